@@ -0,0 +1,259 @@
+#include "../src/gc.h"
+#include "../src/gc_inline.h"
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+  Measures the allocation paths on their own and compares them with two
+  baselines running the same pattern:
+   - gc:     h_alloc_struct / h_alloc_raw, collections included
+   - inline: the same through the fast path of gc_inline.h
+   - malloc: glibc malloc, and free when an object is dropped
+   - arena:  a bump pointer into a fixed block that starts over when full
+
+  Every case allocates ALLOCS objects. The last WINDOW of them stay alive in
+  a ring on the stack, each new object replaces (drops) the oldest, so the
+  collector always has a small live set to keep. The batch cases allocate
+  BATCH objects in a row and then drop all of them at once.
+
+  For every case and allocator it reports nanoseconds and, when the kernel
+  allows perf_event_open, user space instructions per allocation, as a table
+  on stderr and JSON lines on stdout.
+
+  `make bench_alloc` links it with libgc.a and -flto like a program using
+  the packaged library would be.
+
+  usage: ./bench_alloc [allocations per case]
+*/
+
+#define WINDOW 256
+#define BATCH 4096
+#define ARENA_BYTES (4 << 20)
+#define HEAP_BYTES (4 << 20)
+
+typedef enum allocator { GC, GC_INLINE, MALLOC, ARENA } allocator_t;
+
+static const char *allocator_names[] = {"gc", "inline", "malloc", "arena"};
+
+// the layout of the running case, parsed once by h_layout
+static gc_layout_t inline_layout;
+
+typedef struct alloc_case {
+  const char *name;
+  const char *layout; // NULL for a raw allocation of `bytes`
+  size_t bytes;       // what malloc and the arena get for a layout
+  bool batch;
+} alloc_case_t;
+
+static const alloc_case_t cases[] = {
+    {"struct *", "*", 8, false},
+    {"struct *i", "*i", 12, false},
+    {"struct **l", "**l", 24, false},
+    {"struct ********", "********", 64, false},
+    {"raw 16", NULL, 16, false},
+    {"raw 64", NULL, 64, false},
+    {"raw 256", NULL, 256, false},
+    {"raw 1000", NULL, 1000, false},
+    {"batch struct *i", "*i", 12, true},
+    {"batch raw 64", NULL, 64, true},
+};
+
+typedef struct arena {
+  uint8_t *start;
+  size_t used;
+} arena_t;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// a counter of the instructions this thread runs in user space, -1 if the
+// kernel does not allow it (perf_event_paranoid, containers)
+static int open_instruction_counter(void) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void counter_start(int fd) {
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+static long long counter_stop(int fd) {
+  long long count = -1;
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+      count = -1;
+    }
+  }
+  return count;
+}
+
+static void *arena_alloc(arena_t *arena, size_t bytes) {
+  size_t size = (bytes + 15) & ~(size_t)15;
+  if (arena->used + size > ARENA_BYTES) {
+    arena->used = 0;
+  }
+  void *obj = arena->start + arena->used;
+  arena->used += size;
+  return obj;
+}
+
+static void *allocate(allocator_t allocator, const alloc_case_t *c, heap_t *h,
+                      arena_t *arena) {
+  void *obj;
+  switch (allocator) {
+  case GC:
+    obj = c->layout ? h_alloc_struct(h, (char *)c->layout)
+                    : h_alloc_raw(h, c->bytes);
+    break;
+  case GC_INLINE:
+    obj = c->layout ? h_alloc_struct_inline(h, inline_layout)
+                    : h_alloc_raw_inline(h, c->bytes);
+    break;
+  case MALLOC:
+    obj = malloc(c->bytes);
+    break;
+  default:
+    obj = arena_alloc(arena, c->bytes);
+    break;
+  }
+  if (obj == NULL) {
+    fprintf(stderr, "%s: out of memory\n", allocator_names[allocator]);
+    exit(EXIT_FAILURE);
+  }
+  // every allocator pays for touching the new object, a zero is a valid
+  // NULL if the first field is a pointer
+  *(volatile uint64_t *)obj = 0;
+  return obj;
+}
+
+static void drop(allocator_t allocator, void *obj) {
+  if (allocator == MALLOC) {
+    free(obj);
+  }
+}
+
+static void run_window(allocator_t allocator, const alloc_case_t *c, heap_t *h,
+                       arena_t *arena, long allocs) {
+  void *volatile window[WINDOW] = {NULL};
+  for (long i = 0; i < allocs; i++) {
+    size_t slot = i % WINDOW;
+    if (window[slot]) {
+      drop(allocator, window[slot]);
+    }
+    window[slot] = allocate(allocator, c, h, arena);
+  }
+  for (size_t slot = 0; slot < WINDOW; slot++) {
+    if (window[slot]) {
+      drop(allocator, window[slot]);
+    }
+  }
+}
+
+static void run_batch(allocator_t allocator, const alloc_case_t *c, heap_t *h,
+                      arena_t *arena, long allocs) {
+  void **batch = malloc(BATCH * sizeof(void *));
+  for (long done = 0; done < allocs; done += BATCH) {
+    long count = allocs - done < BATCH ? allocs - done : BATCH;
+    for (long i = 0; i < count; i++) {
+      batch[i] = allocate(allocator, c, h, arena);
+    }
+    for (long i = 0; i < count; i++) {
+      drop(allocator, batch[i]);
+    }
+  }
+  free(batch);
+}
+
+static void run(const alloc_case_t *c, allocator_t allocator, long allocs,
+                int counter) {
+  heap_t *h = NULL;
+  if (allocator == GC || allocator == GC_INLINE) {
+    // the batch array is malloc'd and not a root, its objects are only
+    // written right after they are allocated so a collection may take them
+    h = h_init(HEAP_BYTES, false, 0.8);
+    if (c->layout) {
+      inline_layout = h_layout((char *)c->layout);
+    }
+  }
+  arena_t arena = {NULL, 0};
+  if (allocator == ARENA) {
+    arena.start = malloc(ARENA_BYTES);
+  }
+
+  double start = now_ns();
+  counter_start(counter);
+  if (c->batch) {
+    run_batch(allocator, c, h, &arena, allocs);
+  } else {
+    run_window(allocator, c, h, &arena, allocs);
+  }
+  long long instructions = counter_stop(counter);
+  double ns = (now_ns() - start) / allocs;
+  double per_alloc = instructions < 0 ? -1 : (double)instructions / allocs;
+
+  size_t collections = 0;
+  if (h) {
+    gc_stats_t stats;
+    h_stats(h, &stats);
+    collections = stats.collections;
+    h_delete(h);
+  }
+  free(arena.start);
+
+  printf("{\"case\":\"%s\",\"allocator\":\"%s\",\"allocations\":%ld,"
+         "\"ns_per_alloc\":%.2f,\"instructions_per_alloc\":%.1f,"
+         "\"collections\":%zu}\n",
+         c->name, allocator_names[allocator], allocs, ns, per_alloc,
+         collections);
+  fflush(stdout);
+  if (per_alloc < 0) {
+    fprintf(stderr, "%-18s %-8s %10.1f %12s %6zu\n", c->name,
+            allocator_names[allocator], ns, "n/a", collections);
+  } else {
+    fprintf(stderr, "%-18s %-8s %10.1f %12.1f %6zu\n", c->name,
+            allocator_names[allocator], ns, per_alloc, collections);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  long allocs = argc > 1 ? atol(argv[1]) : 200000;
+  if (allocs < 1) {
+    allocs = 1;
+  }
+  int counter = open_instruction_counter();
+  if (counter < 0) {
+    fprintf(stderr, "perf_event_open not allowed, no instruction counts\n");
+  }
+  fprintf(stderr, "%-18s %-8s %10s %12s %6s\n", "case", "alloc", "ns/alloc",
+          "instr/alloc", "GCs");
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    for (allocator_t a = GC; a <= ARENA; a++) {
+      run(&cases[c], a, allocs, counter);
+    }
+  }
+  if (counter >= 0) {
+    close(counter);
+  }
+  return EXIT_SUCCESS;
+}
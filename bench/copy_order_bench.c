@@ -0,0 +1,134 @@
+#include "../src/gc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+  Measures how the copy order of the copying collector affects the speed of
+  the mutator after a collection. The same object graphs are built on two
+  heaps, collected once with COPY_ORDER_BFS and once with COPY_ORDER_DFS, and
+  then traversed repeatedly:
+   - NUM_LISTS linked lists whose nodes are allocated interleaved, like the
+     lists in demos/linked_list_demo.c
+   - a complete binary tree allocated level by level and summed depth first
+
+  usage: ./bench_copy_order [nodes per list] [tree depth] [repeats]
+*/
+
+#define NUM_LISTS 8
+
+typedef struct node node_t;
+struct node {
+  node_t *next;
+  long val;
+};
+
+typedef struct tree tree_t;
+struct tree {
+  tree_t *left;
+  tree_t *right;
+  long val;
+};
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// prepends to every list in turn, so the nodes of one list end up spread out
+static void build_lists(heap_t *h, void **roots, long nodes) {
+  for (long i = 0; i < nodes; i++) {
+    for (int l = 0; l < NUM_LISTS; l++) {
+      node_t *node = h_alloc_struct(h, "*l");
+      node->val = i;
+      node->next = roots[l];
+      roots[l] = node;
+    }
+  }
+}
+
+// allocates the tree level by level (breadth first) and links it afterwards
+static tree_t *build_tree(heap_t *h, int depth) {
+  long count = (1L << depth) - 1;
+  tree_t **nodes = malloc(count * sizeof(tree_t *));
+  for (long i = 0; i < count; i++) {
+    nodes[i] = h_alloc_struct(h, "**l");
+    nodes[i]->val = i;
+  }
+  for (long i = 0; i < count; i++) {
+    if (2 * i + 2 < count) {
+      nodes[i]->left = nodes[2 * i + 1];
+      nodes[i]->right = nodes[2 * i + 2];
+    }
+  }
+  tree_t *root = nodes[0];
+  free(nodes);
+  return root;
+}
+
+static long sum_list(node_t *node) {
+  long sum = 0;
+  while (node != NULL) {
+    sum += node->val;
+    node = node->next;
+  }
+  return sum;
+}
+
+static long sum_tree(tree_t *tree) {
+  if (tree == NULL) {
+    return 0;
+  }
+  return tree->val + sum_tree(tree->left) + sum_tree(tree->right);
+}
+
+static void run(copy_order_t order, const char *name, long nodes, int depth,
+                int repeats) {
+  // live data is 32 bytes per node, the copying collector needs twice that
+  size_t live = (NUM_LISTS * nodes + (1L << depth)) * 32;
+  heap_t *h = h_init(live * 2 + live / 2, false, 1.0);
+  h_set_copy_order(h, order);
+
+  // lists and tree are only reachable through this array on the stack
+  void *roots[NUM_LISTS + 1] = {NULL};
+  build_lists(h, roots, nodes);
+  roots[NUM_LISTS] = build_tree(h, depth);
+
+  double start = now_ns();
+  h_gc(h);
+  double gc_ns = now_ns() - start;
+
+  long checksum = 0;
+  start = now_ns();
+  for (int r = 0; r < repeats; r++) {
+    for (int l = 0; l < NUM_LISTS; l++) {
+      checksum += sum_list(roots[l]);
+    }
+  }
+  double list_ns = (now_ns() - start) / ((double)repeats * NUM_LISTS * nodes);
+
+  start = now_ns();
+  for (int r = 0; r < repeats; r++) {
+    checksum += sum_tree(roots[NUM_LISTS]);
+  }
+  double tree_ns = (now_ns() - start) / ((double)repeats * ((1L << depth) - 1));
+
+  printf("%-6s %18.2f %18.2f %12.2f %20ld\n", name, list_ns, tree_ns,
+         gc_ns / 1e6, checksum);
+  h_delete(h);
+}
+
+int main(int argc, char *argv[]) {
+  long nodes = argc > 1 ? atol(argv[1]) : 8192;
+  int depth = argc > 2 ? atoi(argv[2]) : 16;
+  int repeats = argc > 3 ? atoi(argv[3]) : 20;
+
+  printf("%d lists of %ld nodes, binary tree of depth %d, %d repeats\n",
+         NUM_LISTS, nodes, depth, repeats);
+  printf("%-6s %18s %18s %12s %20s\n", "order", "list ns/node", "tree ns/node",
+         "gc ms", "checksum");
+  run(COPY_ORDER_BFS, "bfs", nodes, depth, repeats);
+  run(COPY_ORDER_DFS, "dfs", nodes, depth, repeats);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,328 @@
+#include "../src/gc.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+  Standard collector workloads, each run once with every collector:
+   - binary_trees: GCBench, a long-lived tree plus many short-lived trees of
+     growing depth built top down
+   - list_churn: the list of demos/linked_list_demo.c, new nodes are
+     prepended and the old end is cut off so the list keeps its length
+   - cache_nursery: a large long-lived cache of entries with values, every
+     step allocates short-lived garbage and now and then replaces an entry
+   - raw_churn: a window of h_alloc_raw buffers of random sizes, a random one
+     is replaced and written every step
+
+  Every run prints one JSON object per line on stdout with the allocation
+  throughput, the number of collections and the pause distribution, and a
+  table on stderr. `make bench` keeps the JSON in bench_output.txt.
+
+  usage: ./gc_bench [scale]   (scale multiplies the work, default 1)
+*/
+
+typedef struct tree tree_t;
+struct tree {
+  tree_t *left;
+  tree_t *right;
+  int i;
+  int j;
+};
+
+typedef struct node node_t;
+struct node {
+  node_t *next;
+  long val;
+};
+
+typedef struct entry entry_t;
+struct entry {
+  entry_t *next;
+  void *value;
+  long key;
+};
+
+typedef struct result {
+  long checksum;
+  size_t pause_count;
+  size_t pause_capacity;
+  uint64_t *pauses; // ns, one per collection
+} result_t;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+// runs with the world stopped, must not touch the heap
+static void record_pause(const gc_event_t *event, void *extra) {
+  result_t *r = extra;
+  if (event->kind != GC_EVENT_END) {
+    return;
+  }
+  if (r->pause_count == r->pause_capacity) {
+    r->pause_capacity = r->pause_capacity ? r->pause_capacity * 2 : 256;
+    r->pauses = realloc(r->pauses, r->pause_capacity * sizeof(uint64_t));
+    if (!r->pauses) {
+      fprintf(stderr, "out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  r->pauses[r->pause_count++] = event->cycle->pause_ns;
+}
+
+static void *checked(void *obj) {
+  if (obj == NULL) {
+    fprintf(stderr, "heap full\n");
+    exit(EXIT_FAILURE);
+  }
+  return obj;
+}
+
+/* binary_trees */
+
+static tree_t *new_tree(heap_t *h, tree_t *left, tree_t *right) {
+  tree_t *tree = checked(h_alloc_struct(h, "**ii"));
+  tree->left = left;
+  tree->right = right;
+  return tree;
+}
+
+static tree_t *bottom_up(heap_t *h, int depth) {
+  if (depth <= 0) {
+    return new_tree(h, NULL, NULL);
+  }
+  tree_t *left = bottom_up(h, depth - 1);
+  return new_tree(h, left, bottom_up(h, depth - 1));
+}
+
+static void top_down(heap_t *h, tree_t *tree, int depth) {
+  if (depth <= 0) {
+    return;
+  }
+  tree->left = new_tree(h, NULL, NULL);
+  tree->right = new_tree(h, NULL, NULL);
+  top_down(h, tree->left, depth - 1);
+  top_down(h, tree->right, depth - 1);
+}
+
+static long count_tree(tree_t *tree) {
+  return tree ? 1 + count_tree(tree->left) + count_tree(tree->right) : 0;
+}
+
+static void binary_trees(heap_t *h, long scale, result_t *r) {
+  int max_depth = 12;
+  int min_depth = 4;
+  tree_t *stretch = bottom_up(h, max_depth + 1);
+  r->checksum += count_tree(stretch);
+  stretch = NULL;
+
+  tree_t *volatile long_lived = bottom_up(h, max_depth);
+  for (long s = 0; s < scale; s++) {
+    for (int depth = min_depth; depth <= max_depth; depth += 2) {
+      long iterations = 1L << (max_depth - depth + min_depth);
+      for (long i = 0; i < iterations; i++) {
+        tree_t *temp = new_tree(h, NULL, NULL);
+        top_down(h, temp, depth);
+        r->checksum += count_tree(temp);
+        r->checksum += count_tree(bottom_up(h, depth));
+      }
+    }
+  }
+  r->checksum += count_tree(long_lived);
+}
+
+/* list_churn */
+
+#define LIST_LENGTH 512
+
+static void list_churn(heap_t *h, long scale, result_t *r) {
+  // the list header is the only root, like the list_t of the demo
+  node_t **volatile list = checked(h_alloc_struct(h, "*"));
+  long steps = 400000 * scale;
+  for (long i = 0; i < steps; i++) {
+    node_t *node = checked(h_alloc_struct(h, "*l"));
+    node->val = i;
+    node->next = *list;
+    *list = node;
+    if (i % LIST_LENGTH == LIST_LENGTH - 1) {
+      // keep the newest nodes, the rest is garbage
+      node_t *last = *list;
+      for (int n = 1; n < LIST_LENGTH && last->next; n++) {
+        last = last->next;
+      }
+      last->next = NULL;
+    }
+  }
+  for (node_t *node = *list; node; node = node->next) {
+    r->checksum += node->val;
+  }
+}
+
+/* cache_nursery */
+
+#define CACHE_BUCKETS 64
+#define CACHE_ENTRIES 4096
+#define CACHE_VALUE 64
+
+static entry_t *new_entry(heap_t *h, long key, entry_t *next) {
+  entry_t *entry = checked(h_alloc_struct(h, "**l"));
+  entry->value = checked(h_alloc_raw(h, CACHE_VALUE));
+  memset(entry->value, (int)key, CACHE_VALUE);
+  entry->key = key;
+  entry->next = next;
+  return entry;
+}
+
+static void cache_nursery(heap_t *h, long scale, result_t *r) {
+  // the bucket heads stay on the stack, the chains live in the heap
+  entry_t *volatile buckets[CACHE_BUCKETS] = {NULL};
+  for (long key = 0; key < CACHE_ENTRIES; key++) {
+    buckets[key % CACHE_BUCKETS] =
+        new_entry(h, key, buckets[key % CACHE_BUCKETS]);
+  }
+
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  long steps = 200000 * scale;
+  for (long i = 0; i < steps; i++) {
+    // short-lived request objects that die right away
+    node_t *request = checked(h_alloc_struct(h, "*l"));
+    request->next = checked(h_alloc_struct(h, "*l"));
+    request->val = i;
+    r->checksum += request->val;
+
+    if (i % 16 == 0) {
+      // replace the head of a random bucket, its old head becomes garbage
+      long bucket = next_random(&state) % CACHE_BUCKETS;
+      entry_t *old = buckets[bucket];
+      buckets[bucket] = new_entry(h, old->key, old->next);
+    }
+  }
+  for (int b = 0; b < CACHE_BUCKETS; b++) {
+    for (entry_t *entry = buckets[b]; entry; entry = entry->next) {
+      r->checksum += entry->key + ((unsigned char *)entry->value)[0];
+    }
+  }
+}
+
+/* raw_churn */
+
+#define RAW_WINDOW 128
+#define RAW_MAX 1024
+
+static void raw_churn(heap_t *h, long scale, result_t *r) {
+  void *volatile window[RAW_WINDOW] = {NULL};
+  size_t sizes[RAW_WINDOW] = {0};
+  uint64_t state = 0x2545f4914f6cdd1dULL;
+  long steps = 300000 * scale;
+  for (long i = 0; i < steps; i++) {
+    size_t slot = next_random(&state) % RAW_WINDOW;
+    size_t size = 16 + next_random(&state) % (RAW_MAX - 16);
+    window[slot] = checked(h_alloc_raw(h, size));
+    memset(window[slot], (int)i, size);
+    sizes[slot] = size;
+  }
+  for (int s = 0; s < RAW_WINDOW; s++) {
+    if (window[s]) {
+      r->checksum += sizes[s] + ((unsigned char *)window[s])[sizes[s] - 1];
+    }
+  }
+}
+
+typedef struct workload {
+  const char *name;
+  size_t heap_bytes;
+  void (*run)(heap_t *h, long scale, result_t *r);
+} workload_t;
+
+static const workload_t workloads[] = {
+    {"binary_trees", 2 << 20, binary_trees},
+    {"list_churn", 1 << 20, list_churn},
+    {"cache_nursery", 4 << 20, cache_nursery},
+    {"raw_churn", 2 << 20, raw_churn},
+};
+
+static const struct {
+  gc_mode_t mode;
+  const char *name;
+} modes[] = {
+    {GC_MODE_COPYING, "copying"},
+    {GC_MODE_SLIDING, "sliding"},
+    {GC_MODE_MARK_REGION, "mark_region"},
+};
+
+static int by_value(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// nearest rank percentile of the sorted pauses, in microseconds
+static double percentile_us(const result_t *r, int percent) {
+  if (r->pause_count == 0) {
+    return 0;
+  }
+  size_t rank = (r->pause_count * percent + 99) / 100;
+  return r->pauses[rank > 0 ? rank - 1 : 0] / 1e3;
+}
+
+static void run(const workload_t *w, size_t m, long scale) {
+  heap_t *h = h_init(w->heap_bytes, false, 0.8);
+  h_set_gc_mode(h, modes[m].mode);
+  result_t r = {0};
+  h_set_event_hook(h, record_pause, &r);
+
+  double start = now_ns();
+  w->run(h, scale, &r);
+  double seconds = (now_ns() - start) / 1e9;
+
+  gc_stats_t stats;
+  h_stats(h, &stats);
+  qsort(r.pauses, r.pause_count, sizeof(uint64_t), by_value);
+  double mb_per_s = stats.bytes_allocated / seconds / (1 << 20);
+  double p50 = percentile_us(&r, 50);
+  double p99 = percentile_us(&r, 99);
+  double max = percentile_us(&r, 100);
+
+  printf("{\"workload\":\"%s\",\"mode\":\"%s\",\"heap_bytes\":%zu,"
+         "\"seconds\":%.6f,\"objects_allocated\":%zu,"
+         "\"bytes_allocated\":%zu,\"alloc_mb_per_s\":%.2f,"
+         "\"collections\":%zu,\"gc_seconds\":%.6f,\"pause_p50_us\":%.2f,"
+         "\"pause_p99_us\":%.2f,\"pause_max_us\":%.2f,\"checksum\":%ld}\n",
+         w->name, modes[m].name, w->heap_bytes, seconds,
+         stats.objects_allocated, stats.bytes_allocated, mb_per_s,
+         stats.collections, stats.total.pause_ns / 1e9, p50, p99, max,
+         r.checksum);
+  fflush(stdout);
+  fprintf(stderr, "%-14s %-12s %10.1f %8zu %10.1f %10.1f %10.1f\n", w->name,
+          modes[m].name, mb_per_s, stats.collections, p50, p99, max);
+
+  free(r.pauses);
+  h_delete(h);
+}
+
+int main(int argc, char *argv[]) {
+  long scale = argc > 1 ? atol(argv[1]) : 1;
+  if (scale < 1) {
+    scale = 1;
+  }
+  fprintf(stderr, "%-14s %-12s %10s %8s %10s %10s %10s\n", "workload", "mode",
+          "MB/s", "GCs", "p50 us", "p99 us", "max us");
+  for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+      run(&workloads[w], m, scale);
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,303 @@
+#include "../src/gc.h"
+#include "../src/trace.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+  Replays a trace recorded with h_trace_start against a collector
+  configuration of choice, so that policies can be compared on the object
+  graphs of a real program.
+
+  Every allocation, pointer store and explicit h_gc of the trace is done
+  again in the same order. The replay has no stack of its own, every object
+  is kept in a root range from its allocation until its death record, so the
+  live set follows the recorded one at the granularity of the recorded
+  collections. Collections triggered by the policy happen wherever the
+  configuration being measured decides. The heap needs room for what died
+  between two recorded collections, the copying collector for twice that.
+
+  The result is one JSON line on stdout like the ones of gc_bench.
+
+  usage: ./trace_replay <trace> [copying|sliding|mark_region] [heap bytes]
+                        [gc threshold]
+*/
+
+#define NO_SLOT ((size_t)-1)
+
+typedef struct replay {
+  heap_t *heap;
+  void **live;        // root range, a slot per object that is alive
+  size_t live_capacity;
+  size_t *free_slots; // slots of dead objects, reused first
+  size_t free_count;
+  size_t used_slots;
+  size_t *slot_of;    // by object number, NO_SLOT once dead
+  size_t id_capacity;
+  size_t next_id;
+  size_t pause_count;
+  size_t pause_capacity;
+  uint64_t *pauses;
+} replay_t;
+
+typedef struct reader {
+  const uint8_t *data;
+  size_t size;
+  size_t pos;
+} reader_t;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *grow(void *array, size_t *capacity, size_t element) {
+  *capacity = *capacity ? *capacity * 2 : 1024;
+  array = realloc(array, *capacity * element);
+  if (!array) {
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return array;
+}
+
+static void fail(const char *message) {
+  fprintf(stderr, "%s\n", message);
+  exit(EXIT_FAILURE);
+}
+
+static uint64_t get_varint(reader_t *r) {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (r->pos >= r->size) {
+      fail("truncated trace");
+    }
+    uint8_t byte = r->data[r->pos++];
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  fail("bad varint in trace");
+  return 0;
+}
+
+// runs with the world stopped, must not touch the heap
+static void record_pause(const gc_event_t *event, void *extra) {
+  replay_t *rp = extra;
+  if (event->kind != GC_EVENT_END) {
+    return;
+  }
+  if (rp->pause_count == rp->pause_capacity) {
+    rp->pauses = grow(rp->pauses, &rp->pause_capacity, sizeof(uint64_t));
+  }
+  rp->pauses[rp->pause_count++] = event->cycle->pause_ns;
+}
+
+// the live slots are a root range, it is registered again when it moves
+static size_t take_slot(replay_t *rp) {
+  if (rp->free_count > 0) {
+    return rp->free_slots[--rp->free_count];
+  }
+  if (rp->used_slots == rp->live_capacity) {
+    if (rp->live) {
+      h_remove_root_range(rp->heap, rp->live);
+    }
+    size_t old = rp->live_capacity;
+    rp->live = grow(rp->live, &rp->live_capacity, sizeof(void *));
+    memset(rp->live + old, 0, (rp->live_capacity - old) * sizeof(void *));
+    h_add_root_range(rp->heap, rp->live, rp->live + rp->live_capacity);
+    rp->free_slots =
+        realloc(rp->free_slots, rp->live_capacity * sizeof(size_t));
+    if (!rp->free_slots) {
+      fail("out of memory");
+    }
+  }
+  return rp->used_slots++;
+}
+
+static void *object(replay_t *rp, uint64_t id) {
+  if (id == 0 || id >= rp->next_id || rp->slot_of[id] == NO_SLOT) {
+    return NULL;
+  }
+  return rp->live[rp->slot_of[id]];
+}
+
+static void allocated(replay_t *rp, void *obj) {
+  if (!obj) {
+    fail("heap full, try a bigger heap");
+  }
+  if (rp->next_id >= rp->id_capacity) {
+    rp->slot_of = grow(rp->slot_of, &rp->id_capacity, sizeof(size_t));
+  }
+  size_t slot = take_slot(rp);
+  rp->live[slot] = obj;
+  rp->slot_of[rp->next_id++] = slot;
+}
+
+static size_t replay(replay_t *rp, reader_t *r) {
+  char *layout = NULL;
+  size_t layout_capacity = 0;
+  size_t records = 0;
+  rp->next_id = 1;
+  while (r->pos < r->size) {
+    uint8_t tag = r->data[r->pos++];
+    records++;
+    switch (tag) {
+    case TRACE_ALLOC_STRUCT: {
+      size_t length = get_varint(r);
+      if (length > r->size - r->pos) {
+        fail("truncated trace");
+      }
+      while (length + 1 > layout_capacity) {
+        layout = grow(layout, &layout_capacity, 1);
+      }
+      memcpy(layout, r->data + r->pos, length);
+      layout[length] = '\0';
+      r->pos += length;
+      allocated(rp, h_alloc_struct(rp->heap, layout));
+      break;
+    }
+    case TRACE_ALLOC_RAW:
+      allocated(rp, h_alloc_raw(rp->heap, get_varint(r)));
+      break;
+    case TRACE_STORE: {
+      uint64_t id = get_varint(r);
+      uint64_t offset = get_varint(r);
+      uint64_t value_id = get_varint(r);
+      uint64_t value_offset = get_varint(r);
+      uint8_t *obj = object(rp, id);
+      uint8_t *value = object(rp, value_id);
+      if (obj) {
+        *(void **)(obj + offset) = value ? value + value_offset : NULL;
+      }
+      break;
+    }
+    case TRACE_DEATH: {
+      uint64_t id = get_varint(r);
+      if (object(rp, id)) {
+        rp->live[rp->slot_of[id]] = NULL;
+        rp->free_slots[rp->free_count++] = rp->slot_of[id];
+        rp->slot_of[id] = NO_SLOT;
+      }
+      break;
+    }
+    case TRACE_GC:
+      h_gc(rp->heap);
+      break;
+    case TRACE_END:
+      free(layout);
+      return records;
+    default:
+      fail("unknown record in trace");
+    }
+  }
+  fail("trace has no end record");
+  return 0;
+}
+
+static int by_value(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// nearest rank percentile of the sorted pauses, in microseconds
+static double percentile_us(const replay_t *rp, int percent) {
+  if (rp->pause_count == 0) {
+    return 0;
+  }
+  size_t rank = (rp->pause_count * percent + 99) / 100;
+  return rp->pauses[rank > 0 ? rank - 1 : 0] / 1e3;
+}
+
+static uint8_t *read_file(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  size_t capacity = 0;
+  uint8_t *data = NULL;
+  *size = 0;
+  for (;;) {
+    if (*size == capacity) {
+      data = grow(data, &capacity, 1);
+    }
+    size_t n = fread(data + *size, 1, capacity - *size, file);
+    if (n == 0) {
+      break;
+    }
+    *size += n;
+  }
+  fclose(file);
+  return data;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "usage: %s <trace> [copying|sliding|mark_region] [heap bytes] "
+            "[gc threshold]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  const char *mode_name = argc > 2 ? argv[2] : "copying";
+  gc_mode_t mode = GC_MODE_COPYING;
+  if (strcmp(mode_name, "sliding") == 0) {
+    mode = GC_MODE_SLIDING;
+  } else if (strcmp(mode_name, "mark_region") == 0) {
+    mode = GC_MODE_MARK_REGION;
+  } else if (strcmp(mode_name, "copying") != 0) {
+    fail("unknown collector, use copying, sliding or mark_region");
+  }
+
+  reader_t r = {0};
+  uint8_t *data = read_file(argv[1], &r.size);
+  r.data = data;
+  if (r.size < TRACE_MAGIC_SIZE ||
+      memcmp(data, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0) {
+    fail("not a trace");
+  }
+  r.pos = TRACE_MAGIC_SIZE;
+  size_t heap_bytes = get_varint(&r);
+  if (argc > 3) {
+    heap_bytes = strtoull(argv[3], NULL, 10);
+  }
+  float threshold = argc > 4 ? strtof(argv[4], NULL) : 0.8f;
+
+  replay_t rp = {0};
+  rp.heap = h_init(heap_bytes, false, threshold);
+  h_set_gc_mode(rp.heap, mode);
+  h_set_event_hook(rp.heap, record_pause, &rp);
+
+  double start = now_ns();
+  size_t records = replay(&rp, &r);
+  double seconds = (now_ns() - start) / 1e9;
+
+  gc_stats_t stats;
+  h_stats(rp.heap, &stats);
+  qsort(rp.pauses, rp.pause_count, sizeof(uint64_t), by_value);
+  printf("{\"trace\":\"%s\",\"mode\":\"%s\",\"heap_bytes\":%zu,"
+         "\"records\":%zu,\"seconds\":%.6f,\"objects_allocated\":%zu,"
+         "\"bytes_allocated\":%zu,\"alloc_mb_per_s\":%.2f,"
+         "\"collections\":%zu,\"gc_seconds\":%.6f,\"pause_p50_us\":%.2f,"
+         "\"pause_p99_us\":%.2f,\"pause_max_us\":%.2f,\"live_bytes\":%zu}\n",
+         argv[1], mode_name, heap_bytes, records, seconds,
+         stats.objects_allocated, stats.bytes_allocated,
+         stats.bytes_allocated / seconds / (1 << 20), stats.collections,
+         stats.total.pause_ns / 1e9, percentile_us(&rp, 50),
+         percentile_us(&rp, 99), percentile_us(&rp, 100), h_used(rp.heap));
+
+  h_remove_root_range(rp.heap, rp.live);
+  h_delete(rp.heap);
+  free(rp.live);
+  free(rp.free_slots);
+  free(rp.slot_of);
+  free(rp.pauses);
+  free(data);
+  return EXIT_SUCCESS;
+}
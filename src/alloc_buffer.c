@@ -0,0 +1,78 @@
+#include "alloc_buffer.h"
+#include "allocation.h"
+#include "compacting.h"
+#include "gc_policy.h"
+#include "gc_stats.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// gc_inline.h reads the buffer through the heap pointer
+_Static_assert(offsetof(heap_t, alloc_buffer) == 0,
+               "the allocation buffer must be the first member of heap_t");
+
+void alloc_buffer_open(heap_t *h, void *obj) {
+  if (h->profile || h->trace || h->threads->count > 0) {
+    return;
+  }
+  gc_policy_state_t *policy = &h->gc_policy;
+  if (policy->used_bytes >= policy->trigger_bytes) {
+    return;
+  }
+  size_t budget = policy->trigger_bytes - policy->used_bytes;
+
+  size_t page_index = ((uint8_t *)obj - (uint8_t *)h->heap_start) / PAGE_SIZE;
+  page_t *page = h->page_array[page_index];
+  uint8_t *start = page->next_empty_space;
+  size_t size = page->remaining_size < budget ? page->remaining_size : budget;
+  size -= size % MIN_OBJECT_SIZE;
+
+  // stop at the first blacklisted slot, no object of the buffer may cover it
+  int slot = (start - (uint8_t *)h->heap_start) / MIN_OBJECT_SIZE;
+  for (size_t offset = 0; offset < size; offset += MIN_OBJECT_SIZE) {
+    if (get_bit_in_alloc_map(h->black_map, slot++)) {
+      size = offset;
+      break;
+    }
+  }
+  if (size < MIN_OBJECT_SIZE) {
+    return;
+  }
+
+  page->next_empty_space = start + size;
+  page->remaining_size -= size;
+  h->alloc_buffer_start = start;
+  h->alloc_buffer.next = start;
+  h->alloc_buffer.limit = start + size;
+}
+
+void alloc_buffer_retire(heap_t *h) {
+  uint8_t *start = h->alloc_buffer_start;
+  if (!start) {
+    return;
+  }
+  uint8_t *end = h->alloc_buffer.next;
+  uint8_t *limit = h->alloc_buffer.limit;
+  size_t page_index = (start - (uint8_t *)h->heap_start) / PAGE_SIZE;
+  page_t *page = h->page_array[page_index];
+
+  if (end > start) {
+    int first_slot = (start - (uint8_t *)h->heap_start) / MIN_OBJECT_SIZE;
+    // the objects are back to back, one run in the alloc_map covers them
+    set_bits_in_alloc_map(h->alloc_map, first_slot, end - start);
+    for (uint8_t *header = start; header < end;) {
+      size_t total_size = object_total_size(header + HEADER_SIZE);
+      int slot = (header - (uint8_t *)h->heap_start) / MIN_OBJECT_SIZE;
+      set_bits_in_alloc_map(h->start_map, slot, MIN_OBJECT_SIZE);
+      gc_stats_note_allocation(h, total_size);
+      header += total_size;
+    }
+    gc_policy_note_allocation(h, end - start);
+  }
+
+  // the unused rest is free space of the page again
+  page->next_empty_space = end;
+  page->remaining_size += limit - end;
+  h->alloc_buffer_start = NULL;
+  h->alloc_buffer.next = NULL;
+  h->alloc_buffer.limit = NULL;
+}
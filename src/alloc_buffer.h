@@ -0,0 +1,43 @@
+#pragma once
+
+#include "gc.h"
+#include "heap.h"
+
+/**
+ * Allocation buffer
+ *
+ * The inline fast path of `gc_inline.h` bumps `heap->alloc_buffer.next`
+ * towards `limit` without taking the lock or touching the maps. The buffer is
+ * a run of free space reserved in the page that the last refill allocated in:
+ * the page already counts it as used, so nothing else is placed there.
+ *
+ * The objects of the buffer are made known to the heap when it is retired,
+ * which every `heap_lock` does before anything else runs. That sets their
+ * alloc_map and start_map bits, counts them for the GC policy and the
+ * statistics, and gives the unused rest back to the page. A collection, a
+ * census or any other walk of the maps therefore never sees a buffer.
+ *
+ * A buffer is only opened when nothing needs to see every allocation as it
+ * happens: no allocation profiler, no trace and no attached threads (a heap
+ * shared by threads must be used only through the locked calls). It never
+ * reaches past what the GC policy still allows before the next collection,
+ * nor over a blacklisted slot, so objects end up where the locked path would
+ * have put them.
+ */
+
+/**
+ * @brief Opens a buffer at the free space of the page `obj` was allocated in,
+ * if the heap allows one.
+ *
+ * @param h   Pointer to the heap, locked and with no buffer.
+ * @param obj An object that was just allocated.
+ */
+void alloc_buffer_open(heap_t *h, void *obj);
+
+/**
+ * @brief Publishes the objects of the buffer to the maps, the policy and the
+ * statistics and closes it. Does nothing if no buffer is open.
+ *
+ * @param h Pointer to the heap, locked.
+ */
+void alloc_buffer_retire(heap_t *h);
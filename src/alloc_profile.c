@@ -0,0 +1,269 @@
+#include "alloc_profile.h"
+#include "gc_policy.h"
+#include "threads.h"
+#include <assert.h>
+#include <execinfo.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// exponentially distributed with mean `mean_bytes`, at least 1
+static int64_t next_distance(alloc_profile_t *p) {
+  // xorshift64*
+  p->rng ^= p->rng >> 12;
+  p->rng ^= p->rng << 25;
+  p->rng ^= p->rng >> 27;
+  uint64_t r = p->rng * 0x2545f4914f6cdd1dULL;
+  // uniform in (0, 1]
+  double u = (double)((r >> 11) + 1) / (double)(1ULL << 53);
+  int64_t distance = (int64_t)(-log(u) * (double)p->mean_bytes);
+  return distance > 0 ? distance : 1;
+}
+
+static uint64_t hash_frames(void **frames, int depth) {
+  // FNV-1a over the addresses
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < depth; i++) {
+    hash ^= (uint64_t)(uintptr_t)frames[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static void grow_table(alloc_profile_t *p) {
+  size_t size = p->table_size ? p->table_size * 2 : 64;
+  size_t *table = calloc(size, sizeof(size_t));
+  if (!table) {
+    assert(!"Could not grow the allocation sites");
+  }
+  for (size_t i = 0; i < p->site_count; i++) {
+    size_t slot = p->sites[i].hash & (size - 1);
+    while (table[slot]) {
+      slot = (slot + 1) & (size - 1);
+    }
+    table[slot] = i + 1;
+  }
+  free(p->table);
+  p->table = table;
+  p->table_size = size;
+}
+
+// index of the site with these frames, added if it is new
+static size_t find_site(alloc_profile_t *p, void **frames, int depth) {
+  uint64_t hash = hash_frames(frames, depth);
+  size_t slot = hash & (p->table_size - 1);
+  while (p->table[slot]) {
+    alloc_site_t *site = &p->sites[p->table[slot] - 1];
+    if (site->hash == hash && site->depth == depth &&
+        memcmp(site->frames, frames, depth * sizeof(void *)) == 0) {
+      return p->table[slot] - 1;
+    }
+    slot = (slot + 1) & (p->table_size - 1);
+  }
+
+  if (p->site_count == p->site_capacity) {
+    size_t capacity = p->site_capacity ? p->site_capacity * 2 : 32;
+    alloc_site_t *sites = realloc(p->sites, capacity * sizeof(alloc_site_t));
+    if (!sites) {
+      assert(!"Could not grow the allocation sites");
+    }
+    p->sites = sites;
+    p->site_capacity = capacity;
+  }
+  size_t index = p->site_count++;
+  alloc_site_t *site = &p->sites[index];
+  *site = (alloc_site_t){.depth = depth, .hash = hash};
+  memcpy(site->frames, frames, depth * sizeof(void *));
+  p->table[slot] = index + 1;
+  // at most half full
+  if (2 * p->site_count > p->table_size) {
+    grow_table(p);
+  }
+  return index;
+}
+
+__attribute__((noinline)) void alloc_profile_sample(heap_t *h, void *obj,
+                                                    size_t bytes) {
+  alloc_profile_t *p = h->profile;
+  // every point inside the object counts, the overshoot is kept
+  size_t points = 0;
+  while (p->countdown <= 0) {
+    points++;
+    p->countdown += next_distance(p);
+  }
+
+  // the first frame is this function
+  void *frames[PROFILE_MAX_FRAMES + 1];
+  int depth = backtrace(frames, PROFILE_MAX_FRAMES + 1) - 1;
+  size_t index = find_site(p, frames + 1, depth > 0 ? depth : 0);
+  alloc_site_t *site = &p->sites[index];
+  site->samples++;
+  site->sample_bytes += bytes;
+  site->points += points;
+  site->live_samples++;
+  site->live_sample_bytes += bytes;
+  site->live_points += points;
+
+  if (p->sample_count == p->sample_capacity) {
+    size_t capacity = p->sample_capacity ? p->sample_capacity * 2 : 64;
+    alloc_sample_t *samples =
+        realloc(p->samples, capacity * sizeof(alloc_sample_t));
+    if (!samples) {
+      assert(!"Could not grow the allocation samples");
+    }
+    p->samples = samples;
+    p->sample_capacity = capacity;
+  }
+  p->samples[p->sample_count++] =
+      (alloc_sample_t){.obj = obj, .bytes = bytes, .points = points,
+                       .site = index};
+}
+
+void alloc_profile_update(heap_t *h, alloc_profile_where_function *where,
+                          void *extra) {
+  alloc_profile_t *p = h->profile;
+  if (!p) {
+    return;
+  }
+  for (size_t i = 0; i < p->site_count; i++) {
+    p->sites[i].live_samples = 0;
+    p->sites[i].live_sample_bytes = 0;
+    p->sites[i].live_points = 0;
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < p->sample_count; i++) {
+    alloc_sample_t sample = p->samples[i];
+    sample.obj = where(h, sample.obj, extra);
+    if (!sample.obj) {
+      continue;
+    }
+    alloc_site_t *site = &p->sites[sample.site];
+    site->live_samples++;
+    site->live_sample_bytes += sample.bytes;
+    site->live_points += sample.points;
+    p->samples[kept++] = sample;
+  }
+  p->sample_count = kept;
+}
+
+void alloc_profile_destroy(heap_t *h) {
+  alloc_profile_t *p = h->profile;
+  if (!p) {
+    return;
+  }
+  free(p->sites);
+  free(p->table);
+  free(p->samples);
+  free(p);
+  h->profile = NULL;
+}
+
+void h_set_alloc_sampling(heap_t *heap, size_t mean_bytes) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  heap_lock(heap);
+  alloc_profile_destroy(heap);
+  if (mean_bytes > 0) {
+    alloc_profile_t *p = calloc(1, sizeof(alloc_profile_t));
+    if (!p) {
+      assert(!"Could not allocate the allocation profile");
+    }
+    p->mean_bytes = mean_bytes;
+    p->rng = (gc_clock_ns() ^ (uintptr_t)heap) | 1;
+    p->countdown = next_distance(p);
+    grow_table(p);
+    heap->profile = p;
+  }
+  heap_unlock(heap);
+}
+
+static int by_allocated_bytes(const void *a, const void *b) {
+  const alloc_site_t *x = *(const alloc_site_t *const *)a;
+  const alloc_site_t *y = *(const alloc_site_t *const *)b;
+  return (x->points < y->points) - (x->points > y->points);
+}
+
+static void write_table(alloc_profile_t *p, FILE *out) {
+  alloc_site_t **order = malloc((p->site_count + 1) * sizeof(alloc_site_t *));
+  if (!order) {
+    assert(!"Could not sort the allocation sites");
+  }
+  for (size_t i = 0; i < p->site_count; i++) {
+    order[i] = &p->sites[i];
+  }
+  qsort(order, p->site_count, sizeof(alloc_site_t *), by_allocated_bytes);
+
+  fprintf(out, "allocation profile, one sample per %zu bytes\n",
+          p->mean_bytes);
+  fprintf(out, "%14s %14s %8s  %s\n", "allocated", "retained", "samples",
+          "site");
+  for (size_t i = 0; i < p->site_count; i++) {
+    alloc_site_t *site = order[i];
+    fprintf(out, "%14zu %14zu %8zu ", site->points * p->mean_bytes,
+            site->live_points * p->mean_bytes, site->samples);
+    char **names = backtrace_symbols(site->frames, site->depth);
+    for (int f = 0; f < site->depth; f++) {
+      fprintf(out, "%*s %s\n", f == 0 ? 0 : 39, "",
+              names ? names[f] : "?");
+    }
+    if (site->depth == 0) {
+      fprintf(out, " ?\n");
+    }
+    free(names);
+  }
+  free(order);
+}
+
+static void write_pprof(alloc_profile_t *p, FILE *out) {
+  size_t samples = 0, sample_bytes = 0, live_samples = 0, live_bytes = 0;
+  for (size_t i = 0; i < p->site_count; i++) {
+    samples += p->sites[i].samples;
+    sample_bytes += p->sites[i].sample_bytes;
+    live_samples += p->sites[i].live_samples;
+    live_bytes += p->sites[i].live_sample_bytes;
+  }
+  fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+          live_samples, live_bytes, samples, sample_bytes, p->mean_bytes);
+  for (size_t i = 0; i < p->site_count; i++) {
+    alloc_site_t *site = &p->sites[i];
+    fprintf(out, "%zu: %zu [%zu: %zu] @", site->live_samples,
+            site->live_sample_bytes, site->samples, site->sample_bytes);
+    for (int f = 0; f < site->depth; f++) {
+      fprintf(out, " 0x%" PRIxPTR, (uintptr_t)site->frames[f]);
+    }
+    fprintf(out, "\n");
+  }
+
+  // pprof needs the mappings to symbolize the addresses
+  fprintf(out, "\nMAPPED_LIBRARIES:\n");
+  FILE *maps = fopen("/proc/self/maps", "r");
+  if (maps) {
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), maps)) > 0) {
+      fwrite(buffer, 1, n, out);
+    }
+    fclose(maps);
+  }
+}
+
+bool h_dump_alloc_profile(heap_t *heap, const char *path, bool pprof) {
+  if (!heap || !path) {
+    assert(!"invalid heap or path");
+  }
+  heap_lock(heap);
+  alloc_profile_t *p = heap->profile;
+  FILE *out = p ? fopen(path, "w") : NULL;
+  if (out) {
+    if (pprof) {
+      write_pprof(p, out);
+    } else {
+      write_table(p, out);
+    }
+  }
+  heap_unlock(heap);
+  return out && fclose(out) == 0;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "gc.h"
+#include "heap.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Sampling allocation profiler
+ *
+ * With `h_set_alloc_sampling(h, mean)` the allocation stream is sampled like
+ * tcmalloc does it: sampling points are put into the allocated bytes at
+ * random, exponentially distributed distances with the given mean, and an
+ * object that a point falls in is sampled. Its backtrace is recorded as a
+ * call site and the object is followed through every collection (the
+ * collectors report where it moved, or that it died), so each site has the
+ * volume allocated from it and the bytes of it still retained.
+ *
+ * Every point stands for `mean` allocated bytes, so a site's sampled points
+ * times `mean` estimates what it allocated. An allocation between two points
+ * only subtracts its size from a counter, a backtrace is only taken for a
+ * sample, so a mean of a few hundred KiB keeps the overhead low.
+ *
+ * `h_dump_alloc_profile` writes either a table per site or the legacy text
+ * heap profile of gperftools that `pprof` reads.
+ */
+
+/**
+ * @brief Records a sampled object, called when a sampling point fell in it.
+ *
+ * @param h     Pointer to the heap.
+ * @param obj   The new object (pointer just after its header).
+ * @param bytes Its size including header and padding.
+ */
+void alloc_profile_sample(heap_t *h, void *obj, size_t bytes);
+
+/**
+ * @brief Counts an allocation towards the next sampling point.
+ *
+ * @param h     Pointer to the heap.
+ * @param obj   The new object (pointer just after its header).
+ * @param bytes Its size including header and padding.
+ */
+static inline void alloc_profile_note(heap_t *h, void *obj, size_t bytes) {
+  alloc_profile_t *p = h->profile;
+  if (p && (p->countdown -= (int64_t)bytes) <= 0) {
+    alloc_profile_sample(h, obj, bytes);
+  }
+}
+
+/// Where a collector put an object, NULL if the object is dead.
+typedef void *alloc_profile_where_function(heap_t *h, void *obj, void *extra);
+
+/**
+ * @brief Follows the sampled objects through a collection.
+ *
+ * Called by the collectors while they still know what moved where, dead
+ * samples are dropped and the retained counts of the sites recomputed. Does
+ * nothing when sampling is off.
+ *
+ * @param h     Pointer to the heap.
+ * @param where Gives the new address (or NULL) of a sampled object.
+ * @param extra Passed to `where`.
+ */
+void alloc_profile_update(heap_t *h, alloc_profile_where_function *where,
+                          void *extra);
+
+/**
+ * @brief Frees the profile of a heap and turns sampling off.
+ *
+ * @param h Pointer to the heap.
+ */
+void alloc_profile_destroy(heap_t *h);
+
+/**
+ * @brief Starts sampling allocations, or stops it.
+ *
+ * Discards what was sampled before.
+ *
+ * @param heap       A pointer to the heap.
+ * @param mean_bytes Mean distance in bytes between two samples, e.g. 512 KiB,
+ * 0 turns sampling off.
+ */
+void h_set_alloc_sampling(heap_t *heap, size_t mean_bytes);
+
+/**
+ * @brief Writes the allocation profile to a file.
+ *
+ * The table lists, per call site with the biggest first, the estimated
+ * allocated bytes, the estimated bytes retained after the last collection,
+ * the number of samples and the symbolized backtrace. The pprof format has
+ * the raw samples with a `heap_v2/<mean>` header, `pprof` scales them back
+ * up and symbolizes with the mappings written at the end.
+ *
+ * @param heap  A pointer to the heap.
+ * @param path  File to (over)write.
+ * @param pprof true for the pprof format, false for the table.
+ * @return false if sampling is off or the file could not be written.
+ */
+bool h_dump_alloc_profile(heap_t *heap, const char *path, bool pprof);
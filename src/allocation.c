@@ -1,10 +1,16 @@
 #include "allocation.h"
+#include "alloc_buffer.h"
+#include "alloc_profile.h"
 #include "compacting.h"
-#include "debug.h"
+#include "gc_events.h"
+#include "gc_policy.h"
+#include "gc_stats.h"
+#include "mark_region.h"
+#include "threads.h"
+#include "trace.h"
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
-#include <stdio.h>
 
 void set_bit_vector(layout_bitvector_t *lbv, int field_index) {
   if (field_index >= 0 && field_index < HEADER_SIZE * 8) {
@@ -57,26 +63,86 @@ void set_layout_header(char *layout, void *header_pos) {
   bv->bit_vector |= (1ULL << 2) | (1ULL << 1) | (1ULL << 0);
 }
 
+// in mark-region mode a page can have more free holes after the one that is
+// being bump allocated into, moves the page to the first one that fits size
+static bool move_to_next_hole(page_t *page, size_t size) {
+  uint8_t *limit = (uint8_t *)page->next_empty_space + page->remaining_size;
+  int from_line = (limit - (uint8_t *)page->page_start) / LINE_SIZE;
+  int hole_lines;
+  int hole = find_hole(page->line_marks, from_line, size, &hole_lines);
+  if (hole < 0) {
+    return false;
+  }
+  page->next_empty_space = (uint8_t *)page->page_start + hole * LINE_SIZE;
+  page->remaining_size = hole_lines * LINE_SIZE;
+  return true;
+}
+
+// true if an object of `size` bytes at `header` would be kept alive by a
+// word the last scan blacklisted, only its start counts unless interior
+// pointers are accepted
+static bool is_blacklisted(heap_t *heap, uint8_t *header, size_t size) {
+  int slot = (header - (uint8_t *)heap->heap_start) / MIN_OBJECT_SIZE;
+  int slots = heap->interior_pointers ? size / MIN_OBJECT_SIZE : 1;
+  for (int i = 0; i < slots; i++) {
+    if (get_bit_in_alloc_map(heap->black_map, slot + i)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// checks if `size` bytes fit in the free space of the page, the space is
+// first moved past slots that are blacklisted
+static bool fits_in_page(heap_t *heap, page_t *page, size_t size) {
+  size_t skip = 0;
+  while (skip + size <= page->remaining_size &&
+         is_blacklisted(heap, (uint8_t *)page->next_empty_space + skip,
+                        size)) {
+    skip += MIN_OBJECT_SIZE;
+  }
+  if (skip + size > page->remaining_size) {
+    return false;
+  }
+  // the skipped slots stay free and are reclaimed with the page
+  page->next_empty_space = (uint8_t *)page->next_empty_space + skip;
+  page->remaining_size -= skip;
+  return true;
+}
+
 int find_next_available(heap_t *heap, size_t size) {
   // Iterera genom page-array
   page_t **arr = heap->page_array;
+  size_t active_pages = 0;
   for (size_t i = 0; i < heap->page_amount; i++) {
     page_t *page = arr[i];
     // Kolla om aktiv
     if (page->is_active) {
+      active_pages++;
       // Jämför storlek på objekt mot remaining size
-      if (size <= page->remaining_size) {
+      if (fits_in_page(heap, page, size)) {
         return (int)i;
       }
+      while (heap->gc_mode == GC_MODE_MARK_REGION &&
+             move_to_next_hole(page, size)) {
+        if (fits_in_page(heap, page, size)) {
+          return (int)i;
+        }
+      }
     } else {
     }
   }
+  // the copying collector needs a passive page for every active one
+  if (heap->gc_mode == GC_MODE_COPYING &&
+      !copy_reserve_allows(heap->page_amount, active_pages + 1)) {
+    return -1;
+  }
   for (size_t i = 0; i < heap->page_amount; i++) {
     page_t *page = arr[i];
     // Kolla om passiv
     if (!page->is_active) {
       // Jämför storlek på objekt mot remaining size
-      if (size <= page->remaining_size) {
+      if (fits_in_page(heap, page, size)) {
         // set page status to active and return
         page->is_active = 1;
         return (int)i;
@@ -87,6 +153,28 @@ int find_next_available(heap_t *heap, size_t size) {
   return -1;
 }
 
+bool copy_reserve_allows(size_t page_amount, size_t active_pages) {
+  // a single page can never be copied anywhere, such a heap is always
+  // collected without moving
+  if (page_amount < 2) {
+    return true;
+  }
+  return active_pages <= page_amount - active_pages;
+}
+
+// finds a page for total_size bytes, collecting once if the heap is full
+static int find_page_for_allocation(heap_t *h, size_t total_size) {
+  int page_index = find_next_available(h, total_size);
+  if (page_index == -1) {
+    gc_collect(h);
+    page_index = find_next_available(h, total_size);
+    if (page_index == -1) {
+      gc_event_emit(h, GC_EVENT_HEAP_FULL, total_size);
+    }
+  }
+  return page_index;
+}
+
 size_t object_size(char *layout) {
   size_t size_layout = 0;
   int index = 0;
@@ -126,15 +214,18 @@ void set_bits_in_alloc_map(uint64_t *alloc_map, int start_index, int bytes) {
   }
 }
 
-void *h_alloc_struct(heap_t *h, char *layout) {
-  size_t allocated_bytes = count_allocated_bytes_on_heap(h);
-  if (((float)allocated_bytes / (float)h->heap_size) > h->GC_threshold) {
-    size_t reclaimed = h_gc(h);
-    if (DEBUG_MODE) {
-      puts("=== GC report ===\n");
-      printf("\nGC collected: %ld bytes\n", reclaimed);
-      puts("\n=================");
-    }
+bool get_bit_in_alloc_map(uint64_t *alloc_map, int index) {
+  // same layout as set_bits_in_alloc_map, two uint64 per page and the first
+  // slot in the page is the most significant bit
+  int index_map = index / 128;
+  int bit_in_page = index % 128;
+  uint64_t part = alloc_map[index_map * 2 + bit_in_page / 64];
+  return (part >> (63 - bit_in_page % 64)) & 1ULL;
+}
+
+static void *alloc_struct(heap_t *h, char *layout) {
+  if (gc_policy_should_collect(h)) {
+    gc_collect(h);
   }
 
   // calculate the size of object and the total size with header and padding
@@ -148,14 +239,11 @@ void *h_alloc_struct(heap_t *h, char *layout) {
   int total_size = obj_size + HEADER_SIZE + bytes_to_add;
 
   // find next free space for the objects total size
-  int page_index = find_next_available(h, total_size);
+  int page_index = find_page_for_allocation(h, total_size);
 
-  // if no available page exist
+  // heap is full even after a collection, or the object is bigger than a page
   if (page_index == -1) {
-    // TODO: could try to run an a gc before
-    printf("object dont fit on any of the pages left, heap could be full or to "
-           "big object size");
-    assert(!"Object dont fit on any page");
+    return NULL;
   }
 
   // create a header
@@ -181,6 +269,7 @@ void *h_alloc_struct(heap_t *h, char *layout) {
   int start_index = (bits_per_page * page_index) + bits_to_obj_start_in_page;
 
   set_bits_in_alloc_map(h->alloc_map, start_index, total_size);
+  set_bits_in_alloc_map(h->start_map, start_index, MIN_OBJECT_SIZE);
 
   // move next ptr
   page->next_empty_space =
@@ -188,28 +277,28 @@ void *h_alloc_struct(heap_t *h, char *layout) {
 
   // change remaining size
   page->remaining_size -= total_size;
+  gc_policy_note_allocation(h, total_size);
+  gc_stats_note_allocation(h, total_size);
+  alloc_profile_note(h, ptr_to_obj, total_size);
+  trace_note_alloc(h, ptr_to_obj, layout, 0);
 
   // return ptr that points to space after header and before the object
   return ptr_to_obj;
 }
 
-void *h_alloc_raw(heap_t *h, size_t bytes) {
-  size_t allocated_bytes = count_allocated_bytes_on_heap(h);
-  if (((float)allocated_bytes / (float)h->heap_size) > h->GC_threshold) {
-    size_t reclaimed = h_gc(h);
-    // TODO: borde vara i debug mode
-    if (DEBUG_MODE) {
-      puts("=== GC report ===\n");
-      printf("\nGC collected: %ld bytes\n", reclaimed);
-      puts("\n=================");
-    }
+static void *alloc_raw(heap_t *h, size_t bytes) {
+  if (gc_policy_should_collect(h)) {
+    gc_collect(h);
   }
 
   // calculate total size
   int bytes_to_add = (16 - ((bytes + HEADER_SIZE) % 16)) % 16;
   int total_size = bytes + HEADER_SIZE + bytes_to_add;
 
-  int page_index = find_next_available(h, total_size);
+  int page_index = find_page_for_allocation(h, total_size);
+  if (page_index == -1) {
+    return NULL;
+  }
 
   // create a header
   page_t *page = h->page_array[page_index];
@@ -229,6 +318,7 @@ void *h_alloc_raw(heap_t *h, size_t bytes) {
   int start_index = (bits_per_page * page_index) + bits_to_obj_start_in_page;
 
   set_bits_in_alloc_map(h->alloc_map, start_index, total_size);
+  set_bits_in_alloc_map(h->start_map, start_index, MIN_OBJECT_SIZE);
 
   // update next ptr
   page->next_empty_space =
@@ -236,7 +326,51 @@ void *h_alloc_raw(heap_t *h, size_t bytes) {
 
   // Update remaining_size
   page->remaining_size -= total_size;
+  gc_policy_note_allocation(h, total_size);
+  gc_stats_note_allocation(h, total_size);
+  alloc_profile_note(h, ptr_to_obj, total_size);
+  trace_note_alloc(h, ptr_to_obj, NULL, bytes);
 
   // return ptr pointing to just after header
   return ptr_to_obj;
 }
+
+// allocation from several threads is serialised by the heap lock, a thread
+// waiting for it counts as stopped for a collection in another thread
+void *h_alloc_struct(heap_t *h, char *layout) {
+  heap_lock(h);
+  void *obj = alloc_struct(h, layout);
+  heap_unlock(h);
+  return obj;
+}
+
+void *h_alloc_raw(heap_t *h, size_t bytes) {
+  heap_lock(h);
+  void *obj = alloc_raw(h, bytes);
+  heap_unlock(h);
+  return obj;
+}
+
+gc_layout_t h_layout(char *layout) {
+  if (!layout) {
+    assert(!"invalid layout");
+  }
+  gc_layout_t prepared = {layout, 0, 0};
+  set_layout_header(layout, &prepared.header);
+  size_t obj_size = object_size(layout);
+  int bytes_to_add = (16 - ((obj_size + HEADER_SIZE) % 16)) % 16;
+  prepared.size = obj_size + HEADER_SIZE + bytes_to_add;
+  return prepared;
+}
+
+// the slow path of gc_inline.h, the lock retires the buffer that was too
+// small and a new one is opened after the object in the page it went to
+void *h_alloc_refill(heap_t *heap, char *layout, size_t bytes) {
+  heap_lock(heap);
+  void *obj = layout ? alloc_struct(heap, layout) : alloc_raw(heap, bytes);
+  if (obj) {
+    alloc_buffer_open(heap, obj);
+  }
+  heap_unlock(heap);
+  return obj;
+}
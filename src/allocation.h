@@ -89,7 +89,9 @@ void set_layout_header(char *layout, void *header_pos);
  * allocation.
  *
  * First looks in active pages, then in passive pages (which are activated if
- * chosen).
+ * chosen). In mark-region mode an active page whose current hole is too small
+ * is moved on to its next free hole that fits. In copying mode a passive page
+ * is only activated if the copy reserve still holds afterwards.
  *
  * @param heap Pointer to the heap structure.
  * @param size Size in bytes of the object to be allocated.
@@ -97,6 +99,21 @@ void set_layout_header(char *layout, void *header_pos);
  */
 int find_next_available(heap_t *heap, size_t size);
 
+/**
+ * @brief Checks the copy reserve of the copying collector.
+ *
+ * Everything on the active pages may survive a collection, so in the worst
+ * case every active page needs a passive page to be copied into. Allocation
+ * never activates a page that would break this, it collects or returns NULL
+ * instead. A heap with a single page has no reserve and is collected without
+ * moving.
+ *
+ * @param page_amount  Number of pages in the heap.
+ * @param active_pages Number of active pages.
+ * @return true if there are at least as many passive pages as active ones.
+ */
+bool copy_reserve_allows(size_t page_amount, size_t active_pages);
+
 /**
  * @brief Sets bits in the allocation map to indicate allocated memory regions.
  *
@@ -110,3 +127,15 @@ int find_next_available(heap_t *heap, size_t size);
  * by 16).
  */
 void set_bits_in_alloc_map(uint64_t *alloc_map, int start_index, int bytes);
+
+/**
+ * @brief Reads one bit of an allocation map.
+ *
+ * Uses the same indexing as `set_bits_in_alloc_map`, 128 bits per page with
+ * one bit per 16-byte slot.
+ *
+ * @param alloc_map  Pointer to the allocation map.
+ * @param index      Index in 16-byte chunks from the start of the heap.
+ * @return true if the slot is marked as allocated.
+ */
+bool get_bit_in_alloc_map(uint64_t *alloc_map, int index);
@@ -0,0 +1,169 @@
+#include "census.h"
+#include "allocation.h"
+#include "compacting.h"
+#include "find_roots.h"
+#include "mark_compact.h"
+#include "stack_cache.h"
+#include "threads.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t bucket_of(size_t bytes) {
+  size_t bucket = 0;
+  size_t limit = MIN_OBJECT_SIZE;
+  while (bucket < GC_CENSUS_BUCKETS - 1 && bytes > limit) {
+    bucket++;
+    limit *= 2;
+  }
+  return bucket;
+}
+
+// the headers are grouped in an open addressing table of indexes into the
+// entries plus one, 0 is an empty slot, there is room for half as many
+// entries as slots
+typedef struct header_table {
+  size_t *slots;
+  size_t size;
+} header_table_t;
+
+static uint64_t hash_header(uint64_t header) {
+  header ^= header >> 33;
+  header *= 0xff51afd7ed558ccdULL;
+  return header ^ (header >> 33);
+}
+
+static void rehash(header_table_t *table, gc_census_t *census) {
+  size_t size = table->size ? table->size * 2 : 64;
+  size_t *slots = calloc(size, sizeof(size_t));
+  if (!slots) {
+    assert(!"Could not grow the census");
+  }
+  for (size_t i = 0; i < census->entry_count; i++) {
+    size_t slot = hash_header(census->entries[i].header) & (size - 1);
+    while (slots[slot]) {
+      slot = (slot + 1) & (size - 1);
+    }
+    slots[slot] = i + 1;
+  }
+  free(table->slots);
+  table->slots = slots;
+  table->size = size;
+}
+
+static gc_census_entry_t *entry_for(header_table_t *table, gc_census_t *census,
+                                    uint64_t header) {
+  size_t slot = hash_header(header) & (table->size - 1);
+  while (table->slots[slot]) {
+    gc_census_entry_t *entry = &census->entries[table->slots[slot] - 1];
+    if (entry->header == header) {
+      return entry;
+    }
+    slot = (slot + 1) & (table->size - 1);
+  }
+
+  size_t index = census->entry_count++;
+  table->slots[slot] = index + 1;
+  census->entries[index] = (gc_census_entry_t){.header = header};
+  if (census->entry_count == table->size / 2) {
+    gc_census_entry_t *entries =
+        realloc(census->entries, table->size * sizeof(gc_census_entry_t));
+    if (!entries) {
+      assert(!"Could not grow the census");
+    }
+    census->entries = entries;
+    rehash(table, census);
+  }
+  return &census->entries[index];
+}
+
+static int by_bytes(const void *a, const void *b) {
+  const gc_census_entry_t *x = a;
+  const gc_census_entry_t *y = b;
+  if (x->bytes != y->bytes) {
+    return (x->bytes < y->bytes) - (x->bytes > y->bytes);
+  }
+  return (x->header > y->header) - (x->header < y->header);
+}
+
+void census_take(heap_t *h, uint64_t *live_map, gc_census_t *census) {
+  *census = (gc_census_t){0};
+  header_table_t table = {0};
+  rehash(&table, census);
+  census->entries = malloc(table.size / 2 * sizeof(gc_census_entry_t));
+  if (!census->entries) {
+    assert(!"Could not allocate the census");
+  }
+
+  for (size_t p = 0; p < h->page_amount; p++) {
+    // a live map has the slots of the marked objects set like alloc_map
+    page_cursor_t cursor =
+        page_cursor_start(h->page_array[p], live_map ? live_map : h->alloc_map);
+    uint8_t *obj;
+    while ((obj = page_cursor_next(&cursor)) != NULL) {
+      size_t bytes = cursor.size;
+      gc_census_entry_t *entry =
+          entry_for(&table, census, *((uint64_t *)obj - 1));
+      entry->objects++;
+      entry->bytes += bytes;
+      size_t bucket = bucket_of(bytes);
+      census->bucket_objects[bucket]++;
+      census->bucket_bytes[bucket] += bytes;
+      census->objects++;
+      census->bytes += bytes;
+    }
+  }
+  free(table.slots);
+
+  qsort(census->entries, census->entry_count, sizeof(gc_census_entry_t),
+        by_bytes);
+}
+
+__attribute__((noinline)) void h_census(heap_t *heap, gc_census_t *census) {
+  if (!heap || !census) {
+    assert(!"invalid heap or census");
+  }
+  // pointers the caller keeps in registers are found by the scan
+  __builtin_unwind_init();
+  heap_lock(heap);
+  threads_stop_world(heap);
+  root_buffer_t *roots = find_gc_roots(heap);
+  // marked without moving anything, the garbage is left for the next
+  // collection
+  memset(heap->visit_map, 0, heap->page_amount * 2 * sizeof(uint64_t));
+  mark_live_objects(heap, roots, heap->visit_map);
+  stack_caches_refresh(heap);
+  threads_resume_world(heap);
+  census_take(heap, heap->visit_map, census);
+  heap_unlock(heap);
+}
+
+void h_census_free(gc_census_t *census) {
+  free(census->entries);
+  census->entries = NULL;
+  census->entry_count = 0;
+}
+
+size_t h_census_describe(uint64_t header, char *buffer, size_t size) {
+  if (((header >> 2) & 0x1) == 0) {
+    int length = snprintf(buffer, size, "raw %zu", object_payload_size(header));
+    return length > 0 ? (size_t)length : 0;
+  }
+
+  // after the leading 1, every 1 is a pointer and every 0 a 4 byte block
+  int i = 63;
+  while (i > 2 && ((header >> i) & 0x1) == 0) {
+    i--;
+  }
+  size_t length = 0;
+  for (i = i - 1; i > 2; i--, length++) {
+    if (length + 1 < size) {
+      buffer[length] = ((header >> i) & 0x1) ? '*' : 'i';
+    }
+  }
+  if (size > 0) {
+    buffer[length < size ? length : size - 1] = '\0';
+  }
+  return length;
+}
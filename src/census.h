@@ -0,0 +1,57 @@
+#pragma once
+
+#include "gc.h"
+#include "heap.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Heap census
+ *
+ * Every object starts with its header word, a layout bitvector for
+ * `h_alloc_struct` and the size for `h_alloc_raw`, so objects of the same
+ * structure share it. `h_census` stops the world, scans the roots and marks
+ * what they reach the way the sliding collector does, without moving or
+ * freeing anything, and then walks the marked objects of every page with a
+ * `page_cursor_t`, stepping over each object with the size in its header,
+ * and groups them by header word and by size class.
+ * The pause is a root scan and a mark, the walk only reads headers and costs
+ * about as much as rebuilding the start map of every page.
+ */
+
+/**
+ * @brief Counts the objects that are allocated right now.
+ *
+ * @param h        Pointer to the heap.
+ * @param live_map A map filled in by `mark_live_objects`, only the objects
+ * marked in it are counted. NULL counts every allocated object.
+ * @param census   Filled in, `entries` is allocated and sorted.
+ */
+void census_take(heap_t *h, uint64_t *live_map, gc_census_t *census);
+
+/**
+ * @brief Counts the live objects of `heap` without collecting.
+ *
+ * @param heap   A pointer to the heap.
+ * @param census Filled in, release it with `h_census_free`.
+ */
+void h_census(heap_t *heap, gc_census_t *census);
+
+/**
+ * @brief Frees the entries of a census.
+ *
+ * @param census A census filled in by `h_census`.
+ */
+void h_census_free(gc_census_t *census);
+
+/**
+ * @brief Writes a header word as text: the layout string (`*` for a
+ * pointer, `i` for each 4 byte block, so `l` and `d` read as `ii`) or
+ * `raw <bytes>`.
+ *
+ * @param header A header word from a census entry.
+ * @param buffer Where the text goes, always terminated if `size` > 0.
+ * @param size   Size of `buffer`.
+ * @return Length of the whole text, like snprintf.
+ */
+size_t h_census_describe(uint64_t header, char *buffer, size_t size);
@@ -1,12 +1,23 @@
 #include "compacting.h"
+#include "alloc_profile.h"
 #include "allocation.h"
 #include "debug.h"
+#include "gc_events.h"
+#include "gc_policy.h"
+#include "gc_stats.h"
 #include "lib/common.h"
+#include "mark_compact.h"
+#include "mark_region.h"
+#include "stack_cache.h"
+#include "threads.h"
+#include "trace.h"
 #include "lib/linked_list.h"
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
 
+#define DEAD_STACK_WORDS 512
+
 // returns array of pointers to all pages with is_active == filter
 // the size of the array is written into *num_filtered_pages
 // caller owns array and is responsible for freeing it
@@ -30,6 +41,14 @@ page_t **filter_pages_by_activity(heap_t *heap, bool filter,
   return filtered_page_array;
 }
 
+size_t count_active_pages(heap_t *heap) {
+  size_t active_pages = 0;
+  for (size_t i = 0; i < heap->page_amount; i++) {
+    active_pages += heap->page_array[i]->is_active ? 1 : 0;
+  }
+  return active_pages;
+}
+
 // returns array of pointers to all currently passive pages
 // the size of the array is written into *num_passive_pages
 // caller owns array and is responsible for freeing it
@@ -125,6 +144,141 @@ void ***interpret_header(void *p, size_t *num_pointers, size_t *object_size) {
   return pointer_array; // return array, caller owns it and must free it
 }
 
+size_t object_pointer_fields(void *p, void **fields[MAX_POINTER_FIELDS]) {
+  uint64_t header = *((uint64_t *)p - 1);
+  if (((0x4 & header) >> 2) == 0) {
+    // only a size, no pointers
+    return 0;
+  }
+  int i = 63;
+  while (i > 2 && ((header >> i) & 0x1) == 0) {
+    i--;
+  }
+  size_t count = 0;
+  size_t offset = 0;
+  for (i = i - 1; i > 2; i--) {
+    if (((header >> i) & 0x1) == 0) {
+      offset += 4;
+      continue;
+    }
+    void **field = (void **)((uint8_t *)p + offset);
+    if (*field != NULL) {
+      fields[count++] = field;
+    }
+    offset += 8;
+  }
+  return count;
+}
+
+size_t object_payload_size(uint64_t header) {
+  if (((0x4 & header) >> 2) == 0) {
+    // only a size in the header
+    return (size_t)(header >> 3);
+  }
+
+  // layout bitvector, after the leading 1 every 1 is an 8 byte pointer and
+  // every 0 is a 4 byte block
+  int i = 63;
+  while (i > 2 && ((header >> i) & 0x1) == 0) {
+    i--;
+  }
+  size_t size = 0;
+  for (i = i - 1; i > 2; i--) {
+    size += ((header >> i) & 0x1) ? 8 : 4;
+  }
+  return size;
+}
+
+size_t object_total_size(void *p) {
+  size_t size = object_payload_size(*((uint64_t *)p - 1));
+  int bytes_to_add = (16 - ((size + HEADER_SIZE) % 16)) % 16;
+  return size + HEADER_SIZE + bytes_to_add;
+}
+
+bool is_object_start(heap_t *h, void *ptr) {
+  return is_allocated_on_heap(h, ptr);
+}
+
+void *object_base(heap_t *h, void *ptr) {
+  if (is_allocated_on_heap(h, ptr)) {
+    return ptr;
+  }
+  if (!h->interior_pointers) {
+    return NULL;
+  }
+  uintptr_t offset = (uintptr_t)ptr - (uintptr_t)h->heap_start;
+  if (offset >= h->page_amount << PAGE_SHIFT) {
+    return NULL;
+  }
+  // the header of the enclosing object is the closest start bit at or before
+  // the slot of ptr, objects never cross pages so only the two words of the
+  // page are searched
+  uintptr_t slot = offset >> GRANULE_SHIFT;
+  uintptr_t word = slot / 64;
+  uint64_t starts = h->start_map[word] & (~0ULL << (63 - slot % 64));
+  if (starts == 0 && word % 2 == 1) {
+    word--;
+    starts = h->start_map[word];
+  }
+  if (starts == 0) {
+    return NULL;
+  }
+  uintptr_t start = word * 64 + 63 - __builtin_ctzll(starts);
+  uint8_t *base =
+      (uint8_t *)h->heap_start + (start << GRANULE_SHIFT) + HEADER_SIZE;
+  if ((uint8_t *)ptr < base) {
+    return NULL; // points at the header
+  }
+  // during a collection the size is read from the copy of a moved object
+  void *sized = base;
+  if (header_is_forwarding_address(base)) {
+    sized = (void *)extract_adress(*((uint64_t *)base - 1));
+  }
+  if ((size_t)((uint8_t *)ptr - base) >=
+      object_total_size(sized) - HEADER_SIZE) {
+    return NULL;
+  }
+  return base;
+}
+
+page_cursor_t page_cursor_start(page_t *page, uint64_t *map) {
+  return (page_cursor_t){.page = page, .map = map, .granule = 0, .size = 0,
+                         .next = 0};
+}
+
+void *page_cursor_next(page_cursor_t *cursor) {
+  while (cursor->next < GRANULES_PER_PAGE) {
+    // the first slot of the page is the most significant bit of its first
+    // word, the bits before `next` are masked off
+    int word = cursor->next / 64;
+    uint64_t bits = cursor->map[cursor->page->index * 2 + word] &
+                    (~0ULL >> (cursor->next % 64));
+    if (bits == 0) {
+      cursor->next = (word + 1) * 64;
+      continue;
+    }
+    cursor->granule = word * 64 + __builtin_clzll(bits);
+    uint8_t *obj = (uint8_t *)cursor->page->page_start +
+                   cursor->granule * MIN_OBJECT_SIZE + HEADER_SIZE;
+    cursor->size = object_total_size(obj);
+    cursor->next = cursor->granule + cursor->size / MIN_OBJECT_SIZE;
+    return obj;
+  }
+  return NULL;
+}
+
+void rebuild_start_map(heap_t *h, page_t *page) {
+  int first_bit = page->index * GRANULES_PER_PAGE;
+  h->start_map[page->index * 2] = 0;
+  h->start_map[page->index * 2 + 1] = 0;
+
+  page_cursor_t cursor = page_cursor_start(page, h->alloc_map);
+  while (page_cursor_next(&cursor) != NULL) {
+    set_bits_in_alloc_map(h->start_map, first_bit + cursor.granule,
+                          MIN_OBJECT_SIZE);
+  }
+}
+
 // helper function to check if an object header (where p points to the object)
 // is a forwarding address
 bool header_is_forwarding_address(void *p) {
@@ -141,30 +295,92 @@ int eq_function_ptr(elem_t a, elem_t b) {
   return (a.ptr > b.ptr) - (a.ptr < b.ptr);
 }
 
+// the work lists grow by doubling and keep their capacity, so a collection
+// only allocates when it follows more references than any before it
+static void work_list_push(work_list_t *list, void *item) {
+  if (list->size == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 64;
+    void **items = realloc(list->items, capacity * sizeof(void *));
+    if (items == NULL) {
+      assert(!"Allocation of GC work list failed");
+    }
+    list->items = items;
+    list->capacity = capacity;
+  }
+  list->items[list->size++] = item;
+}
+
+// takes the oldest entry when `as_stack` is false, the newest otherwise
+static bool work_list_take(work_list_t *list, bool as_stack, void **item) {
+  if (list->head == list->size) {
+    return false;
+  }
+  *item = as_stack ? list->items[--list->size] : list->items[list->head++];
+  return true;
+}
+
+static void work_list_clear(work_list_t *list) {
+  list->head = 0;
+  list->size = 0;
+}
+
+// undoes an unfinished traverse_and_move, the copies still have the original
+// headers so they are written back and the to-space pages are emptied again
+static void undo_moves(heap_t *h, work_list_t *moved, page_t **to_space,
+                       size_t num_to_space) {
+  void *old_header;
+  while (work_list_take(moved, true, &old_header)) {
+    uint64_t *header = (uint64_t *)old_header;
+    uint64_t *copy = (uint64_t *)extract_adress(*header);
+    *header = *(copy - 1);
+  }
+  for (size_t i = 0; i < num_to_space; i++) {
+    page_t *page = to_space[i];
+    page->is_active = false;
+    page->remaining_size = PAGE_SIZE;
+    page->next_empty_space = page->page_start;
+    h->alloc_map[page->index * 2] = 0;
+    h->alloc_map[page->index * 2 + 1] = 0;
+    h->start_map[page->index * 2] = 0;
+    h->start_map[page->index * 2 + 1] = 0;
+  }
+}
+
 // Traverses the object graph starting from the stack roots,
 // copies all the objects (including headers) to currently passive pages,
 // replaces the old object headers with the new address of the object,
 // and resets the previously active pages to passive status
 // NOTE: leaves stale pointers inside moved objects, to be remedied by a later
-// traversal ASSUMES: that there are sufficiently many passive pages to fit all
-// currently active objects
-//          we make no assumption as to where on the heap these pages are
-//          placed, but allocation must ensure they exist!
-void traverse_and_move(heap_t *h, ioopm_list_t *root_list,
-                       ioopm_list_t *expected_list) {
+// traversal
+// If the passive pages run out every move is undone and false is returned,
+// the heap is then exactly as before the call. Allocation keeps a copy reserve
+// so this only happens with very fragmented survivors.
+bool traverse_and_move(heap_t *h, root_buffer_t *roots) {
   size_t num_passive_pages, num_active_pages;
   page_t **passive_page_array = find_passive_pages(h, &num_passive_pages);
   page_t **active_page_array = find_active_pages(h, &num_active_pages);
 
-  // BFS where root_list is copied to a list with unvisited nodes
-  // loops are avoided since the layout bitmap is overwritten by a forwarding
-  // address
-
-  ioopm_list_t *queue = ioopm_linked_list_create(eq_function_ptr);
-  for (size_t j = 0; j < ioopm_linked_list_size(root_list); j++) {
-    elem_t res;
-    ioopm_linked_list_get(root_list, j, &res);
-    ioopm_linked_list_append(queue, res);
+  // BFS (or DFS depending on h->copy_order) where the roots are copied to a
+  // list with unvisited nodes loops are avoided since the layout bitmap is
+  // overwritten by a forwarding address
+  bool depth_first = h->copy_order == COPY_ORDER_DFS;
+
+  work_list_t *queue = &h->work;
+  // old header address of every moved object, used if the move is undone
+  work_list_t *moved = &h->moved;
+  work_list_clear(queue);
+  work_list_clear(moved);
+  size_t copied_bytes = 0;
+  bool out_of_space = false;
+  for (size_t k = 0; k < roots->size; k++) {
+    // used as a stack the first root has to end up on top
+    size_t j = depth_first ? roots->size - 1 - k : k;
+    // a slot that changed after the scan is not a root any more, those are
+    // wrongfully put in the buffer by find roots
+    if (*roots->slots[j] != roots->values[j]) {
+      continue;
+    }
+    work_list_push(queue, roots->slots[j]);
   }
 
   // when visiting a node, read its layout and extract any pointers from it,
@@ -173,64 +389,62 @@ void traverse_and_move(heap_t *h, ioopm_list_t *root_list,
   size_t num_pointers;
   void **current_pointer;
   void ***pointer_array;
-  elem_t temp_elem; // for compatibility with linked list library
+  void *item;
   // for each unvisited element
-  while (ioopm_linked_list_remove(queue, 0, &temp_elem)) {
+  while (work_list_take(queue, depth_first, &item)) {
 
-    current_pointer = (void **)temp_elem.ptr;
-
-    // if expected_list isnt empty compare them if not equal its been corrupted
-    // NOTE: there are equal in numbers of pointers, however those who have
-    // changed are wrongfully put inte the array in find roots
-    if (!ioopm_linked_list_is_empty(expected_list)) {
-      elem_t res1;
-      ioopm_linked_list_remove(expected_list, 0, &res1);
-      if (res1.ptr != *current_pointer) {
-        continue;
-      }
-    }
+    current_pointer = (void **)item;
+    // the object the reference points into, the same address unless it is
+    // an interior pointer
+    void *obj = object_base(h, *current_pointer);
 
     // check if this object is already visited once (i.e. header is forwarding
     // address), in which case we skip it entirely forwarding address ends in
     // 0b01
-    if (header_is_forwarding_address(*current_pointer)) {
+    if (header_is_forwarding_address(obj)) {
       continue;
     }
 
-    pointer_array =
-        interpret_header(*current_pointer, &num_pointers, &obj_size);
+    pointer_array = interpret_header(obj, &num_pointers, &obj_size);
     // check if this object contains references
     if (pointer_array != NULL) {
       // if header was a layout bitmap containing pointers, add them to list of
       // unvisited
-      for (size_t i = 0; i < num_pointers; i++) {
-        elem_t tmp;
-        tmp.ptr = pointer_array[i];
-        ioopm_linked_list_append(queue, tmp);
+      if (depth_first) {
+        // used as a stack, pushed in reverse so the first child is popped
+        // next and copied right after this object
+        for (size_t i = num_pointers; i > 0; i--) {
+          work_list_push(queue, pointer_array[i - 1]);
+        }
+      } else {
+        for (size_t i = 0; i < num_pointers; i++) {
+          work_list_push(queue, pointer_array[i]);
+        }
       }
       free(pointer_array);
-    } else {
-      obj_size = 0;
     }
 
     // exploration step done, now we must move this object to a new page
+    int bytes_to_add = (16 - ((obj_size + HEADER_SIZE) % 16)) % 16;
+    size_t total_size = obj_size + HEADER_SIZE + bytes_to_add;
 
     // iterate across passive_page_array until we find the first page where this
     // object fits
     page_t *new_page = NULL;
     for (size_t i = 0; i < num_passive_pages; i++) {
-      if ((obj_size + HEADER_SIZE) < passive_page_array[i]->remaining_size) {
+      if (total_size <= passive_page_array[i]->remaining_size) {
         new_page = passive_page_array[i];
         break;
       }
     }
 
     if (new_page == NULL) {
-      assert(!"No page with enough size (traverse_and_move)");
+      out_of_space = true;
+      break;
     }
 
     // move object (including header)
-    void *old_header_address = (void *)((uint64_t *)(*current_pointer) - 1);
+    void *old_header_address = (void *)((uint64_t *)obj - 1);
     void *new_header_address = new_page->next_empty_space;
     DEBUG_PRINT("next empty: %lu, ",
                 new_page->next_empty_space - h->page_array[0]->page_start);
@@ -241,8 +455,6 @@ void traverse_and_move(heap_t *h, ioopm_list_t *root_list,
 
     // update page metadata to reflect new allocation
     // Update allocation map
-    int bytes_to_add = (16 - ((obj_size + HEADER_SIZE) % 16)) % 16;
-    int total_size = obj_size + HEADER_SIZE + bytes_to_add;
     int page_index = new_page->index;
     int bits_per_page = 2048 / 16; // = 128
     int bits_to_obj_start_in_page =
@@ -251,6 +463,7 @@ void traverse_and_move(heap_t *h, ioopm_list_t *root_list,
     int start_index = (bits_per_page * page_index) + bits_to_obj_start_in_page;
 
     set_bits_in_alloc_map(h->alloc_map, start_index, total_size);
+    set_bits_in_alloc_map(h->start_map, start_index, MIN_OBJECT_SIZE);
     new_page->next_empty_space =
         (void *)(((uint8_t *)new_header_address) + total_size);
     new_page->remaining_size -= total_size;
@@ -261,10 +474,24 @@ void traverse_and_move(heap_t *h, ioopm_list_t *root_list,
     uint64_t forwarding_address =
         (uint64_t)((uint64_t *)new_header_address + 1) | 0x1;
     *((uint64_t *)old_header_address) = forwarding_address;
+    work_list_push(moved, old_header_address);
+    copied_bytes += total_size;
   }
 
-  // make all the prev active pages passive
+  if (out_of_space) {
+    undo_moves(h, moved, passive_page_array, num_passive_pages);
+    free(passive_page_array);
+    free(active_page_array);
+    return false;
+  }
+
+  h->stats->last.objects_copied += moved->size;
+  h->stats->last.bytes_copied += copied_bytes;
+
+  // make all the prev active pages passive, their start map is kept until
+  // traverse_and_forward has used it to resolve interior pointers
   for (size_t i = 0; i < num_active_pages; i++) {
+    gc_stats_note_page_reset(h);
     active_page_array[i]->is_active = false;
     active_page_array[i]->remaining_size = PAGE_SIZE;
     active_page_array[i]->next_empty_space = active_page_array[i]->page_start;
@@ -273,51 +500,44 @@ void traverse_and_move(heap_t *h, ioopm_list_t *root_list,
     h->alloc_map[index_page * 2 + 1] = 0;
   }
 
-  // deallocate linked list and page arrays
+  // deallocate page arrays, the work lists stay with the heap
   free(passive_page_array);
   free(active_page_array);
-  ioopm_linked_list_destroy(queue);
+  return true;
 }
 
 uint64_t extract_adress(uint64_t header) { return header & ~0x3; }
 
 // NOTE: here I assume the root list has ptr to ptr that points to the object so
 // void**
-// // TODO: behöver jag ens ta in heapen???
-void traverse_and_forward(heap_t *h, ioopm_list_t *root_list,
-                          ioopm_list_t *expected_list) {
+void traverse_and_forward(heap_t *h, root_buffer_t *roots) {
 
-  ioopm_list_t *queue = ioopm_linked_list_create(eq_function_ptr);
+  work_list_t *queue = &h->work;
+  work_list_clear(queue);
 
-  // add roots to queue
-  for (size_t j = 0; j < ioopm_linked_list_size(root_list); j++) {
-    elem_t res;
-    ioopm_linked_list_get(root_list, j, &res);
-    ioopm_linked_list_append(queue, res);
+  // add roots to queue, skipping slots that changed since the scan
+  for (size_t j = 0; j < roots->size; j++) {
+    if (*roots->slots[j] != roots->values[j]) {
+      continue;
+    }
+    work_list_push(queue, roots->slots[j]);
   }
 
-  ioopm_list_t *visited = ioopm_linked_list_create(eq_function_ptr);
+  // one bit per 16 byte slot (same layout as alloc_map), set at the old
+  // address of every object whose pointers are already in the queue
+  uint64_t *visited = h->visit_map;
+  memset(visited, 0, h->page_amount * 2 * sizeof(uint64_t));
 
-  while (!ioopm_linked_list_is_empty(queue)) {
+  void *item;
+  while (work_list_take(queue, false, &item)) {
 
-    elem_t result;
-    ioopm_linked_list_remove(queue, 0, &result);
-    void **obj_ptr = result.ptr;
-    void *obj_adress = *obj_ptr;
-
-    // if expected_list isnt empty compare them if not equal its been corrupted
-    if (!ioopm_linked_list_is_empty(expected_list)) {
-      elem_t res1;
-      ioopm_linked_list_remove(expected_list, 0, &res1);
-      if (res1.ptr != obj_adress) {
-        continue;
-      }
-    }
+    void **obj_ptr = item;
 
     if (obj_ptr == NULL) {
       assert(!"obj_ptr is null (traverse_and_forward)");
       continue;
     }
+    void *obj_adress = object_base(h, *obj_ptr);
     // extract the forwarding adress from the header
     uint64_t header = *((uint64_t *)obj_adress - 1);
     // expect to always have a forward adress
@@ -325,16 +545,23 @@ void traverse_and_forward(heap_t *h, ioopm_list_t *root_list,
 
     void *forwarding_adress = (void *)extract_adress(header);
 
-    // change the objects pointer to point to the forwarding adress instead
-    *obj_ptr = forwarding_adress;
+    // change the objects pointer to point to the forwarding adress instead,
+    // an interior pointer keeps its offset into the object
+    *obj_ptr = (uint8_t *)forwarding_adress +
+               ((uint8_t *)*obj_ptr - (uint8_t *)obj_adress);
 
     // if the forwarding adress already been visited before, i don't want to do
     // anything becuase it's pointers are already in the queue
-    if (ioopm_linked_list_contains(visited, (elem_t){.ptr = obj_adress})) {
+    page_t *old_page = page_of(h, obj_adress);
+    int visited_index =
+        old_page->index * GRANULES_PER_PAGE +
+        ((uint8_t *)obj_adress - HEADER_SIZE - (uint8_t *)old_page->page_start) /
+            MIN_OBJECT_SIZE;
+    if (get_bit_in_alloc_map(visited, visited_index)) {
       continue;
     }
     // otherwise add it to the visited and continue
-    ioopm_linked_list_append(visited, (elem_t){.ptr = obj_adress});
+    set_bits_in_alloc_map(visited, visited_index, MIN_OBJECT_SIZE);
 
     // follow the forwarding adress
     // with the layout information add its pointer to the queue
@@ -351,59 +578,137 @@ void traverse_and_forward(heap_t *h, ioopm_list_t *root_list,
 
     // otherwise add the pointer to the queue
     for (size_t i = 0; i < num_pointers; i++) {
-      void **ptr_to_ptr_to_obj = ptrs_in_obj[i];
-      ioopm_linked_list_append(queue, (elem_t){.ptr = ptr_to_ptr_to_obj});
+      work_list_push(queue, ptrs_in_obj[i]);
     }
     free(ptrs_in_obj);
   }
-  ioopm_linked_list_destroy(queue);
-  ioopm_linked_list_destroy(visited);
+
+  // the from-space pages are passive now, the start bits traverse_and_move
+  // left there are not needed any more
+  for (size_t i = 0; i < h->page_amount; i++) {
+    if (!h->page_array[i]->is_active) {
+      h->start_map[i * 2] = 0;
+      h->start_map[i * 2 + 1] = 0;
+    }
+  }
 }
 
 size_t count_allocated_bytes_on_heap(heap_t *h) {
-  size_t total_bytes_allocated = 0;
-  for (size_t i = 0; i < h->page_amount; i++) {
-    page_t *page = h->page_array[i];
-    total_bytes_allocated +=
-        (char *)page->next_empty_space - (char *)page->page_start;
+  // every set bit in the allocation map is a 16 byte slot in use
+  size_t allocated_slots = 0;
+  for (size_t i = 0; i < h->page_amount * 2; i++) {
+    allocated_slots += __builtin_popcountll(h->alloc_map[i]);
   }
-  return total_bytes_allocated;
+  return allocated_slots * MIN_OBJECT_SIZE;
 }
 
 size_t h_gc(heap_t *h) { return h_gc_dbg(h, !h->safe); }
 
-size_t h_gc_dbg(heap_t *h, bool unsafe_stack) {
-
-  // iterate over pages to count size usage
-  size_t initial_size_usage = count_allocated_bytes_on_heap(h);
+// the collector leaves heap pointers in its dead frames below the caller,
+// a later collection must not find them in the padding of a new frame
+__attribute__((noinline)) static void clear_dead_stack(void) {
+  volatile uint64_t area[DEAD_STACK_WORDS];
+  for (size_t i = 0; i < DEAD_STACK_WORDS; i++) {
+    area[i] = 0;
+  }
+  (void)area;
+}
 
-  result *root_res = find_gc_roots(h);
-  ioopm_list_t *root_list = root_res->roots;
-  ioopm_list_t *expected_list1 = root_res->expected_roots1;
-  ioopm_list_t *expected_list2 = root_res->expected_roots2;
+// where the copying collector put an object, dead objects were not copied
+// and still have their layout header
+static void *copied_to(heap_t *h, void *obj, void *extra) {
+  (void)h;
+  (void)extra;
+  if (!header_is_forwarding_address(obj)) {
+    return NULL;
+  }
+  return (void *)extract_adress(*((uint64_t *)obj - 1));
+}
 
-  // print_linked_list(root_list);
+// the copying collector, false if it ran out of passive pages and undid the
+// moves
+static bool copy_live_objects(heap_t *h, root_buffer_t *roots) {
+  uint64_t start_ns = gc_clock_ns();
+  // 1st traversal finds all objects and moves them (avoids loops by checking
+  // forwarding address), 2nd traversal replaces all occurences of old
+  // pre-compacting addresses with new addresses
+  bool moved = traverse_and_move(h, roots);
+  uint64_t moved_ns = gc_clock_ns();
+  h->stats->last.move_ns += moved_ns - start_ns;
+  if (!moved) {
+    return false;
+  }
+  gc_event_emit(h, GC_EVENT_MOVE_END, 0);
+  alloc_profile_update(h, copied_to, NULL);
+  trace_update(h, copied_to, NULL);
+  traverse_and_forward(h, roots);
+  h->stats->last.forward_ns += gc_clock_ns() - moved_ns;
+  gc_event_emit(h, GC_EVENT_FORWARD_END, 0);
+  return true;
+}
 
-  // 1st traversal to find all objects (avoid loops by checking forwarding
-  // address)
-  traverse_and_move(h, root_list, expected_list1);
+__attribute__((noinline)) size_t gc_collect(heap_t *h) {
+  // save all callee-saved registers in this frame, pointers the caller keeps
+  // in registers are then found by the stack scan and any update the
+  // collector makes to them is restored into the registers when we return
+  __builtin_unwind_init();
+  threads_stop_world(h);
+  uint64_t gc_start_ns = gc_clock_ns();
 
-  // 2nd traversal to replace all occurences of old pre-compacting addresses
-  // with new addresses
-  traverse_and_forward(h, root_list, expected_list2);
+  // iterate over pages to count size usage
+  size_t initial_size_usage = count_allocated_bytes_on_heap(h);
+  gc_stats_begin(h, initial_size_usage);
+  gc_event_emit(h, GC_EVENT_START, initial_size_usage);
+
+  root_buffer_t *roots = find_gc_roots(h);
+  h->stats->last.roots = roots->size;
+  h->stats->last.roots_ns = gc_clock_ns() - gc_start_ns;
+  gc_event_emit(h, GC_EVENT_ROOTS_END, 0);
+
+  if (h->gc_mode == GC_MODE_SLIDING) {
+    // mark, forward and slide everything within the pages it already lives in
+    mark_compact(h, roots);
+  } else if (h->gc_mode == GC_MODE_MARK_REGION) {
+    // mark live lines, only the most fragmented pages are evacuated
+    mark_region(h, roots, true);
+  } else if (!copy_reserve_allows(h->page_amount, count_active_pages(h)) ||
+             !copy_live_objects(h, roots)) {
+    // not enough passive pages to copy into, reclaim what is possible without
+    // moving anything rather than giving up halfway through a copy
+    mark_region(h, roots, false);
+  }
 
   size_t new_size_usage = count_allocated_bytes_on_heap(h);
 
-  ioopm_linked_list_destroy(root_list);
-  ioopm_linked_list_destroy(expected_list1);
-  ioopm_linked_list_destroy(expected_list2);
-  free(root_res);
+  gc_policy_after_gc(h, new_size_usage, gc_start_ns);
+  gc_stats_end(h, new_size_usage, gc_clock_ns() - gc_start_ns);
+  gc_event_emit(h, GC_EVENT_END, new_size_usage);
+  stack_caches_refresh(h);
+  threads_resume_world(h);
+  clear_dead_stack();
 
   return initial_size_usage - new_size_usage;
 }
 
+size_t h_gc_dbg(heap_t *h, bool unsafe_stack) {
+  (void)unsafe_stack;
+  heap_lock(h);
+  size_t reclaimed = gc_collect(h);
+  trace_note_gc(h);
+  heap_unlock(h);
+  return reclaimed;
+}
+
 size_t h_avail(heap_t *h) {
-  return h->page_amount * PAGE_SIZE - count_allocated_bytes_on_heap(h);
+  heap_lock(h);
+  size_t avail = h->page_amount * PAGE_SIZE - count_allocated_bytes_on_heap(h);
+  heap_unlock(h);
+  return avail;
 }
 
-size_t h_used(heap_t *h) { return count_allocated_bytes_on_heap(h); }
+size_t h_used(heap_t *h) {
+  heap_lock(h);
+  size_t used = count_allocated_bytes_on_heap(h);
+  heap_unlock(h);
+  return used;
+}
@@ -26,6 +26,124 @@
  */
 void ***interpret_header(void *p, size_t *num_pointers, size_t *obj_size);
 
+/// Most pointer fields a layout header can describe.
+#define MAX_POINTER_FIELDS 60
+
+/**
+ * @brief Finds the non-NULL pointer fields of an object without allocating.
+ *
+ * Decodes the layout header in front of `p` the way `interpret_header`
+ * does, into an array of the caller, so it can run where `malloc` cannot
+ * (in a forked child of a threaded process for instance).
+ *
+ * @param p      A pointer to the start of the object (just after the header).
+ * @param fields Filled with the address of every non-NULL pointer field, in
+ * the order of the layout.
+ * @return The number of fields written, at most `MAX_POINTER_FIELDS`.
+ */
+size_t object_pointer_fields(void *p, void **fields[MAX_POINTER_FIELDS]);
+
+/**
+ * @brief Calculates how many bytes an object was allocated for.
+ *
+ * Decodes a size header or a layout bitvector, where every pointer counts as
+ * 8 bytes and every data block as 4.
+ *
+ * @param header The header word in front of the object.
+ * @return Size in bytes, without header and padding.
+ */
+size_t object_payload_size(uint64_t header);
+
+/**
+ * @brief Calculates how many bytes an object occupies on its page.
+ *
+ * Reads the layout or size header in front of `p` and adds the header and
+ * the padding up to the next 16-byte boundary, the same way the allocation
+ * functions do.
+ *
+ * @param p A pointer to the start of the object (just after the header).
+ * @return Size in bytes including header and padding.
+ */
+size_t object_total_size(void *p);
+
+/**
+ * @brief Checks if `ptr` is the address of an allocated object.
+ *
+ * Looks up the header slot in the heap's start map, so a pointer into the
+ * middle of an object or at its header is rejected.
+ *
+ * @param h   Pointer to the heap.
+ * @param ptr The pointer to check.
+ * @return true if `ptr` is exactly what an allocation function returned.
+ */
+bool is_object_start(heap_t *h, void *ptr);
+
+/**
+ * @brief Finds the object a reference points to.
+ *
+ * An object pointer is returned as is. With `interior_pointers` set on the
+ * heap a pointer into the body of an allocated object resolves to the start
+ * of that object, the start map is searched backwards from the slot of `ptr`
+ * and the size in the header decides whether `ptr` is still inside. The size
+ * of an object that was moved is read from its copy, so this works while a
+ * collection runs as long as the start map of the old pages is intact.
+ *
+ * @param h   Pointer to the heap.
+ * @param ptr The reference to resolve.
+ * @return The address of the enclosing object (just after its header), or
+ * NULL if `ptr` does not point into one.
+ */
+void *object_base(heap_t *h, void *ptr);
+
+/**
+ * @brief Position of a walk over the objects of one page, in address order.
+ *
+ * The slots set in `map`, the allocation map or a live map with the same
+ * layout, belong to objects. Free slots are skipped a map word at a time and
+ * every object is stepped over with the size in its header.
+ *
+ *  - `granule`: the first slot of the object last returned, counted from
+ * the page start.
+ *  - `size`: its size including header and padding, read before it is
+ * returned so the caller may move the object or overwrite its header.
+ *  - `next`: the slot the search continues from.
+ */
+typedef struct page_cursor {
+  page_t *page;
+  uint64_t *map;
+  int granule;
+  size_t size;
+  int next;
+} page_cursor_t;
+
+/**
+ * @brief Starts a walk over the objects of `page` marked in `map`.
+ *
+ * @param page The page to walk.
+ * @param map  `alloc_map` or a map with the same layout.
+ * @return A cursor before the first object.
+ */
+page_cursor_t page_cursor_start(page_t *page, uint64_t *map);
+
+/**
+ * @brief Moves the cursor to the next object of the page.
+ *
+ * @param cursor A cursor from `page_cursor_start`.
+ * @return The next object (just after its header), NULL after the last one.
+ */
+void *page_cursor_next(page_cursor_t *cursor);
+
+/**
+ * @brief Recomputes the start map bits of a page from its allocation map.
+ *
+ * Walks the allocated objects of the page using the sizes in their headers,
+ * for collectors that rewrite the allocation map of a page in one go.
+ *
+ * @param h    Pointer to the heap.
+ * @param page The page to rebuild.
+ */
+void rebuild_start_map(heap_t *h, page_t *page);
+
 /**
  * @brief Performs garbage collection using the current heap's safety setting.
  *
@@ -36,6 +154,18 @@ void ***interpret_header(void *p, size_t *num_pointers, size_t *obj_size);
  */
 size_t h_gc(heap_t *h);
 
+/**
+ * @brief Runs one collection, the heap lock must be held.
+ *
+ * Stops all other attached threads, collects with the collector selected by
+ * `gc_mode` and lets the threads continue. Allocation uses this directly
+ * since it already holds the lock.
+ *
+ * @param h Pointer to the heap.
+ * @return Number of bytes reclaimed.
+ */
+size_t gc_collect(heap_t *h);
+
 /**
  * @brief Performs garbage collection with optional unsafe stack scanning.
  *
@@ -49,6 +179,14 @@ size_t h_gc(heap_t *h);
  */
 size_t h_gc_dbg(heap_t *h, bool unsafe_stack);
 
+/**
+ * @brief Checks if the header in front of an object is a forwarding address.
+ *
+ * @param p A pointer to the object (just after the header), or NULL.
+ * @return true if the header tag is 0b01, i.e. the object has been moved.
+ */
+bool header_is_forwarding_address(void *p);
+
 /**
  * @brief Extracts the actual address from a forwarding header.
  *
@@ -63,25 +201,44 @@ uint64_t extract_adress(uint64_t header);
 /**
  * @brief Counts the total number of allocated bytes across all active pages.
  *
+ * Counted from the allocation map, so free holes inside pages (mark-region
+ * mode) are not included.
+ *
  * @param h Pointer to the heap.
  * @return The number of allocated bytes.
  */
 size_t count_allocated_bytes_on_heap(heap_t *h);
 
+/**
+ * @brief Counts the active pages of the heap.
+ *
+ * @param heap Pointer to the heap.
+ * @return Number of pages with `is_active` set.
+ */
+size_t count_active_pages(heap_t *heap);
+
 /**
  * @brief Traverses all reachable objects from the root list and moves them to
  * passive pages.
  *
- * Performs a breadth-first traversal of the object graph, copying each object
- * to a new page and updating the old header with a forwarding address.
+ * Performs a breadth-first (`COPY_ORDER_BFS`) or depth-first
+ * (`COPY_ORDER_DFS`) traversal of the object graph, copying each object to a
+ * new page and updating the old header with a forwarding address. Depth-first
+ * order places every object right before its first child, which keeps lists
+ * and trees in traversal order after the collection.
  *
- * @param h              Pointer to the heap.
- * @param root_list      List of root pointers to scan.
- * @param expected_list  List of expected pointer values for
- * validation/debugging.
+ * If an object does not fit in any passive page the moves done so far are
+ * undone, so the heap is left as it was before the call.
+ *
+ * Roots whose slot no longer holds the value recorded in `roots->values`
+ * are skipped.
+ *
+ * @param h      Pointer to the heap.
+ * @param roots  Root slots to start from.
+ * @return true if every reachable object was moved, false if it ran out of
+ * passive pages.
  */
-void traverse_and_move(heap_t *h, ioopm_list_t *root_list,
-                       ioopm_list_t *expected_list);
+bool traverse_and_move(heap_t *h, root_buffer_t *roots);
 
 /**
  * @brief Second pass of GC: updates all root and internal pointers to point to
@@ -90,9 +247,7 @@ void traverse_and_move(heap_t *h, ioopm_list_t *root_list,
  * Follows the forwarding addresses in object headers and updates all
  * pointers in the object graph to point to the new locations.
  *
- * @param h              Pointer to the heap.
- * @param root_list      List of stack pointer locations (pointers to pointers).
- * @param expected_list  Expected pointer values (used for validation).
+ * @param h      Pointer to the heap.
+ * @param roots  The same roots that were given to `traverse_and_move`.
  */
-void traverse_and_forward(heap_t *h, ioopm_list_t *root_list,
-                          ioopm_list_t *expected_list);
+void traverse_and_forward(heap_t *h, root_buffer_t *roots);
@@ -1,109 +1,397 @@
+#define _GNU_SOURCE // pthread_getattr_np
 #include "find_roots.h"
+#include "allocation.h"
+#include "compacting.h"
 #include "debug.h"
-#include "lib/linked_list.h"
+#include "stack_cache.h"
+#include "threads.h"
 #include <assert.h>
-#include <setjmp.h>
+#include <link.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-
-#define Dump_registers()                                                       \
-  jmp_buf env;                                                                 \
-  if (setjmp(env))                                                             \
-    abort();
+#include <string.h>
 
 extern char **environ;
 
-void *get_stack_top() { return __builtin_frame_address(0); }
+// the stack of a thread never moves, so its base is only looked up once
+static __thread void *stack_base = NULL;
 
-void *get_stack_bottom() { return (void *)environ; }
+void *get_stack_bottom() {
+  if (stack_base) {
+    return stack_base;
+  }
+  pthread_attr_t attr;
+  void *stack_addr;
+  size_t stack_size;
+  if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+    if (pthread_attr_getstack(&attr, &stack_addr, &stack_size) == 0) {
+      // the stack grows down from the end of the mapping
+      stack_base = (uint8_t *)stack_addr + stack_size;
+    }
+    pthread_attr_destroy(&attr);
+  }
+  if (!stack_base) {
+    // environ lies close above the start of main's frame
+    stack_base = (void *)environ;
+  }
+  return stack_base;
+}
 
 // helper function check if allocated on our heap
 bool is_allocated_on_heap(heap_t *heap, void *ptr) {
   if (!heap) {
     assert(!"invalid heap");
   }
-  if ((uint8_t *)ptr <= (uint8_t *)heap->heap_start ||
-      (uint8_t *)ptr >= (uint8_t *)heap->heap_start + heap->heap_size) {
+  // offset of the header from the first page, anything below heap_start
+  // wraps around and fails the range check like anything above the last page
+  uintptr_t offset =
+      (uintptr_t)ptr - HEADER_SIZE - (uintptr_t)heap->heap_start;
+  if (offset >= heap->page_amount << PAGE_SHIFT) {
+    return false;
+  }
+  // headers start at a 16 byte slot
+  if (offset & (MIN_OBJECT_SIZE - 1)) {
     return false;
   }
-  uint64_t *allocation_map = heap->alloc_map;
-  uint64_t heap_ptr_offset =
-      (uint8_t *)ptr - ((uint8_t *)heap->heap_start + sizeof(page_t));
+  // pages are back to back so the slot index is the same as in the maps,
+  // two uint64_t per page with the first slot in the most significant bit
+  uintptr_t slot = offset >> GRANULE_SHIFT;
+  return (heap->start_map[slot / 64] >> (63 - slot % 64)) & 1;
+}
+
+// whether a word found by a scan is a reference into the heap, with interior
+// pointers every address inside an object counts
+static bool is_root_candidate(heap_t *heap, void *ptr) {
+  if (heap->interior_pointers) {
+    return object_base(heap, ptr) != NULL;
+  }
+  return is_allocated_on_heap(heap, ptr);
+}
+
+void root_buffer_append(root_buffer_t *roots, void **slot) {
+  if (roots->size == roots->capacity) {
+    size_t capacity = roots->capacity ? roots->capacity * 2 : 64;
+    void ***slots = realloc(roots->slots, capacity * sizeof(void **));
+    void **values = realloc(roots->values, capacity * sizeof(void *));
+    if (slots) {
+      roots->slots = slots;
+    }
+    if (values) {
+      roots->values = values;
+    }
+    if (!slots || !values) {
+      assert(!"Could not grow the root buffer");
+    }
+    roots->capacity = capacity;
+  }
+  roots->slots[roots->size] = slot;
+  roots->values[roots->size] = *slot;
+  roots->size++;
+}
 
-  // för debuggin //
-  uint64_t second_page_start_address =
-      (uint64_t)heap->page_array[1]->page_start -
-      ((uint64_t)heap->heap_start + sizeof(page_t));
-  DEBUG_PRINT("second_page_start_address: %llu\n", second_page_start_address);
-  //////////////////
+static int by_slot(const void *a, const void *b) {
+  const root_order_t *x = a;
+  const root_order_t *y = b;
+  if (x->slot != y->slot) {
+    return (uintptr_t)x->slot < (uintptr_t)y->slot ? -1 : 1;
+  }
+  return (x->index > y->index) - (x->index < y->index);
+}
 
-  // there is always a header so we should point 8 bytes in
-  if (heap_ptr_offset % 8 != 0) {
+void root_buffer_dedupe(root_buffer_t *roots) {
+  if (roots->size < 2) {
+    return;
+  }
+  if (roots->order_capacity < roots->size) {
+    root_order_t *order =
+        realloc(roots->order, roots->capacity * sizeof(root_order_t));
+    if (!order) {
+      assert(!"Could not grow the root order");
+    }
+    roots->order = order;
+    roots->order_capacity = roots->capacity;
+  }
+  for (size_t i = 0; i < roots->size; i++) {
+    roots->order[i] = (root_order_t){roots->slots[i], i};
+  }
+  qsort(roots->order, roots->size, sizeof(root_order_t), by_slot);
+
+  // every copy after the first of a slot is cleared, then the rest is packed
+  // in its original order so that the collectors see the same root order
+  bool duplicates = false;
+  for (size_t i = 1; i < roots->size; i++) {
+    if (roots->order[i].slot == roots->order[i - 1].slot) {
+      roots->slots[roots->order[i].index] = NULL;
+      duplicates = true;
+    }
+  }
+  if (!duplicates) {
+    return;
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < roots->size; i++) {
+    if (roots->slots[i]) {
+      roots->slots[kept] = roots->slots[i];
+      roots->values[kept] = roots->values[i];
+      kept++;
+    }
+  }
+  roots->size = kept;
+}
+
+void root_buffer_destroy(root_buffer_t *roots) {
+  free(roots->slots);
+  free(roots->values);
+  free(roots->order);
+  *roots = (root_buffer_t){0};
+}
+
+// blacklists the slot a word points at, for words that would be taken for a
+// reference if an object were allocated there. Misaligned words can never
+// be object pointers unless interior pointers are accepted.
+static bool note_false_reference(heap_t *heap, void *ptr) {
+  uintptr_t offset = (uintptr_t)ptr - (uintptr_t)heap->heap_start;
+  if (offset >= heap->page_amount << PAGE_SHIFT) {
     return false;
   }
-  uint64_t pages_before_ptr = heap_ptr_offset / PAGE_SIZE;
+  if (!heap->interior_pointers &&
+      (offset & (MIN_OBJECT_SIZE - 1)) != HEADER_SIZE) {
+    return false;
+  }
+  uintptr_t slot = offset >> GRANULE_SHIFT;
+  heap->black_map[slot / 64] |= 1ULL << (63 - slot % 64);
+  return true;
+}
+
+void scan_word(heap_t *heap, void **slot, root_buffer_t *res,
+               stack_cache_t *cache) {
+  if (is_root_candidate(heap, *slot)) {
+    root_buffer_append(res, slot);
+  } else if (!note_false_reference(heap, *slot)) {
+    return;
+  }
+  if (cache) {
+    stack_cache_note(cache, slot);
+  }
+}
 
-  DEBUG_PRINT("\n--------------\n");
-  DEBUG_PRINT("heap_ptr_offset before: %llu\n", heap_ptr_offset);
-  DEBUG_PRINT("pages_before_ptr: %llu\n", pages_before_ptr);
+static void scan_words(heap_t *heap, void **from, void **to,
+                       root_buffer_t *res, stack_cache_t *cache) {
+  for (void **current = from; current < to; current++) {
+    scan_word(heap, current, res, cache);
+  }
+}
 
-  uint64_t page_offset = sizeof(page_t) * pages_before_ptr;
+#if defined(__x86_64__)
+#include <immintrin.h>
 
-  uint64_t alloc_map_index = heap_ptr_offset / ((2048 + sizeof(page_t)));
-  alloc_map_index *= 2;
-  heap_ptr_offset -= page_offset;
-  // heap_ptr_offset -= alloc_map_index;
-  uint64_t alloc_map_bit = 127 - ((heap_ptr_offset / 16) % 128);
-  alloc_map_index += alloc_map_bit < 64;
-  alloc_map_bit %= 64;
+// the range and alignment checks of is_allocated_on_heap for 4 words at a
+// time, the few words that pass both are looked up in the start map (with
+// interior pointers any alignment passes)
+__attribute__((target("avx2"))) static void
+scan_words_avx2(heap_t *heap, void **from, void **to, root_buffer_t *res,
+                stack_cache_t *cache) {
+  // AVX2 only compares signed 64 bit integers, flipping the sign bit of both
+  // sides turns the unsigned offset < size check into a signed one
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  const __m256i base = _mm256_set1_epi64x(
+      (int64_t)((uintptr_t)heap->heap_start + HEADER_SIZE));
+  const __m256i limit = _mm256_xor_si256(
+      _mm256_set1_epi64x((int64_t)(heap->page_amount << PAGE_SHIFT)), sign);
+  const __m256i misaligned =
+      _mm256_set1_epi64x(heap->interior_pointers ? 0 : MIN_OBJECT_SIZE - 1);
+  const __m256i zero = _mm256_setzero_si256();
 
-  DEBUG_PRINT("Pointer: %p\n", ptr);
-  DEBUG_PRINT("With offset: %llu\n", heap_ptr_offset);
-  DEBUG_PRINT("Alloc map index: %llu\n", alloc_map_index);
-  DEBUG_PRINT("Alloc map bit: %llu\n", alloc_map_bit);
-  DEBUG_PRINT("-------------\n");
+  void **current = from;
+  for (; current + 4 <= to; current += 4) {
+    __m256i words = _mm256_loadu_si256((const __m256i *)current);
+    __m256i offsets = _mm256_sub_epi64(words, base);
+    __m256i in_range =
+        _mm256_cmpgt_epi64(limit, _mm256_xor_si256(offsets, sign));
+    __m256i aligned =
+        _mm256_cmpeq_epi64(_mm256_and_si256(offsets, misaligned), zero);
+    int candidates = _mm256_movemask_pd(
+        _mm256_castsi256_pd(_mm256_and_si256(in_range, aligned)));
+    while (candidates) {
+      int lane = __builtin_ctz(candidates);
+      candidates &= candidates - 1;
+      scan_word(heap, &current[lane], res, cache);
+    }
+  }
+  scan_words(heap, current, to, res, cache);
+}
+#endif
 
-  if ((allocation_map[alloc_map_index] & (1ull << alloc_map_bit)) != 0) {
-    return true;
+// scans [from, to) for object pointers with the fastest filter the cpu has
+void scan_range(heap_t *heap, void **from, void **to, root_buffer_t *res,
+                stack_cache_t *cache) {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2")) {
+    scan_words_avx2(heap, from, to, res, cache);
+    return;
   }
+#endif
+  scan_words(heap, from, to, res, cache);
+}
 
-  return false;
+// the variables one thread registered with h_push_root
+static void scan_shadow_stack(heap_t *heap, shadow_stack_t *stack,
+                              root_buffer_t *res) {
+  for (size_t i = 0; i < stack->size; i++) {
+    void **slot = stack->slots[i];
+    if (is_root_candidate(heap, *slot)) {
+      root_buffer_append(res, slot);
+    }
+  }
 }
 
-// NOTE: stack seems to grow downwards
-result *find_gc_roots(heap_t *heap) {
-  void **stack_top = get_stack_top();
-  void **stack_bottom = get_stack_bottom();
+// the registered areas outside the heap, in every root mode
+static void scan_root_ranges(heap_t *heap, root_buffer_t *res) {
+  for (size_t i = 0; i < heap->root_range_count; i++) {
+    root_range_t *range = &heap->root_ranges[i];
+    if (range->stride == 0) {
+      scan_range(heap, range->start, range->end, res, NULL);
+      continue;
+    }
+    for (uint8_t *slot = range->start; slot < (uint8_t *)range->end;
+         slot += range->stride) {
+      if (is_root_candidate(heap, *(void **)slot)) {
+        root_buffer_append(res, (void **)slot);
+      }
+    }
+  }
+}
 
-  result *res = calloc(1, sizeof(result));
-  ioopm_list_t *roots = ioopm_linked_list_create(ioopm_ptr_cmp_func);
-  ioopm_list_t *expected_roots1 = ioopm_linked_list_create(ioopm_ptr_cmp_func);
-  ioopm_list_t *expected_roots2 = ioopm_linked_list_create(ioopm_ptr_cmp_func);
+typedef struct segment_search {
+  heap_t *heap;
+  size_t added;
+} segment_search_t;
 
-  res->roots = roots;
-  res->expected_roots1 = expected_roots1;
-  res->expected_roots2 = expected_roots2;
+static int add_writable_segments(struct dl_phdr_info *info, size_t size,
+                                 void *data) {
+  (void)size;
+  segment_search_t *search = data;
+  for (size_t i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+    if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_W)) {
+      uint8_t *start = (uint8_t *)(info->dlpi_addr + phdr->p_vaddr);
+      h_add_root_range(search->heap, start, start + phdr->p_memsz);
+      search->added++;
+    }
+  }
+  // the executable comes first, shared libraries are not scanned
+  return 1;
+}
 
-  DEBUG_PRINT("created list at: %p\n", roots);
-  if (roots == NULL) {
-    assert(!"Could not linked list to hold roots");
+// every segment is added with h_add_root_range, which takes the heap lock
+size_t h_add_data_segments(heap_t *heap) {
+  if (!heap) {
+    assert(!"invalid heap");
   }
+  segment_search_t search = {heap, 0};
+  dl_iterate_phdr(add_writable_segments, &search);
+  return search.added;
+}
 
-  for (void **current = stack_top; current <= stack_bottom;
-       current = current + 1) {
+// scans a stack that a thread runs on, up to the top of the registered stack
+// if it runs on one. The native stack of the thread is suspended meanwhile,
+// it is only scanned if it is registered too. A native stack is scanned up to
+// the thread's barrier, see stack_cache.h
+static void scan_running_stack(heap_t *heap, void **top, void **bottom,
+                               stack_cache_t *cache, stack_barrier_t *barrier,
+                               root_buffer_t *res) {
+  gc_stack_t *stack = threads_stack_containing(heap, top);
+  if (stack) {
+    gc_stack_t *native = threads_stack_containing(heap, bottom - 1);
+    if (!native || native == stack) {
+      assert(!"The native stack of a thread on a registered stack must be "
+              "registered");
+    }
+    stack->running = true;
+    stack_cache_scan(heap, &stack->cache, top, stack->hi, res);
+    return;
+  }
+  stack_cache_scan_thread(heap, cache, barrier, top, bottom, res);
+}
 
-    if (is_allocated_on_heap(heap, *current)) {
-      ioopm_linked_list_append(expected_roots1, (elem_t){.ptr = *current});
-      ioopm_linked_list_append(expected_roots2, (elem_t){.ptr = *current});
+// the registered stacks that no thread runs on, clean ones are not scanned
+static void scan_suspended_stacks(heap_t *heap, root_buffer_t *res) {
+  for (size_t i = 0; i < heap->threads->stack_count; i++) {
+    gc_stack_t *stack = heap->threads->stacks[i];
+    if (stack->running) {
+      continue;
+    }
+    void **top = stack->lo;
+    if (stack->sp_getter) {
+      void **sp = stack->sp_getter(stack->lo);
+      if ((uint8_t *)sp > (uint8_t *)stack->lo &&
+          (uint8_t *)sp <= (uint8_t *)stack->hi) {
+        top = (void **)((uintptr_t)sp & ~(uintptr_t)(sizeof(void *) - 1));
+      }
+    }
+    stack_cache_t *cache = &stack->cache;
+    if (!stack->dirty && cache->bottom == stack->hi &&
+        cache->interior == heap->interior_pointers &&
+        cache->words == (size_t)((void **)stack->hi - top)) {
+      stack_cache_reuse(heap, cache, res);
+    } else {
+      stack_cache_scan(heap, cache, top, stack->hi, res);
+    }
+  }
+}
+
+// NOTE: stack seems to grow downwards
+// noinline so that the canonical frame address is the stack pointer of the
+// caller, everything below it is dead once this function returns
+__attribute__((noinline)) root_buffer_t *find_gc_roots(heap_t *heap) {
+  void **stack_top = __builtin_dwarf_cfa();
+  void **stack_bottom = get_stack_bottom();
+
+  // the buffer keeps its capacity, after the first few collections no
+  // allocation is needed to record the roots
+  root_buffer_t *res = &heap->roots;
+  res->size = 0;
+  // only what the words found by this scan point at is avoided afterwards
+  memset(heap->black_map, 0, heap->page_amount * 2 * sizeof(uint64_t));
+
+  if (heap->root_mode == ROOT_MODE_PRECISE) {
+    // only the registered variables, no need to look at the stack
+    scan_shadow_stack(heap, &heap->shadow_stack, res);
+    for (size_t i = 0; i < heap->threads->count; i++) {
+      scan_shadow_stack(heap, &heap->threads->list[i]->shadow_stack, res);
+    }
+    scan_root_ranges(heap, res);
+    root_buffer_dedupe(res);
+    return res;
+  }
+
+  gc_thread_t *self = threads_current(heap);
+  if (self) {
+    scan_running_stack(heap, stack_top, stack_bottom, &self->cache,
+                       self->barrier, res);
+  } else {
+    scan_running_stack(heap, stack_top, stack_bottom,
+                       &heap->threads->collector_cache, stack_barrier_own(),
+                       res);
+  }
+  scan_root_ranges(heap, res);
 
-      ioopm_linked_list_append(roots, (elem_t){.ptr = current});
+  // the other attached threads are stopped, with their registers spilled
+  // above stack_top
+  for (size_t i = 0; i < heap->threads->count; i++) {
+    gc_thread_t *thread = heap->threads->list[i];
+    if (thread != self) {
+      scan_running_stack(heap, thread->stack_top, thread->stack_bottom,
+                         &thread->cache, thread->barrier, res);
     }
   }
+  scan_suspended_stacks(heap, res);
+  root_buffer_dedupe(res);
   asm volatile("" ::: "memory");
-  DEBUG_PRINT("Roots before returning:\n");
-  print_linked_list(roots);
+  DEBUG_PRINT("found %lu roots\n", res->size);
 
   return res;
 }
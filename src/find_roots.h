@@ -1,48 +1,121 @@
+#pragma once
+
 #include "heap.h"
-#include "lib/linked_list.h"
 
 /**
- * @brief Container for GC root scanning results.
- *
- * Used to return multiple lists from `find_gc_roots()`:
- * - `roots`: A list of pointers to stack locations holding references into the
- * heap.
- * - `expected_roots1` and `expected_roots2`: Lists of the actual pointer values
- *    found on the stack that point into the heap (used for validation in
- * compacting).
+ * @brief Appends a root slot to a root buffer, growing it if needed.
+ *
+ * The current value of `*slot` is recorded as the value the slot is expected
+ * to hold when the collector gets to it.
+ *
+ * @param roots The buffer, a zeroed `root_buffer_t` is an empty buffer.
+ * @param slot  Address of a variable holding a pointer into the heap.
+ */
+void root_buffer_append(root_buffer_t *roots, void **slot);
+
+/**
+ * @brief Removes the slots that were found more than once, keeping the first
+ * of each in place.
+ *
+ * Overlapping root ranges (e.g. a global registered with `h_add_root_range`
+ * that is also in a data segment from `h_add_data_segments`) find the same
+ * slot twice, and the collectors must update every slot exactly once.
+ *
+ * @param roots The buffer.
+ */
+void root_buffer_dedupe(root_buffer_t *roots);
+
+/**
+ * @brief Frees the arrays of a root buffer and leaves it empty.
+ *
+ * @param roots The buffer.
+ */
+void root_buffer_destroy(root_buffer_t *roots);
+
+/**
+ * @brief Checks one word of a conservatively scanned area.
+ *
+ * A word that is a reference is appended to `res`, one that points at a
+ * free slot is blacklisted. Both are noted in `cache` if it is not NULL.
+ *
+ * @param heap  A pointer to the heap.
+ * @param slot  Address of the word.
+ * @param res   Buffer the root is appended to.
+ * @param cache Cache of the stack that `slot` belongs to, or NULL.
  */
-typedef struct res {
-  // ptr to ptr
-  ioopm_list_t *roots;
-  // A bug where some values where added/changed just before the return and just
-  // after, I solved this 2 validation lists with only a ptr to the object, so
-  // one less level the *roots
-  ioopm_list_t *expected_roots1;
-  ioopm_list_t *expected_roots2;
+void scan_word(heap_t *heap, void **slot, root_buffer_t *res,
+               stack_cache_t *cache);
 
-} result;
+/**
+ * @brief Checks every word in `[from, to)` with `scan_word`, four at a time
+ * with AVX2 when the cpu has it.
+ *
+ * @param heap  A pointer to the heap.
+ * @param from  First word.
+ * @param to    One past the last word.
+ * @param res   Buffer the roots are appended to.
+ * @param cache Cache of the stack being scanned, or NULL.
+ */
+void scan_range(heap_t *heap, void **from, void **to, root_buffer_t *res,
+                stack_cache_t *cache);
 
 /**
  * @brief Scans the stack for potential root pointers referencing the heap.
  *
- * This function scans the stack from the current frame
- * (`__builtin_frame_address(0)`) down to the environment pointer (`environ`)
- * and checks every word-sized slot to see if it contains a valid pointer into
- * the heap.
+ * This function scans the live part of the stack, from the stack pointer of
+ * its caller up to the base of the calling thread's stack (taken from
+ * `pthread_getattr_np`, or `environ` if that fails), and checks every
+ * word-sized slot to see if it contains a valid pointer into the heap. Its own
+ * frame is not scanned since it is dead once it returns.
+ *
+ * Registers are not scanned, the caller has to spill them to its own frame
+ * first (`gc_collect` does this with `__builtin_unwind_init`).
+ *
+ * The stacks of all other threads attached to the heap are scanned too, from
+ * the `stack_top` they recorded when they stopped. With stack barriers on,
+ * the frames above a thread's barrier are not read again (see
+ * `stack_cache.h`).
+ *
+ * Registered stacks that no thread ran on since the last collection are not
+ * read again, only the words that pointed into the heap are (see
+ * `stack_cache.h`).
+ *
+ * All found root locations are written to `heap->roots`, which is emptied
+ * first: `slots` gets the stack addresses (void **) that hold pointers to the
+ * heap and `values` the pointers themselves.
+ *
+ * In `ROOT_MODE_PRECISE` the stack is not scanned, the roots are the
+ * variables on the shadow stacks of the heap and of every attached thread
+ * (see `h_push_root`) that currently point to an object.
  *
- * All found root locations are added to the returned `result` structure:
- * - `roots` contains the stack addresses (void **) that hold pointers to the
- * heap.
- * - `expected_roots1` and `expected_roots2` contain the dereferenced values of
- * those pointers.
+ * In both modes the areas registered with `h_add_root_range`,
+ * `h_add_root_table` and `h_add_data_segments` are scanned as well.
  *
  * @param heap A pointer to the heap being scanned.
- * @return A dynamically allocated `result *` structure containing the root
- * lists.
+ * @return `&heap->roots`, owned by the heap and overwritten by the next scan.
+ */
+root_buffer_t *find_gc_roots(heap_t *heap);
+
+/**
+ * @brief Registers the writable data segments of the executable as root
+ * ranges.
+ *
+ * Finds the loaded `PT_LOAD` segments with write permission of the main
+ * program (`.data`, `.bss` and the relocated read-only data) with
+ * `dl_iterate_phdr`, so heap pointers in global and static variables are
+ * roots. Shared libraries are not included.
+ *
+ * @param heap A pointer to the heap.
+ * @return The number of ranges added.
+ */
+size_t h_add_data_segments(heap_t *heap);
+
+/**
+ * @brief Finds the base (highest address) of the calling thread's stack.
  *
- * @note Caller is responsible for freeing the result and its contained lists.
+ * @return One past the last word of the stack.
  */
-result *find_gc_roots(heap_t *heap);
+void *get_stack_bottom();
 
 /**
  * @brief Checks if a given pointer refers to a valid allocated object within
@@ -0,0 +1,59 @@
+#include "fragmentation.h"
+#include "allocation.h"
+#include "compacting.h"
+#include "threads.h"
+#include <assert.h>
+#include <stdint.h>
+
+static void take_page(heap_t *h, size_t p, gc_fragmentation_t *report) {
+  size_t used = 0;
+  int end = 0; // the granule after the last object
+  page_cursor_t cursor = page_cursor_start(h->page_array[p], h->alloc_map);
+  uint8_t *obj;
+  while ((obj = page_cursor_next(&cursor)) != NULL) {
+    // the free slots between the previous object and this one
+    size_t run = (cursor.granule - end) * MIN_OBJECT_SIZE;
+    if (run > report->largest_free_run) {
+      report->largest_free_run = run;
+    }
+    size_t bytes = cursor.size;
+    report->padding_bytes +=
+        bytes - HEADER_SIZE - object_payload_size(*((uint64_t *)obj - 1));
+    used += bytes;
+    end = cursor.next;
+  }
+  size_t tail = (GRANULES_PER_PAGE - end) * MIN_OBJECT_SIZE;
+  if (tail > report->largest_free_run) {
+    report->largest_free_run = tail;
+  }
+
+  report->used_bytes += used;
+  report->free_bytes += PAGE_SIZE - used;
+  if (used == 0) {
+    report->empty_pages++;
+    return;
+  }
+  report->tail_bytes += tail;
+  report->hole_bytes += PAGE_SIZE - used - tail;
+  report->occupancy[(used - 1) * GC_OCCUPANCY_BUCKETS / PAGE_SIZE]++;
+  if (used == PAGE_SIZE) {
+    report->full_pages++;
+  }
+}
+
+void fragmentation_take(heap_t *h, gc_fragmentation_t *report) {
+  *report = (gc_fragmentation_t){0};
+  report->pages = h->page_amount;
+  for (size_t p = 0; p < h->page_amount; p++) {
+    take_page(h, p, report);
+  }
+}
+
+void h_fragmentation(heap_t *heap, gc_fragmentation_t *report) {
+  if (!heap || !report) {
+    assert(!"invalid heap or report");
+  }
+  heap_lock(heap);
+  fragmentation_take(heap, report);
+  heap_unlock(heap);
+}
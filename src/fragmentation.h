@@ -0,0 +1,38 @@
+#pragma once
+
+#include "gc.h"
+#include "heap.h"
+#include <stddef.h>
+
+/**
+ * Fragmentation
+ *
+ * Objects never cross a page, so an allocation can fail with plenty of free
+ * bytes on the heap when every free run is shorter than the object. The
+ * report tells the two apart: it sorts the pages by how much of them is
+ * allocated and splits the free bytes of the pages in use into the tail after
+ * their last object, which bump allocation still reaches, and the holes
+ * between objects, which only mark-region allocation or a collection that
+ * moves objects gets back. The bytes lost to rounding objects up to 16 are
+ * counted separately, they are allocated but hold nothing.
+ *
+ * Nothing is collected. The walk reads the two alloc_map words of every page
+ * and the header of every allocated object, the same as `census_take` without
+ * the table, so it is cheap enough to poll from a metrics exporter.
+ */
+
+/**
+ * @brief Fills in the fragmentation report of `h` as it is right now.
+ *
+ * @param h      Pointer to the heap.
+ * @param report Filled in.
+ */
+void fragmentation_take(heap_t *h, gc_fragmentation_t *report);
+
+/**
+ * @brief The fragmentation report of `heap`, taken under the heap lock.
+ *
+ * @param heap   A pointer to the heap.
+ * @param report Filled in.
+ */
+void h_fragmentation(heap_t *heap, gc_fragmentation_t *report);
@@ -1,21 +1,256 @@
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifndef __gc__
 #define __gc__
 
 typedef struct heap heap_t;
 
+/// Selects how h_gc reclaims memory on a heap.
+/// GC_MODE_COPYING evacuates live objects to passive pages and needs half of
+/// the pages free, GC_MODE_SLIDING compacts live objects in place inside
+/// their own pages and needs no copy reserve, GC_MODE_MARK_REGION only marks
+/// live lines and lets allocation reuse the free holes between them.
+typedef enum gc_mode {
+  GC_MODE_COPYING,
+  GC_MODE_SLIDING,
+  GC_MODE_MARK_REGION,
+} gc_mode_t;
+
+/// Order in which the copying collector evacuates objects.
+/// COPY_ORDER_BFS copies level by level (Cheney order), COPY_ORDER_DFS places
+/// every object next to its first child.
+typedef enum copy_order {
+  COPY_ORDER_BFS,
+  COPY_ORDER_DFS,
+} copy_order_t;
+
+/// Where h_gc looks for roots.
+/// ROOT_MODE_CONSERVATIVE scans every word of the stack, ROOT_MODE_PRECISE
+/// only uses the variables registered with h_push_root.
+typedef enum root_mode {
+  ROOT_MODE_CONSERVATIVE,
+  ROOT_MODE_PRECISE,
+} root_mode_t;
+
+/// A shadow stack frame, see H_ROOT_SCOPE.
+typedef struct h_root_scope {
+  heap_t *heap;
+  size_t depth;
+} h_root_scope_t;
+
+/// What a GC trigger policy gets to see after every collection.
+typedef struct gc_policy_info {
+  size_t heap_size;           // bytes given to h_init
+  float gc_threshold;         // threshold given to h_init
+  size_t collections;         // collections so far, 0 when the heap is new
+  size_t live_bytes;          // bytes still allocated after the last h_gc
+  size_t previous_live_bytes; // bytes still allocated after the one before
+  size_t allocated_bytes;     // bytes allocated between the two collections
+  uint64_t gc_ns;             // duration of the last collection
+  uint64_t mutator_ns;        // time between the two collections
+} gc_policy_info_t;
+
+/// A GC trigger policy, returns how many bytes may be in use before the
+/// next collection is triggered by an allocation.
+typedef size_t gc_policy_function(const gc_policy_info_t *info, void *extra);
+
+/// What one collection did, or the sum over all of them.
+/// Times are in nanoseconds. The move phase is copying (or marking and
+/// sliding, marking and evacuating) the objects, the forward phase is
+/// updating the references to the ones that moved.
+typedef struct gc_cycle_stats {
+  uint64_t pause_ns;      // the whole collection, with the world stopped
+  uint64_t roots_ns;      // finding the roots
+  uint64_t move_ns;       // marking and moving objects
+  uint64_t forward_ns;    // updating references
+  size_t roots;           // roots found
+  size_t objects_copied;  // objects that got a new address
+  size_t bytes_copied;    // their size including headers
+  size_t pages_reset;     // pages that became empty
+  size_t bytes_before;    // allocated when the collection started
+  size_t bytes_after;     // still allocated after it
+} gc_cycle_stats_t;
+
+/// Statistics of a heap, see h_stats.
+typedef struct gc_stats {
+  size_t collections;        // collections so far
+  gc_cycle_stats_t last;     // the last collection
+  gc_cycle_stats_t total;    // summed over all collections
+  double survival_rate;      // bytes_after / bytes_before of the last one
+  size_t objects_allocated;  // since h_init
+  size_t bytes_allocated;    // including headers and padding
+} gc_stats_t;
+
+/// Points in a collection (and allocation) that an event hook is told about.
+/// A collection sends GC_EVENT_START, GC_EVENT_ROOTS_END, GC_EVENT_MOVE_END,
+/// GC_EVENT_FORWARD_END and GC_EVENT_END. The sliding and mark-region
+/// collectors update references before they are done moving, and a
+/// collection that moved nothing sends no GC_EVENT_FORWARD_END.
+/// GC_EVENT_HEAP_FULL is sent when an allocation fails even after a
+/// collection, the heap never grows.
+typedef enum gc_event_kind {
+  GC_EVENT_START,
+  GC_EVENT_ROOTS_END,
+  GC_EVENT_MOVE_END,
+  GC_EVENT_FORWARD_END,
+  GC_EVENT_END,
+  GC_EVENT_HEAP_FULL,
+} gc_event_kind_t;
+
+/// What an event hook gets, only valid during the call.
+typedef struct gc_event {
+  gc_event_kind_t kind;
+  uint64_t time_ns;              // monotonic clock, same as the policy uses
+  size_t collections;            // finished collections, this one included
+                                 // from GC_EVENT_END on
+  size_t bytes;                  // START: allocated, END: still allocated,
+                                 // HEAP_FULL: requested, otherwise 0
+  const gc_cycle_stats_t *cycle; // counters of the running collection so far
+} gc_event_t;
+
+/// An event hook, called with the heap lock held (and for collections with
+/// the world stopped), so it must not allocate from or collect the heap.
+typedef void gc_event_hook_function(const gc_event_t *event, void *extra);
+
+/// Size classes of the census histogram, bucket i counts the objects of at
+/// most 16 << i bytes (including header) that do not fit the bucket before.
+#define GC_CENSUS_BUCKETS 8
+
+/// Live objects that share a header word, i.e. the same layout string or
+/// the same size of a raw allocation.
+typedef struct gc_census_entry {
+  uint64_t header; // see h_census_describe
+  size_t objects;
+  size_t bytes; // including headers and padding
+} gc_census_entry_t;
+
+/// What is reachable right now, see h_census.
+typedef struct gc_census {
+  size_t objects;
+  size_t bytes;
+  gc_census_entry_t *entries; // biggest total first, free with h_census_free
+  size_t entry_count;
+  size_t bucket_objects[GC_CENSUS_BUCKETS];
+  size_t bucket_bytes[GC_CENSUS_BUCKETS];
+} gc_census_t;
+
+/// Buckets of the page occupancy histogram, bucket i counts the pages in use
+/// with more than i / 8 and at most (i + 1) / 8 of their bytes allocated.
+#define GC_OCCUPANCY_BUCKETS 8
+
+/// How the free space of the heap is split up, see h_fragmentation.
+typedef struct gc_fragmentation {
+  size_t pages;
+  size_t empty_pages; // nothing allocated, not in the histogram
+  size_t full_pages;  // also counted in the last bucket
+  size_t occupancy[GC_OCCUPANCY_BUCKETS];
+  size_t used_bytes; // including headers and padding
+  size_t free_bytes;
+  size_t tail_bytes; // free after the last object of a page in use
+  size_t hole_bytes; // free between the objects of a page in use
+  size_t largest_free_run; // biggest object (with header) that still fits
+  size_t padding_bytes;    // lost to rounding objects up to 16 bytes
+} gc_fragmentation_t;
+
+/// The bump region of the inline allocation fast path, see gc_inline.h. It is
+/// the first member of every heap, objects are placed at `next` while they
+/// fit before `limit`. Both are NULL while the heap has no buffer open.
+typedef struct gc_alloc_buffer {
+  uint8_t *next;
+  uint8_t *limit;
+} gc_alloc_buffer_t;
+
+/// A struct layout prepared once by h_layout for h_alloc_struct_inline.
+typedef struct gc_layout {
+  char *layout;    // the layout string, for the slow path
+  uint64_t header; // the header of every object with this layout
+  size_t size;     // bytes of an object with header and padding
+} gc_layout_t;
+
+/// A stack registered with h_register_stack, e.g. the stack of a coroutine.
+typedef struct gc_stack gc_stack_t;
+
+/// Returns the saved stack pointer of a suspended registered stack, given the
+/// `lo` it was registered with.
+typedef void *gc_stack_pointer_function(void *lo);
+
+/// Configuration and running estimates of the adaptive trigger policy.
+typedef struct gc_adaptive_policy {
+  double target_overhead; // wanted fraction of time spent in GC, e.g. 0.05
+  double pause_goal_ns;   // longest wanted pause, 0 means no pause goal
+  size_t min_budget;      // always allow at least this much between GCs
+  // estimates, updated after every collection
+  double alloc_bytes_per_ns;
+  double gc_ns_per_live_byte;
+  double survival_rate;
+} gc_adaptive_policy_t;
+
 heap_t *h_init(size_t bytes, bool unsafe_stack, float gc_threshold);
 void h_delete(heap_t *heap);
 void h_delete_dbg(heap_t *heap, unsigned char dbg_value);
+void h_set_gc_mode(heap_t *heap, gc_mode_t mode);
+void h_set_copy_order(heap_t *heap, copy_order_t order);
+void h_set_gc_policy(heap_t *heap, gc_policy_function *policy, void *extra);
+void h_set_adaptive_gc_policy(heap_t *heap, double target_overhead,
+                              double pause_goal_ms);
+void h_set_root_mode(heap_t *heap, root_mode_t mode);
+void h_set_interior_pointers(heap_t *heap, bool enabled);
+void h_set_stack_barriers(heap_t *heap, bool enabled);
+void h_push_root(heap_t *heap, void *slot);
+void h_pop_roots(heap_t *heap, size_t n);
+size_t h_root_depth(heap_t *heap);
+void h_root_scope_exit(h_root_scope_t *scope);
+void h_add_root_range(heap_t *heap, void *start, void *end);
+void h_add_root_table(heap_t *heap, void *base, size_t count, size_t stride);
+bool h_remove_root_range(heap_t *heap, void *start);
+size_t h_add_data_segments(heap_t *heap);
+size_t h_blacklisted(heap_t *heap);
+size_t gc_policy_threshold(const gc_policy_info_t *info, void *extra);
+size_t gc_policy_adaptive(const gc_policy_info_t *info, void *extra);
 
 void *h_alloc_struct(heap_t *h, char *layout);
 void *h_alloc_raw(heap_t *h, size_t bytes);
+gc_layout_t h_layout(char *layout);
+void *h_alloc_refill(heap_t *heap, char *layout, size_t bytes);
 
 size_t h_avail(heap_t *h);
 size_t h_used(heap_t *h);
 size_t h_gc(heap_t *h);
 size_t h_gc_dbg(heap_t *h, bool unsafe_stack);
+void h_stats(heap_t *heap, gc_stats_t *stats);
+void h_set_event_hook(heap_t *heap, gc_event_hook_function *hook, void *extra);
+void h_set_alloc_sampling(heap_t *heap, size_t mean_bytes);
+bool h_dump_alloc_profile(heap_t *heap, const char *path, bool pprof);
+void h_census(heap_t *heap, gc_census_t *census);
+void h_census_free(gc_census_t *census);
+size_t h_census_describe(uint64_t header, char *buffer, size_t size);
+bool h_dump_snapshot(heap_t *heap, int fd);
+void h_fragmentation(heap_t *heap, gc_fragmentation_t *report);
+bool h_trace_start(heap_t *heap, const char *path);
+bool h_trace_stop(heap_t *heap);
+void h_trace_store(heap_t *heap, void *obj, void **slot, void *value);
+
+void h_thread_attach(heap_t *heap);
+void h_thread_detach(heap_t *heap);
+void h_safepoint(heap_t *heap);
+void *h_do_blocking(heap_t *heap, void *(*fn)(void *), void *arg);
+gc_stack_t *h_register_stack(heap_t *heap, void *lo, void *hi,
+                             gc_stack_pointer_function *sp_getter);
+void h_unregister_stack(heap_t *heap, gc_stack_t *stack);
+void h_stack_set_dirty(gc_stack_t *stack, bool dirty);
+
+/// Opens a shadow stack frame for the rest of the enclosing block, every root
+/// pushed after it is popped when the block is left.
+#define H_ROOT_SCOPE(heap)                                                     \
+  h_root_scope_t h_root_scope_                                                 \
+      __attribute__((cleanup(h_root_scope_exit))) = {(heap),                   \
+                                                     h_root_depth(heap)}
+
+/// Stores `value` in the pointer field `field` of `obj`, and records the store
+/// in the trace if one is being recorded (see h_trace_start).
+#define H_STORE(heap, obj, field, value)                                       \
+  h_trace_store((heap), (obj), (void **)&(obj)->field, (value))
 
 #endif
@@ -0,0 +1,70 @@
+#include "gc_events.h"
+#include "gc_policy.h"
+#include "threads.h"
+#include <assert.h>
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define GC_PROBE(name, collections, bytes)                                     \
+  DTRACE_PROBE2(gc, name, collections, bytes)
+#endif
+#endif
+
+#ifndef GC_PROBE
+#define GC_PROBE(name, collections, bytes) ((void)0)
+#endif
+
+// every probe needs its own name at its own site
+static void fire_probe(gc_event_kind_t kind, size_t collections,
+                       size_t bytes) {
+  switch (kind) {
+  case GC_EVENT_START:
+    GC_PROBE(start, collections, bytes);
+    break;
+  case GC_EVENT_ROOTS_END:
+    GC_PROBE(roots_end, collections, bytes);
+    break;
+  case GC_EVENT_MOVE_END:
+    GC_PROBE(move_end, collections, bytes);
+    break;
+  case GC_EVENT_FORWARD_END:
+    GC_PROBE(forward_end, collections, bytes);
+    break;
+  case GC_EVENT_END:
+    GC_PROBE(end, collections, bytes);
+    break;
+  case GC_EVENT_HEAP_FULL:
+    GC_PROBE(heap_full, collections, bytes);
+    break;
+  }
+  (void)collections;
+  (void)bytes;
+}
+
+void gc_event_emit(heap_t *h, gc_event_kind_t kind, size_t bytes) {
+  size_t collections = h->stats->collections;
+  fire_probe(kind, collections, bytes);
+  if (!h->event_hook) {
+    return;
+  }
+  gc_event_t event = {
+      .kind = kind,
+      .time_ns = gc_clock_ns(),
+      .collections = collections,
+      .bytes = bytes,
+      .cycle = &h->stats->last,
+  };
+  h->event_hook(&event, h->event_extra);
+}
+
+void h_set_event_hook(heap_t *heap, gc_event_hook_function *hook,
+                      void *extra) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  heap_lock(heap);
+  heap->event_hook = hook;
+  heap->event_extra = extra;
+  heap_unlock(heap);
+}
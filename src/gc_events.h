@@ -0,0 +1,42 @@
+#pragma once
+
+#include "gc.h"
+#include "heap.h"
+#include <stddef.h>
+
+/**
+ * GC events
+ *
+ * Collections and failed allocations are reported in two ways, both off by
+ * default:
+ *  - a hook set with `h_set_event_hook` gets a `gc_event_t` with a timestamp
+ * and the counters of the running collection, to correlate pauses with
+ * whatever the program traces itself, and
+ *  - a static USDT probe (provider `gc`) per event, when the build has
+ * `<sys/sdt.h>`. A probe is a single nop until perf or bpftrace attaches to
+ * it, its arguments are the finished collections and the `bytes` of the
+ * event.
+ *
+ * Without a hook an event costs a call and a test, the clock is only read
+ * for the hook.
+ */
+
+/**
+ * @brief Fires a probe and calls the hook of `h`, if there is one.
+ *
+ * @param h     Pointer to the heap.
+ * @param kind  What happened.
+ * @param bytes See `gc_event_t`, 0 if the event has no size.
+ */
+void gc_event_emit(heap_t *h, gc_event_kind_t kind, size_t bytes);
+
+/**
+ * @brief Sets a function that is called at every GC event of `heap`.
+ *
+ * Replaces the previous hook, NULL removes it.
+ *
+ * @param heap  A pointer to the heap.
+ * @param hook  The hook, see `gc_event_hook_function`.
+ * @param extra Passed to every call of `hook`.
+ */
+void h_set_event_hook(heap_t *heap, gc_event_hook_function *hook, void *extra);
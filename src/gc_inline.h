@@ -0,0 +1,99 @@
+#pragma once
+
+#include "gc.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Inline allocation
+ *
+ * `h_alloc_struct` and `h_alloc_raw` are calls into the library that take
+ * the heap lock every time. The functions here are inlined into the caller
+ * instead: they place the object at the bump pointer of the heap's
+ * allocation buffer, a free run of the current page, and only call
+ * `h_alloc_refill` when it does not fit. The refill takes the lock, runs a
+ * collection if the policy asks for one, allocates the object the normal way
+ * and opens a new buffer behind it.
+ *
+ * Objects allocated inline are published to the heap (maps, statistics, GC
+ * policy) by the next call that takes the heap lock, which includes every
+ * collection and every query such as `h_used` or `h_census`. No buffer is
+ * opened while the allocation profiler or a trace is running or while any
+ * thread is attached with `h_thread_attach`, so then every allocation goes
+ * through the slow path and is seen as usual. A heap used from several
+ * threads is only safe through the locked calls, as before.
+ *
+ * Struct layouts are parsed once with `h_layout`:
+ *
+ *     static gc_layout_t node_layout;
+ *     node_layout = h_layout("*i");
+ *     node_t *node = h_alloc_struct_inline(heap, node_layout);
+ */
+
+/**
+ * @brief Parses a struct layout for `h_alloc_struct_inline`.
+ *
+ * @param layout The layout string as for `h_alloc_struct`, it must stay
+ * valid as long as the result is used.
+ * @return The header and allocation size of objects with this layout.
+ */
+gc_layout_t h_layout(char *layout);
+
+/**
+ * @brief The slow path of the inline allocation functions.
+ *
+ * Allocates like `h_alloc_struct(heap, layout)`, or `h_alloc_raw(heap,
+ * bytes)` when `layout` is NULL, and opens a new allocation buffer if the
+ * heap allows one.
+ *
+ * @return The object, or NULL if the heap is full.
+ */
+void *h_alloc_refill(heap_t *heap, char *layout, size_t bytes);
+
+// bumps the buffer by `size` bytes and writes the header, NULL if it is full
+static inline void *h_alloc_bump_(heap_t *heap, uint64_t header, size_t size) {
+  gc_alloc_buffer_t *buffer = (gc_alloc_buffer_t *)heap;
+  uint8_t *head = buffer->next;
+  if ((size_t)(buffer->limit - head) < size) {
+    return NULL;
+  }
+  buffer->next = head + size;
+  *(uint64_t *)head = header;
+  return head + sizeof(uint64_t);
+}
+
+/**
+ * @brief Allocates a zeroed struct like `h_alloc_struct`, inline unless the
+ * allocation buffer is full.
+ *
+ * @param heap   A pointer to the heap.
+ * @param layout A layout prepared by `h_layout`.
+ * @return The object, or NULL if the heap is full.
+ */
+static inline void *h_alloc_struct_inline(heap_t *heap, gc_layout_t layout) {
+  void *obj = h_alloc_bump_(heap, layout.header, layout.size);
+  if (__builtin_expect(obj == NULL, 0)) {
+    return h_alloc_refill(heap, layout.layout, 0);
+  }
+  memset(obj, 0, layout.size - sizeof(uint64_t));
+  return obj;
+}
+
+/**
+ * @brief Allocates `bytes` uninitialised bytes like `h_alloc_raw`, inline
+ * unless the allocation buffer is full.
+ *
+ * @param heap  A pointer to the heap.
+ * @param bytes Size of the object.
+ * @return The object, or NULL if the heap is full.
+ */
+static inline void *h_alloc_raw_inline(heap_t *heap, size_t bytes) {
+  // header and padding, rounded up to 16 bytes like h_alloc_raw
+  size_t size = (bytes + sizeof(uint64_t) + 15) & ~(size_t)15;
+  void *obj = h_alloc_bump_(heap, ((uint64_t)bytes << 3) | 0x3, size);
+  if (__builtin_expect(obj == NULL, 0)) {
+    return h_alloc_refill(heap, NULL, bytes);
+  }
+  return obj;
+}
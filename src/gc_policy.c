@@ -0,0 +1,152 @@
+#include "gc_policy.h"
+#include <assert.h>
+#include <time.h>
+
+// weight of the newest collection in the adaptive estimates
+#define ESTIMATE_WEIGHT 0.5
+
+uint64_t gc_clock_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static size_t ceiling_bytes(const gc_policy_info_t *info) {
+  return (size_t)(info->gc_threshold * (float)info->heap_size);
+}
+
+static double update_estimate(double old, double sample, size_t collections) {
+  // the first collection has nothing to average with
+  if (collections <= 1) {
+    return sample;
+  }
+  return ESTIMATE_WEIGHT * sample + (1.0 - ESTIMATE_WEIGHT) * old;
+}
+
+size_t gc_policy_threshold(const gc_policy_info_t *info, void *extra) {
+  (void)extra;
+  return ceiling_bytes(info);
+}
+
+size_t gc_policy_adaptive(const gc_policy_info_t *info, void *extra) {
+  gc_adaptive_policy_t *p = (gc_adaptive_policy_t *)extra;
+  size_t ceiling = ceiling_bytes(info);
+  if (info->collections == 0) {
+    // nothing measured yet, behave like the threshold policy
+    return ceiling;
+  }
+
+  size_t live = info->live_bytes;
+  // a collection of an almost empty heap still has a fixed cost, count it as
+  // at least one page worth of tracing
+  size_t traced = live > PAGE_SIZE ? live : PAGE_SIZE;
+  size_t before = info->previous_live_bytes + info->allocated_bytes;
+  uint64_t mutator_ns = info->mutator_ns ? info->mutator_ns : 1;
+
+  p->alloc_bytes_per_ns =
+      update_estimate(p->alloc_bytes_per_ns,
+                      (double)info->allocated_bytes / (double)mutator_ns,
+                      info->collections);
+  p->gc_ns_per_live_byte =
+      update_estimate(p->gc_ns_per_live_byte,
+                      (double)info->gc_ns / (double)traced, info->collections);
+  p->survival_rate = update_estimate(
+      p->survival_rate, before ? (double)live / (double)before : 1.0,
+      info->collections);
+
+  // the next collection is expected to cost about as much as this one, let
+  // the mutator run long enough for that cost to be target_overhead of the
+  // total time and allocate what it normally does in that time
+  double gc_ns = p->gc_ns_per_live_byte * (double)traced;
+  double mutator_budget_ns =
+      gc_ns * (1.0 - p->target_overhead) / p->target_overhead;
+  double budget = p->alloc_bytes_per_ns * mutator_budget_ns;
+
+  // the pause grows with what survives of the budget, stop before the
+  // estimated pause passes the goal
+  if (p->pause_goal_ns > 0 && p->gc_ns_per_live_byte > 0) {
+    double survival = p->survival_rate > 0.01 ? p->survival_rate : 0.01;
+    double max_budget =
+        (p->pause_goal_ns / p->gc_ns_per_live_byte - (double)traced) /
+        survival;
+    if (budget > max_budget) {
+      budget = max_budget;
+    }
+  }
+
+  size_t trigger = ceiling;
+  if (budget < (double)(ceiling - (live < ceiling ? live : ceiling))) {
+    trigger = live + (size_t)(budget > 0 ? budget : 0);
+  }
+  if (trigger < live + p->min_budget) {
+    trigger = live + p->min_budget;
+  }
+  return trigger;
+}
+
+void gc_policy_init(heap_t *h) {
+  gc_policy_state_t *s = &h->gc_policy;
+  s->policy = gc_policy_threshold;
+  s->extra = NULL;
+  s->used_bytes = 0;
+  s->info = (gc_policy_info_t){.heap_size = h->heap_size,
+                               .gc_threshold = h->GC_threshold};
+  s->last_gc_end_ns = gc_clock_ns();
+  s->adaptive = (gc_adaptive_policy_t){0};
+  s->trigger_bytes = s->policy(&s->info, s->extra);
+}
+
+bool gc_policy_should_collect(heap_t *h) {
+  return h->gc_policy.used_bytes > h->gc_policy.trigger_bytes;
+}
+
+void gc_policy_note_allocation(heap_t *h, size_t bytes) {
+  h->gc_policy.used_bytes += bytes;
+}
+
+void gc_policy_after_gc(heap_t *h, size_t live_bytes, uint64_t gc_start_ns) {
+  gc_policy_state_t *s = &h->gc_policy;
+  uint64_t now = gc_clock_ns();
+
+  gc_policy_info_t *info = &s->info;
+  info->collections++;
+  // used_bytes was the live data after the last collection plus everything
+  // allocated since then
+  info->allocated_bytes = s->used_bytes > info->live_bytes
+                              ? s->used_bytes - info->live_bytes
+                              : 0;
+  info->previous_live_bytes = info->live_bytes;
+  info->live_bytes = live_bytes;
+  info->gc_ns = now - gc_start_ns;
+  info->mutator_ns = gc_start_ns - s->last_gc_end_ns;
+
+  s->used_bytes = live_bytes;
+  s->last_gc_end_ns = now;
+  s->trigger_bytes = s->policy(info, s->extra);
+}
+
+void h_set_gc_policy(heap_t *heap, gc_policy_function *policy, void *extra) {
+  if (!heap || !policy) {
+    assert(!"invalid heap or policy");
+  }
+  gc_policy_state_t *s = &heap->gc_policy;
+  s->policy = policy;
+  s->extra = extra;
+  s->trigger_bytes = policy(&s->info, extra);
+}
+
+void h_set_adaptive_gc_policy(heap_t *heap, double target_overhead,
+                              double pause_goal_ms) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  if (target_overhead <= 0.0 || target_overhead >= 1.0) {
+    assert(!"target overhead must be between 0 and 1");
+  }
+  heap->gc_policy.adaptive = (gc_adaptive_policy_t){
+      .target_overhead = target_overhead,
+      .pause_goal_ns = pause_goal_ms * 1e6,
+      .min_budget = DEFAULT_MIN_BUDGET,
+  };
+  h_set_gc_policy(heap, gc_policy_adaptive, &heap->gc_policy.adaptive);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "gc.h"
+#include "heap.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * GC trigger policies
+ *
+ * Allocation asks the heap's policy when to collect. After every collection
+ * the policy gets a `gc_policy_info_t` with the surviving bytes, the bytes
+ * allocated since the collection before and the time spent in GC and in the
+ * mutator, and returns how many bytes may be in use before the next one.
+ *
+ * Two policies are built in:
+ *  - `gc_policy_threshold` (default): collect when the fixed fraction
+ * `GC_threshold` of the heap is in use, the original behaviour.
+ *  - `gc_policy_adaptive`: gives the mutator an allocation budget sized so
+ * that the time spent in GC stays near `target_overhead`, optionally capped
+ * so that the estimated pause stays below `pause_goal_ns`. `GC_threshold` is
+ * the ceiling for the trigger point, but at least `min_budget` bytes can
+ * always be allocated between two collections so a nearly full heap does not
+ * collect on every allocation.
+ *
+ * Custom policies can be installed with `h_set_gc_policy`.
+ */
+
+/// smallest allocation budget of the adaptive policy unless configured
+#define DEFAULT_MIN_BUDGET (4 * PAGE_SIZE)
+
+/**
+ * @brief Reads the monotonic clock.
+ *
+ * @return Nanoseconds from an arbitrary fixed point.
+ */
+uint64_t gc_clock_ns(void);
+
+/**
+ * @brief Installs the default threshold policy on a new heap.
+ *
+ * @param h Pointer to the heap.
+ */
+void gc_policy_init(heap_t *h);
+
+/**
+ * @brief Checks if an allocation should start with a collection.
+ *
+ * @param h Pointer to the heap.
+ * @return true if the heap is above the current trigger point.
+ */
+bool gc_policy_should_collect(heap_t *h);
+
+/**
+ * @brief Records a successful allocation.
+ *
+ * @param h     Pointer to the heap.
+ * @param bytes Bytes taken from the page including header and padding.
+ */
+void gc_policy_note_allocation(heap_t *h, size_t bytes);
+
+/**
+ * @brief Updates the statistics after a collection and asks the policy for
+ * the next trigger point.
+ *
+ * @param h           Pointer to the heap.
+ * @param live_bytes  Bytes still allocated after the collection.
+ * @param gc_start_ns `gc_clock_ns()` when the collection started.
+ */
+void gc_policy_after_gc(heap_t *h, size_t live_bytes, uint64_t gc_start_ns);
@@ -0,0 +1,65 @@
+#include "gc_stats.h"
+#include "threads.h"
+#include <assert.h>
+#include <stdlib.h>
+
+void gc_stats_init(heap_t *h) {
+  h->stats = calloc(1, sizeof(gc_stats_t));
+  if (!h->stats) {
+    assert(!"Could not allocate the statistics");
+  }
+}
+
+void gc_stats_destroy(heap_t *h) {
+  free(h->stats);
+  h->stats = NULL;
+}
+
+void gc_stats_begin(heap_t *h, size_t bytes_before) {
+  h->stats->last = (gc_cycle_stats_t){.bytes_before = bytes_before};
+}
+
+void gc_stats_end(heap_t *h, size_t bytes_after, uint64_t pause_ns) {
+  gc_stats_t *s = h->stats;
+  gc_cycle_stats_t *last = &s->last;
+  last->bytes_after = bytes_after;
+  last->pause_ns = pause_ns;
+
+  s->collections++;
+  s->survival_rate = last->bytes_before
+                         ? (double)bytes_after / (double)last->bytes_before
+                         : 1.0;
+
+  gc_cycle_stats_t *total = &s->total;
+  total->pause_ns += last->pause_ns;
+  total->roots_ns += last->roots_ns;
+  total->move_ns += last->move_ns;
+  total->forward_ns += last->forward_ns;
+  total->roots += last->roots;
+  total->objects_copied += last->objects_copied;
+  total->bytes_copied += last->bytes_copied;
+  total->pages_reset += last->pages_reset;
+  total->bytes_before += last->bytes_before;
+  total->bytes_after += last->bytes_after;
+}
+
+void gc_stats_note_copy(heap_t *h, size_t bytes) {
+  h->stats->last.objects_copied++;
+  h->stats->last.bytes_copied += bytes;
+}
+
+void gc_stats_note_page_reset(heap_t *h) { h->stats->last.pages_reset++; }
+
+void gc_stats_note_allocation(heap_t *h, size_t bytes) {
+  h->stats->objects_allocated++;
+  h->stats->bytes_allocated += bytes;
+}
+
+void h_stats(heap_t *heap, gc_stats_t *stats) {
+  if (!heap || !stats) {
+    assert(!"invalid heap or stats");
+  }
+  heap_lock(heap);
+  *stats = *heap->stats;
+  heap_unlock(heap);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "gc.h"
+#include "heap.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * GC statistics
+ *
+ * Every collection fills `last` as it goes and adds it to `total` when it is
+ * done, allocation counts the objects it hands out. It costs a few counters
+ * and clock reads per collection and two additions per allocation, so it is
+ * always on. `h_stats` returns a copy.
+ */
+
+/**
+ * @brief Allocates the (zeroed) statistics of a new heap.
+ *
+ * @param h Pointer to the heap.
+ */
+void gc_stats_init(heap_t *h);
+
+/**
+ * @brief Frees the statistics of a heap.
+ *
+ * @param h Pointer to the heap.
+ */
+void gc_stats_destroy(heap_t *h);
+
+/**
+ * @brief Starts the numbers of a new collection.
+ *
+ * @param h            Pointer to the heap.
+ * @param bytes_before Bytes allocated when the collection starts.
+ */
+void gc_stats_begin(heap_t *h, size_t bytes_before);
+
+/**
+ * @brief Finishes the numbers of the running collection and adds them to the
+ * totals.
+ *
+ * @param h           Pointer to the heap.
+ * @param bytes_after Bytes still allocated.
+ * @param pause_ns    Duration of the whole collection.
+ */
+void gc_stats_end(heap_t *h, size_t bytes_after, uint64_t pause_ns);
+
+/**
+ * @brief Records an object moved by the running collection.
+ *
+ * @param h     Pointer to the heap.
+ * @param bytes Its size including header and padding.
+ */
+void gc_stats_note_copy(heap_t *h, size_t bytes);
+
+/**
+ * @brief Records a page the running collection emptied.
+ *
+ * @param h Pointer to the heap.
+ */
+void gc_stats_note_page_reset(heap_t *h);
+
+/**
+ * @brief Records an allocation.
+ *
+ * @param h     Pointer to the heap.
+ * @param bytes Bytes taken from the page including header and padding.
+ */
+void gc_stats_note_allocation(heap_t *h, size_t bytes);
+
+/**
+ * @brief Copies the statistics of a heap.
+ *
+ * Cumulative numbers are in `total`, those of the latest collection in
+ * `last`. Safe to call from any thread.
+ *
+ * @param heap  A pointer to the heap.
+ * @param stats Filled with the current numbers.
+ */
+void h_stats(heap_t *heap, gc_stats_t *stats);
@@ -1,4 +1,10 @@
 #include "heap.h"
+#include "alloc_profile.h"
+#include "find_roots.h"
+#include "gc_policy.h"
+#include "gc_stats.h"
+#include "threads.h"
+#include "trace.h"
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -7,15 +13,12 @@
 #include <stdlib.h>
 #include <string.h>
 
-page_t *p_init(void *page_start, size_t page_index) {
-  if (!page_start) {
+page_t *p_init(page_t *page, void *page_start, size_t page_index) {
+  if (!page || !page_start) {
     assert(!"invalid address");
   }
 
-  page_t *page = (page_t *)page_start;
-
-  // move page start to after the page struct
-  page->page_start = (uint8_t *)page_start + sizeof(page_t);
+  page->page_start = page_start;
 
   // set all the metadata
   page->next_empty_space = page->page_start;
@@ -23,6 +26,7 @@ page_t *p_init(void *page_start, size_t page_index) {
   page->is_safe = true;
   page->remaining_size = PAGE_SIZE;
   page->index = page_index;
+  page->line_marks = 0;
 
   return page;
 }
@@ -38,8 +42,8 @@ heap_t *h_init(size_t bytes, bool unsafe_stack, float gc_threshold) {
   size_t page_amount = bytes / PAGE_SIZE; // 2048 bytes
   // space for all structs
   bytes_to_allocate += page_amount * sizeof(page_t) + sizeof(heap_t);
-  // space for allocation map
-  bytes_to_allocate += PAGE_SIZE * page_amount / MIN_OBJECT_SIZE; // 16 bytes
+  // space for allocation map, object start map, blacklist and visited map
+  bytes_to_allocate += 4 * PAGE_SIZE * page_amount / MIN_OBJECT_SIZE;
 
   // array for the pages in heap struct
   bytes_to_allocate += page_amount * sizeof(page_t *);
@@ -67,28 +71,57 @@ heap_t *h_init(size_t bytes, bool unsafe_stack, float gc_threshold) {
   // two uint64_t can represent a page
   size_t alloc_map_entries = page_amount * 2;
 
-  heap->alloc_map = (uint64_t *)heap->heap_start;
-  // initialise the alloc map to 0
+  heap->start_map = (uint64_t *)heap->heap_start;
+  heap->alloc_map = heap->start_map + alloc_map_entries;
+  heap->black_map = heap->alloc_map + alloc_map_entries;
+  heap->visit_map = heap->black_map + alloc_map_entries;
+  // initialise the maps to 0
   for (size_t i = 0; i < alloc_map_entries; i++) {
+    heap->start_map[i] = 0;
     heap->alloc_map[i] = 0;
+    heap->black_map[i] = 0;
+    heap->visit_map[i] = 0;
   }
-  // Move heap_start beyond alloc_map
+  heap->heap_start = heap->visit_map;
+  // Move heap_start beyond the maps
   heap->heap_start =
       (uint8_t *)heap->heap_start + (alloc_map_entries * sizeof(uint64_t));
 
   heap->heap_size = bytes;
+  heap->alloc_buffer = (gc_alloc_buffer_t){NULL, NULL};
+  heap->alloc_buffer_start = NULL;
   heap->GC_threshold = gc_threshold;
   heap->safe = !unsafe_stack;
+  heap->gc_mode = GC_MODE_COPYING;
+  heap->copy_order = COPY_ORDER_BFS;
+  gc_policy_init(heap);
+  heap->root_mode = ROOT_MODE_CONSERVATIVE;
+  heap->interior_pointers = false;
+  heap->stack_barriers = false;
+  heap->event_hook = NULL;
+  heap->event_extra = NULL;
+  heap->profile = NULL;
+  heap->trace = NULL;
+  heap->shadow_stack = (shadow_stack_t){0};
+  heap->roots = (root_buffer_t){0};
+  heap->work = (work_list_t){0};
+  heap->moved = (work_list_t){0};
+  heap->root_ranges = NULL;
+  heap->root_range_count = 0;
+  heap->root_range_capacity = 0;
+  threads_init(heap);
+  gc_stats_init(heap);
 
-  // Positions the page_array after all the pages:
-  heap->page_array =
-      (page_t **)((uint8_t *)heap->heap_start +
-                  (heap->page_amount * (PAGE_SIZE + sizeof(page_t))));
+  // The page data is contiguous so that the page of an address is found with
+  // a shift, the page structs and the page_array come after all of it
+  page_t *page_structs =
+      (page_t *)((uint8_t *)heap->heap_start + page_amount * PAGE_SIZE);
+  heap->page_array = (page_t **)(page_structs + page_amount);
 
   // Initialize each page:
   for (size_t i = 0; i < heap->page_amount; i++) {
     heap->page_array[i] = p_init(
-        (uint8_t *)heap->heap_start + i * (PAGE_SIZE + sizeof(page_t)), i);
+        &page_structs[i], (uint8_t *)heap->heap_start + i * PAGE_SIZE, i);
   }
 
   return heap;
@@ -98,6 +131,15 @@ void h_delete(heap_t *heap) {
   if (!heap) {
     assert(!"invalid heap");
   }
+  free(heap->shadow_stack.slots);
+  root_buffer_destroy(&heap->roots);
+  free(heap->work.items);
+  free(heap->moved.items);
+  free(heap->root_ranges);
+  threads_destroy(heap);
+  gc_stats_destroy(heap);
+  alloc_profile_destroy(heap);
+  trace_destroy(heap);
   free(heap);
 }
 
@@ -106,9 +148,183 @@ void h_delete_dbg(heap_t *heap, unsigned char dbg_value) {
     assert(!"invalid heap");
   }
 
+  free(heap->shadow_stack.slots);
+  root_buffer_destroy(&heap->roots);
+  free(heap->work.items);
+  free(heap->moved.items);
+  free(heap->root_ranges);
+  threads_destroy(heap);
+  gc_stats_destroy(heap);
+  alloc_profile_destroy(heap);
+  trace_destroy(heap);
   if (heap->heap_start) {
     memset(heap, dbg_value, heap->heap_size);
   }
 
   free(heap);
 }
+
+void h_set_gc_mode(heap_t *heap, gc_mode_t mode) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  heap->gc_mode = mode;
+}
+
+void h_set_copy_order(heap_t *heap, copy_order_t order) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  heap->copy_order = order;
+}
+
+void h_set_root_mode(heap_t *heap, root_mode_t mode) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  heap->root_mode = mode;
+}
+
+void h_set_interior_pointers(heap_t *heap, bool enabled) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  heap->interior_pointers = enabled;
+}
+
+void h_set_stack_barriers(heap_t *heap, bool enabled) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  heap->stack_barriers = enabled;
+}
+
+// every attached thread pushes and pops its own roots without the lock, the
+// collector only reads them while the thread is stopped
+static shadow_stack_t *own_shadow_stack(heap_t *heap) {
+  gc_thread_t *self = threads_current(heap);
+  return self ? &self->shadow_stack : &heap->shadow_stack;
+}
+
+void h_push_root(heap_t *heap, void *slot) {
+  if (!heap || !slot) {
+    assert(!"invalid heap or root");
+  }
+  shadow_stack_t *stack = own_shadow_stack(heap);
+  if (stack->size == stack->capacity) {
+    size_t capacity = stack->capacity ? stack->capacity * 2 : 16;
+    void ***grown = realloc(stack->slots, capacity * sizeof(void **));
+    if (!grown) {
+      assert(!"Could not grow the shadow stack");
+    }
+    stack->slots = grown;
+    stack->capacity = capacity;
+  }
+  stack->slots[stack->size++] = (void **)slot;
+}
+
+void h_pop_roots(heap_t *heap, size_t n) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  shadow_stack_t *stack = own_shadow_stack(heap);
+  if (n > stack->size) {
+    assert(!"Popping more roots than pushed");
+  }
+  stack->size -= n;
+}
+
+size_t h_root_depth(heap_t *heap) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  return own_shadow_stack(heap)->size;
+}
+
+void h_root_scope_exit(h_root_scope_t *scope) {
+  h_pop_roots(scope->heap, h_root_depth(scope->heap) - scope->depth);
+}
+
+// the ranges are read by collections on other threads, they are only changed
+// under the heap lock
+static void add_root_range(heap_t *heap, root_range_t range) {
+  heap_lock(heap);
+  if (heap->root_range_count == heap->root_range_capacity) {
+    size_t capacity =
+        heap->root_range_capacity ? heap->root_range_capacity * 2 : 8;
+    root_range_t *grown =
+        realloc(heap->root_ranges, capacity * sizeof(root_range_t));
+    if (!grown) {
+      assert(!"Could not grow the root ranges");
+    }
+    heap->root_ranges = grown;
+    heap->root_range_capacity = capacity;
+  }
+  heap->root_ranges[heap->root_range_count++] = range;
+  heap_unlock(heap);
+}
+
+void h_add_root_range(heap_t *heap, void *start, void *end) {
+  if (!heap || !start || (uintptr_t)end < (uintptr_t)start) {
+    assert(!"invalid heap or root range");
+  }
+  // only whole aligned words can hold a pointer
+  uintptr_t first = ((uintptr_t)start + sizeof(void *) - 1) &
+                    ~(uintptr_t)(sizeof(void *) - 1);
+  uintptr_t last = (uintptr_t)end & ~(uintptr_t)(sizeof(void *) - 1);
+  if (last <= first) {
+    return;
+  }
+  add_root_range(heap, (root_range_t){(void *)first, (void *)last, 0});
+}
+
+void h_add_root_table(heap_t *heap, void *base, size_t count, size_t stride) {
+  if (!heap || !base || stride == 0 || stride % sizeof(void *) ||
+      (uintptr_t)base % sizeof(void *)) {
+    assert(!"invalid heap or root table");
+  }
+  add_root_range(heap, (root_range_t){base, (uint8_t *)base + count * stride,
+                                      stride});
+}
+
+bool h_remove_root_range(heap_t *heap, void *start) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  heap_lock(heap);
+  bool removed = false;
+  for (size_t i = 0; i < heap->root_range_count; i++) {
+    root_range_t *range = &heap->root_ranges[i];
+    // h_add_root_range may have rounded the start up to a whole word
+    uintptr_t distance = (uintptr_t)range->start - (uintptr_t)start;
+    if (distance < sizeof(void *)) {
+      heap->root_ranges[i] = heap->root_ranges[--heap->root_range_count];
+      removed = true;
+      break;
+    }
+  }
+  heap_unlock(heap);
+  return removed;
+}
+
+size_t h_blacklisted(heap_t *heap) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  heap_lock(heap);
+  size_t slots = 0;
+  for (size_t i = 0; i < heap->page_amount * 2; i++) {
+    slots += __builtin_popcountll(heap->black_map[i]);
+  }
+  heap_unlock(heap);
+  return slots * MIN_OBJECT_SIZE;
+}
+
+page_t *page_of(heap_t *heap, void *ptr) {
+  // below heap_start the subtraction wraps around and fails the range check
+  uintptr_t offset = (uintptr_t)ptr - (uintptr_t)heap->heap_start;
+  if (offset >= heap->page_amount << PAGE_SHIFT) {
+    return NULL;
+  }
+  return heap->page_array[offset >> PAGE_SHIFT];
+}
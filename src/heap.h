@@ -1,24 +1,35 @@
 #pragma once
+#include "gc.h"
 #include "lib/linked_list.h"
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #define PAGE_SIZE 2048
+#define PAGE_SHIFT 11 // PAGE_SIZE == 1 << PAGE_SHIFT
 #define MIN_OBJECT_SIZE 16
+#define GRANULE_SHIFT 4 // MIN_OBJECT_SIZE == 1 << GRANULE_SHIFT
 #define ALIGNMENT 0x1000
+#define GRANULES_PER_PAGE (PAGE_SIZE / MIN_OBJECT_SIZE) // bits per page in map
+#define LINE_SIZE 128 // granularity of holes in mark-region mode
+#define LINES_PER_PAGE (PAGE_SIZE / LINE_SIZE)
 
 /**
  * @brief Represents a single memory page within the heap.
  *
  * Each page tracks metadata related to allocation and compacting:
  *  - `next_empty_space`: pointer to the next available space within the page.
- *  - `page_start`: the usable memory region after the page metadata.
+ *  - `page_start`: the usable memory region of the page, all pages lie back
+ * to back from `heap->heap_start`.
  *  - `remaining_size`: how many bytes are left for allocation in this page.
  *  - `is_active`: marks whether the page is currently used for allocation.
  *  - `is_safe`: used during GC; true if references from stack are considered
  * safe.
  *  - `index`: the page's position in the heap's page array.
+ *  - `line_marks`: one bit per 128 byte line that held live objects after the
+ * last mark-region collection, used to find the next free hole.
  */
 typedef struct page {
   void *next_empty_space;
@@ -27,8 +38,322 @@ typedef struct page {
   bool is_active;
   bool is_safe;
   size_t index;
+  uint32_t line_marks;
 } page_t;
 
+/**
+ * @brief Bookkeeping for deciding when allocation triggers a collection.
+ *
+ *  - `policy`/`extra`: the trigger policy and its argument.
+ *  - `trigger_bytes`: a collection runs when `used_bytes` goes above this.
+ *  - `used_bytes`: allocated bytes, kept up to date by allocation and h_gc.
+ *  - `info`: what the policy saw after the last collection.
+ *  - `last_gc_end_ns`: monotonic time when the last collection finished.
+ *  - `adaptive`: storage for `h_set_adaptive_gc_policy`.
+ */
+typedef struct gc_policy_state {
+  gc_policy_function *policy;
+  void *extra;
+  size_t trigger_bytes;
+  size_t used_bytes;
+  gc_policy_info_t info;
+  uint64_t last_gc_end_ns;
+  gc_adaptive_policy_t adaptive;
+} gc_policy_state_t;
+
+/**
+ * @brief A memory area outside the heap that holds roots.
+ *
+ *  - `start`/`end`: the area, `end` is one past the last byte.
+ *  - `stride`: 0 if every word in the area is checked like a stack word,
+ * otherwise only the pointer slots at `start`, `start + stride`, ... are read.
+ */
+typedef struct root_range {
+  void *start;
+  void *end;
+  size_t stride;
+} root_range_t;
+
+/**
+ * @brief The variables one thread registered with `h_push_root`.
+ *
+ *  - `slots`: their addresses, `size` of `capacity` are used.
+ */
+typedef struct shadow_stack {
+  void ***slots;
+  size_t size;
+  size_t capacity;
+} shadow_stack_t;
+
+/**
+ * @brief What the last collection saw on one stack, see `stack_cache.h`.
+ *
+ *  - `bottom`: the stack it belongs to.
+ *  - `words`: how many words below `bottom` the last scan looked at.
+ *  - `refs`: offsets of the words that pointed into the heap, the word at
+ * `bottom - 1 - refs[i]`, roots as well as blacklisted ones, `ref_count` of
+ * `ref_capacity` are used.
+ *  - `reused`: words the last scan did not have to look at.
+ *  - `serial`: the `serial` of the thread's stack barrier that the words
+ * above the barrier are valid for, see `stack_barrier_t`.
+ *  - `interior`: `interior_pointers` of the heap when the words were checked.
+ *  - `scanned`: set by a scan until the collection has refreshed the stack.
+ */
+typedef struct stack_cache {
+  void **bottom;
+  size_t words;
+  size_t *refs;
+  size_t ref_count;
+  size_t ref_capacity;
+  size_t reused;
+  uint64_t serial;
+  bool interior;
+  bool scanned;
+} stack_cache_t;
+
+/**
+ * @brief The return address a thread's stack barrier replaced, see
+ * `stack_cache.h`. Every thread has one.
+ *
+ *  - `slot`: the return address slot that holds the trampoline, NULL while
+ * the barrier is not armed.
+ *  - `return_address`: what `slot` held before.
+ *  - `watermark`: lowest address of the frame the barrier returns to, the
+ * words from here to the bottom of the stack are unchanged while the barrier
+ * is armed.
+ *  - `serial`: incremented whenever the barrier is armed, disarmed or
+ * returned through.
+ */
+typedef struct stack_barrier {
+  void **slot;
+  void *return_address;
+  void **watermark;
+  uint64_t serial;
+} stack_barrier_t;
+
+/**
+ * @brief A stack registered with `h_register_stack`, e.g. of a coroutine.
+ *
+ *  - `lo`/`hi`: the memory of the stack, it grows down from `hi`.
+ *  - `sp_getter`: returns the saved stack pointer while the stack is
+ * suspended, NULL if all of `[lo, hi)` is scanned.
+ *  - `dirty`: the stack may have changed since the last collection.
+ *  - `running`: the current collection found a thread running on it.
+ *  - `index`: position in the heap's list of stacks.
+ *  - `cache`: what the last collection saw on it.
+ */
+struct gc_stack {
+  void *lo;
+  void *hi;
+  gc_stack_pointer_function *sp_getter;
+  bool dirty;
+  bool running;
+  size_t index;
+  stack_cache_t cache;
+};
+
+/**
+ * @brief A mutator thread attached to a heap with `h_thread_attach`.
+ *
+ *  - `id`: the thread.
+ *  - `heap`: the heap it is attached to.
+ *  - `stack_bottom`: base (highest address) of the thread's stack.
+ *  - `stack_top`: lowest live stack address while the thread is stopped, its
+ * callee-saved registers are spilled above it.
+ *  - `stopped`: true while the thread waits at a safepoint or runs a blocking
+ * function, the collector may then scan and update its stack.
+ *  - `next_of_thread`: the records of the same thread on other heaps.
+ *  - `shadow_stack`: the roots it pushed with `h_push_root`.
+ *  - `cache`: what the last collection saw on its stack.
+ *  - `barrier`: the thread's stack barrier.
+ */
+typedef struct gc_thread {
+  pthread_t id;
+  struct heap *heap;
+  void *stack_bottom;
+  void *stack_top;
+  bool stopped;
+  struct gc_thread *next_of_thread;
+  shadow_stack_t shadow_stack;
+  stack_cache_t cache;
+  stack_barrier_t *barrier;
+} gc_thread_t;
+
+/**
+ * @brief The mutator threads of a heap and the stop-the-world handshake.
+ *
+ *  - `lock`: held by allocation and collection, every heap operation from an
+ * attached thread goes through it.
+ *  - `all_stopped`: signalled when a thread stops for a collection.
+ *  - `resumed`: broadcast when a collection is done.
+ *  - `stop_requested`: set while a collection waits for or runs with the
+ * other threads stopped, polled by `h_safepoint` without the lock.
+ *  - `list`: the attached threads, `count` of `capacity` are used.
+ *  - `stacks`: the registered stacks, `stack_count` of `stack_capacity` are
+ * used.
+ *  - `collector_cache`: what the last collection saw on the stack of a
+ * collecting thread that is not attached.
+ */
+typedef struct gc_threads_state {
+  pthread_mutex_t lock;
+  pthread_cond_t all_stopped;
+  pthread_cond_t resumed;
+  bool stop_requested;
+  gc_thread_t **list;
+  size_t count;
+  size_t capacity;
+  gc_stack_t **stacks;
+  size_t stack_count;
+  size_t stack_capacity;
+  stack_cache_t collector_cache;
+} gc_threads_state_t;
+
+/**
+ * @brief A root slot and its position in the root buffer, sorted to find the
+ * slots that were found more than once.
+ */
+typedef struct root_order {
+  void **slot;
+  size_t index;
+} root_order_t;
+
+/**
+ * @brief The roots found by one scan, kept in the heap between collections.
+ *
+ *  - `slots`: the stack (or shadow stack) locations that hold heap pointers.
+ *  - `values`: what each slot held when it was scanned, a slot whose value
+ * changed since then is not a root any more.
+ *  - `size` of `capacity` entries are in use, both arrays grow by doubling and
+ * are never shrunk so a collection normally does not allocate for its roots.
+ *  - `order`: scratch space of `order_capacity` entries for
+ * `root_buffer_dedupe`, kept for the same reason.
+ */
+typedef struct root_buffer {
+  void ***slots;
+  void **values;
+  size_t size;
+  size_t capacity;
+  root_order_t *order;
+  size_t order_capacity;
+} root_buffer_t;
+
+/**
+ * @brief A list of pointers the copying collector works through, kept in the
+ * heap between collections like `root_buffer_t`.
+ *
+ *  - `items`: the entries, reference slots still to visit or the old headers
+ * of the objects moved so far.
+ *  - `head`: the entries before it are already taken when the list is used
+ * as a queue.
+ *  - `size` of `capacity` entries are in use, the array grows by doubling and
+ * is never shrunk.
+ */
+typedef struct work_list {
+  void **items;
+  size_t head;
+  size_t size;
+  size_t capacity;
+} work_list_t;
+
+#define PROFILE_MAX_FRAMES 32 // deepest backtrace kept for a sampled object
+
+/**
+ * @brief A call site that sampled objects were allocated from.
+ *
+ *  - `frames`: return addresses, innermost first, `depth` of them.
+ *  - `hash`: of the frames, for the lookup table.
+ *  - `samples`/`sample_bytes`: objects sampled here and their sizes.
+ *  - `points`: sampling points that fell in those objects, every point stands
+ * for `mean_bytes` allocated.
+ *  - `live_*`: the same counts for the samples that survived the last
+ * collection.
+ */
+typedef struct alloc_site {
+  void *frames[PROFILE_MAX_FRAMES];
+  int depth;
+  uint64_t hash;
+  size_t samples;
+  size_t sample_bytes;
+  size_t points;
+  size_t live_samples;
+  size_t live_sample_bytes;
+  size_t live_points;
+} alloc_site_t;
+
+/**
+ * @brief A sampled object that was alive at the last collection.
+ *
+ *  - `obj`: its current address.
+ *  - `bytes`: its size including header and padding.
+ *  - `points`: sampling points that fell in it.
+ *  - `site`: index of its call site.
+ */
+typedef struct alloc_sample {
+  void *obj;
+  size_t bytes;
+  size_t points;
+  size_t site;
+} alloc_sample_t;
+
+/**
+ * @brief State of the sampling allocation profiler, see `h_set_alloc_sampling`.
+ *
+ *  - `mean_bytes`: mean distance between two sampling points.
+ *  - `countdown`: bytes left to the next sampling point.
+ *  - `rng`: state of the random generator for the distances.
+ *  - `sites`: the call sites, `site_count` of `site_capacity` are used.
+ *  - `table`: open addressing table of `table_size` (a power of two) site
+ * indexes plus one, 0 is an empty entry.
+ *  - `samples`: the live sampled objects, `sample_count` of
+ * `sample_capacity` are used.
+ */
+typedef struct alloc_profile {
+  size_t mean_bytes;
+  int64_t countdown;
+  uint64_t rng;
+  alloc_site_t *sites;
+  size_t site_count;
+  size_t site_capacity;
+  size_t *table;
+  size_t table_size;
+  alloc_sample_t *samples;
+  size_t sample_count;
+  size_t sample_capacity;
+} alloc_profile_t;
+
+/**
+ * @brief An object allocated while a trace was recorded, alive at the last
+ * collection.
+ *
+ *  - `obj`: its current address.
+ *  - `id`: its number in the trace, objects are numbered from 1 in the order
+ * they were allocated.
+ */
+typedef struct trace_object {
+  void *obj;
+  uint64_t id;
+} trace_object_t;
+
+/**
+ * @brief State of a trace being recorded, see `h_trace_start`.
+ *
+ *  - `file`: the trace file.
+ *  - `next_id`: number of the next allocated object.
+ *  - `objects`: the traced objects, `object_count` of `object_capacity` are
+ * used, followed through every collection like the samples of the profiler.
+ *  - `table`: open addressing table of `table_size` (a power of two) object
+ * indexes plus one by address, 0 is an empty entry.
+ */
+typedef struct trace_recorder {
+  FILE *file;
+  uint64_t next_id;
+  trace_object_t *objects;
+  size_t object_count;
+  size_t object_capacity;
+  size_t *table;
+  size_t table_size;
+} trace_recorder_t;
+
 /**
  * @brief Represents the entire heap memory space managed by the custom
  * allocator.
@@ -40,6 +365,10 @@ typedef struct page {
  * scanning).
  *
  * Fields:
+ *  - `alloc_buffer`: bump region of the inline allocation fast path, must be
+ * the first member so that `gc_inline.h` reaches it through the opaque heap
+ * pointer. `alloc_buffer_start` is where it was opened, NULL while there is
+ * none, see `alloc_buffer.h`.
  *  - `heap_start`: pointer to the start of the usable heap memory.
  *  - `heap_size`: total number of bytes allocated for the heap.
  *  - `page_array`: array of pointers to pages (each holding page metadata).
@@ -47,8 +376,45 @@ typedef struct page {
  *  - `safe`: indicates whether the stack is treated as safe for GC.
  *  - `GC_threshold`: fraction (0.0–1.0) of heap usage that triggers GC.
  *  - `alloc_map`: bitmap representing allocated slots in the heap.
+ *  - `start_map`: same layout as `alloc_map` but only the first slot (the
+ * header) of every object is set, used to tell object pointers apart from
+ * other words.
+ *  - `black_map`: same layout again, slots that a word of a conservative scan
+ * pointed at while no object was there. Allocation does not put objects
+ * where such a word would keep them alive, the map is rebuilt by every
+ * collection.
+ *  - `visit_map`: same layout again, the objects `traverse_and_forward` has
+ * already followed, or what `h_census` marked. Cleared at the start of every
+ * traversal.
+ *  - `gc_mode`: which collector `h_gc` runs (copying, sliding or
+ * mark-region).
+ *  - `copy_order`: traversal order of the copying collector.
+ *  - `gc_policy`: when allocation triggers a collection.
+ *  - `root_mode`: conservative stack scanning or precise roots.
+ *  - `interior_pointers`: whether pointers into the middle of an object keep
+ * it alive, see `h_set_interior_pointers`.
+ *  - `stack_barriers`: whether thread stacks are only scanned up to a stack
+ * barrier, see `h_set_stack_barriers`.
+ *  - `shadow_stack`: the roots pushed with `h_push_root` by threads that are
+ * not attached, every attached thread has its own.
+ *  - `roots`: buffer filled by `find_gc_roots`, reused by every collection.
+ *  - `work`, `moved`: the traversal queue of the copying collector and the
+ * objects it has moved, reused the same way.
+ *  - `root_ranges`: registered areas outside the heap that are scanned for
+ * roots in every root mode, `root_range_count` of `root_range_capacity` are
+ * used.
+ *  - `threads`: attached mutator threads and the lock they share, allocated
+ * separately to keep `heap_t` small.
+ *  - `stats`: what the collections and allocations did, see `h_stats`.
+ *  - `event_hook`: called at GC events with `event_extra`, see
+ * `h_set_event_hook`.
+ *  - `profile`: the allocation profiler, NULL unless sampling is on.
+ *  - `trace`: the trace being recorded, NULL unless `h_trace_start` was
+ * called.
  */
 typedef struct heap {
+  gc_alloc_buffer_t alloc_buffer;
+  uint8_t *alloc_buffer_start;
   void *heap_start;
   size_t heap_size;
   page_t **page_array;
@@ -56,6 +422,28 @@ typedef struct heap {
   bool safe;
   float GC_threshold;
   uint64_t *alloc_map;
+  uint64_t *start_map;
+  uint64_t *black_map;
+  uint64_t *visit_map;
+  gc_mode_t gc_mode;
+  copy_order_t copy_order;
+  gc_policy_state_t gc_policy;
+  root_mode_t root_mode;
+  bool interior_pointers;
+  bool stack_barriers;
+  shadow_stack_t shadow_stack;
+  root_buffer_t roots;
+  work_list_t work;
+  work_list_t moved;
+  root_range_t *root_ranges;
+  size_t root_range_count;
+  size_t root_range_capacity;
+  gc_threads_state_t *threads;
+  gc_stats_t *stats;
+  gc_event_hook_function *event_hook;
+  void *event_extra;
+  alloc_profile_t *profile;
+  trace_recorder_t *trace;
 } heap_t;
 
 /**
@@ -63,10 +451,12 @@ typedef struct heap {
  *        and page metadata for use in a custom memory manager or garbage
  * collector.
  *
- * This function allocates a contiguous memory block large enough to contain:
+ * This function allocates a contiguous memory block large enough to contain,
+ * in this order:
  *  - Heap metadata (`heap_t`)
- *  - All heap pages (`page_t`)
- *  - An allocation bitmap for tracking object allocations
+ *  - An object start bitmap, an allocation bitmap and a blacklist bitmap
+ *  - The data of all pages, back to back (`heap_start`)
+ *  - The page metadata (`page_t`)
  *  - An array of pointers to each page
  *
  * It ensures the allocated memory is properly aligned using `posix_memalign`
@@ -119,3 +509,176 @@ void h_delete(heap_t *heap);
  * @note If `heap` is NULL, the program will abort via `assert`.
  */
 void h_delete_dbg(heap_t *heap, unsigned char dbg_value);
+
+/**
+ * @brief Selects the collector that `h_gc` runs on this heap.
+ *
+ * The mode can be changed between collections, every collector leaves the
+ * pages in a state the others can start from.
+ *
+ * @param heap A pointer to the heap.
+ * @param mode `GC_MODE_COPYING` (default), `GC_MODE_SLIDING` or
+ * `GC_MODE_MARK_REGION`.
+ */
+void h_set_gc_mode(heap_t *heap, gc_mode_t mode);
+
+/**
+ * @brief Selects the order in which the copying collector moves objects.
+ *
+ * @param heap  A pointer to the heap.
+ * @param order `COPY_ORDER_BFS` (default) or `COPY_ORDER_DFS`.
+ */
+void h_set_copy_order(heap_t *heap, copy_order_t order);
+
+/**
+ * @brief Selects where `h_gc` finds its roots.
+ *
+ * In `ROOT_MODE_PRECISE` the stack is not scanned at all, only the variables
+ * on the shadow stack are roots. Every pointer into the heap that must
+ * survive a collection then has to be registered with `h_push_root`, and
+ * since nothing is guessed the collectors can move every object.
+ *
+ * @param heap A pointer to the heap.
+ * @param mode `ROOT_MODE_CONSERVATIVE` (default) or `ROOT_MODE_PRECISE`.
+ */
+void h_set_root_mode(heap_t *heap, root_mode_t mode);
+
+/**
+ * @brief Lets pointers into the middle of objects act as references.
+ *
+ * With interior pointers on, any address inside an allocated object (header
+ * excluded) keeps the whole object alive, and when the object moves the
+ * pointer moves with it and keeps its offset. This makes slices into
+ * `h_alloc_raw` buffers possible without copying them out. The enclosing
+ * object is found with the start map, so roots and pointer fields are
+ * resolved by every collector.
+ *
+ * Off by default: conservative scanning then also takes words that point
+ * into a dead object for roots, which retains more garbage.
+ *
+ * @param heap    A pointer to the heap.
+ * @param enabled true to accept interior pointers.
+ */
+void h_set_interior_pointers(heap_t *heap, bool enabled);
+
+/**
+ * @brief Lets collections skip the old frames of deep thread stacks.
+ *
+ * With stack barriers on, every collection replaces a return address deep in
+ * the stack of each thread it scanned with a trampoline. Until the thread
+ * returns through it, the frames above the barrier stay as they were and the
+ * next collection only rescans the frames below it, the roots above are
+ * taken from the last scan (see `stack_cache.h`).
+ *
+ * Off by default, since it restricts the program: frames above the barrier
+ * must not be written through pointers from deeper frames (e.g. a heap
+ * pointer stored into a caller's local through `&local`), and no `longjmp`,
+ * thread cancellation or exception may unwind past it. `backtrace` stops at
+ * the barrier, and shadow stacks (CET) reject it. Only x86-64 has barriers,
+ * elsewhere the stacks are scanned in full.
+ *
+ * @param heap    A pointer to the heap.
+ * @param enabled true to use stack barriers.
+ */
+void h_set_stack_barriers(heap_t *heap, bool enabled);
+
+/**
+ * @brief Registers a variable holding a pointer into the heap as a root.
+ *
+ * The variable is read at every collection and updated if its object moves,
+ * so it must stay alive until it is popped. NULL or non-heap values are
+ * ignored. Each variable should be pushed at most once. Every attached thread
+ * has a shadow stack of its own, threads that are not attached share one.
+ *
+ * @param heap A pointer to the heap.
+ * @param slot Address of the variable, e.g. `&list`.
+ */
+void h_push_root(heap_t *heap, void *slot);
+
+/**
+ * @brief Removes the `n` roots the calling thread pushed most recently.
+ *
+ * @param heap A pointer to the heap.
+ * @param n    Number of roots to pop, at most `h_root_depth(heap)`.
+ */
+void h_pop_roots(heap_t *heap, size_t n);
+
+/**
+ * @brief Number of roots currently on the calling thread's shadow stack.
+ *
+ * @param heap A pointer to the heap.
+ * @return The shadow stack depth.
+ */
+size_t h_root_depth(heap_t *heap);
+
+/**
+ * @brief Pops a shadow stack frame opened with `H_ROOT_SCOPE`.
+ *
+ * Called automatically when the block holding the frame is left.
+ *
+ * @param scope The frame, pops everything pushed after it was opened.
+ */
+void h_root_scope_exit(h_root_scope_t *scope);
+
+/**
+ * @brief Registers an area outside the heap whose words may point into it.
+ *
+ * For globals, static data or malloc'd structures that keep heap pointers.
+ * Every aligned word in [start, end) is checked like a word on the stack,
+ * and updated when its object moves, in both root modes.
+ *
+ * @param heap  A pointer to the heap.
+ * @param start First byte of the area.
+ * @param end   One past the last byte of the area.
+ */
+void h_add_root_range(heap_t *heap, void *start, void *end);
+
+/**
+ * @brief Registers a table of pointer slots outside the heap.
+ *
+ * Only the `count` slots `base`, `base + stride`, ... are read, so a large
+ * static table of structs with one heap pointer each costs `count` lookups
+ * instead of a scan of every word. A slot that is NULL or does not point at
+ * an object is skipped.
+ *
+ * @param heap   A pointer to the heap.
+ * @param base   Address of the first pointer slot.
+ * @param count  Number of slots.
+ * @param stride Bytes from one slot to the next, `sizeof(void *)` for a plain
+ * array of pointers. Must be a multiple of 8.
+ */
+void h_add_root_table(heap_t *heap, void *base, size_t count, size_t stride);
+
+/**
+ * @brief Unregisters the range or table that starts at `start`.
+ *
+ * Must be called before the memory of a registered range is freed.
+ *
+ * @param heap  A pointer to the heap.
+ * @param start The `start` or `base` it was registered with.
+ * @return true if a range was removed.
+ */
+bool h_remove_root_range(heap_t *heap, void *start);
+
+/**
+ * @brief How much of the heap the last collection blacklisted.
+ *
+ * Words on the stack (or in a conservatively scanned root range) that look
+ * like a pointer to a free slot, e.g. integers or hashes, would keep an object
+ * allocated there alive. Every collection records those slots and the
+ * allocator skips them, so this is roughly the memory such noise costs
+ * instead of garbage it retains.
+ *
+ * @param heap A pointer to the heap.
+ * @return Bytes in blacklisted slots.
+ */
+size_t h_blacklisted(heap_t *heap);
+
+/**
+ * @brief Finds the page whose usable memory contains `ptr`.
+ *
+ * @param heap A pointer to the heap.
+ * @param ptr  Any address.
+ * @return The page holding `ptr`, or NULL if `ptr` lies outside the pages.
+ */
+page_t *page_of(heap_t *heap, void *ptr);
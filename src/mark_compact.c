@@ -0,0 +1,186 @@
+#include "mark_compact.h"
+#include "alloc_profile.h"
+#include "allocation.h"
+#include "compacting.h"
+#include "debug.h"
+#include "gc_events.h"
+#include "gc_policy.h"
+#include "gc_stats.h"
+#include "trace.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// index of the first slot of the object in the (alloc/live) map
+static int slot_index(heap_t *h, void *obj) {
+  page_t *page = page_of(h, obj);
+  uint8_t *header = (uint8_t *)obj - HEADER_SIZE;
+  return page->index * GRANULES_PER_PAGE +
+         (header - (uint8_t *)page->page_start) / MIN_OBJECT_SIZE;
+}
+
+// number of set bits before `granule` in the 128 bits that belong to the page
+static size_t live_slots_before(uint64_t *live_map, size_t page_index,
+                                int granule) {
+  uint64_t low = live_map[page_index * 2];
+  uint64_t high = live_map[page_index * 2 + 1];
+
+  if (granule == 0) {
+    return 0;
+  }
+  // the first slot of the page is the most significant bit
+  if (granule <= 64) {
+    return __builtin_popcountll(low >> (64 - granule));
+  }
+  return __builtin_popcountll(low) +
+         __builtin_popcountll(high >> (128 - granule));
+}
+
+void mark_live_objects(heap_t *h, root_buffer_t *roots, uint64_t *live_map) {
+  // depth first, objects are marked when they are popped
+  ioopm_list_t *stack = ioopm_linked_list_create(ioopm_ptr_cmp_func);
+
+  for (size_t j = 0; j < roots->size; j++) {
+    void *obj = object_base(h, *roots->slots[j]);
+    if (obj) {
+      ioopm_linked_list_prepend(stack, (elem_t){.ptr = obj});
+    }
+  }
+
+  elem_t current;
+  while (ioopm_linked_list_remove(stack, 0, &current)) {
+    void *obj = current.ptr;
+    int start = slot_index(h, obj);
+    if (get_bit_in_alloc_map(live_map, start)) {
+      continue; // already marked
+    }
+    set_bits_in_alloc_map(live_map, start, object_total_size(obj));
+
+    size_t num_pointers;
+    size_t obj_size;
+    void ***pointer_array = interpret_header(obj, &num_pointers, &obj_size);
+    for (size_t i = 0; i < num_pointers; i++) {
+      void *child = object_base(h, *pointer_array[i]);
+      if (child) {
+        ioopm_linked_list_prepend(stack, (elem_t){.ptr = child});
+      }
+    }
+    free(pointer_array);
+  }
+
+  ioopm_linked_list_destroy(stack);
+}
+
+bool is_marked(heap_t *h, uint64_t *live_map, void *obj) {
+  return get_bit_in_alloc_map(live_map, slot_index(h, obj));
+}
+
+// where an object will be after sliding, NULL if it is dead
+static void *slid_to(heap_t *h, void *obj, void *live_map) {
+  return is_marked(h, live_map, obj) ? slide_destination(h, live_map, obj)
+                                     : NULL;
+}
+
+void *slide_destination(heap_t *h, uint64_t *live_map, void *obj) {
+  page_t *page = page_of(h, obj);
+  int granule = slot_index(h, obj) - page->index * GRANULES_PER_PAGE;
+  size_t before = live_slots_before(live_map, page->index, granule);
+  return (uint8_t *)page->page_start + before * MIN_OBJECT_SIZE + HEADER_SIZE;
+}
+
+// points `*slot` at the address its object will have after sliding, an
+// interior pointer keeps its offset into the object
+static void update_reference(heap_t *h, uint64_t *live_map, void **slot) {
+  void *obj = object_base(h, *slot);
+  if (obj && get_bit_in_alloc_map(live_map, slot_index(h, obj))) {
+    *slot = (uint8_t *)slide_destination(h, live_map, obj) +
+            ((uint8_t *)*slot - (uint8_t *)obj);
+  }
+}
+
+// rewrites every root and every pointer field in a live object to the address
+// the target will have after sliding, must run before anything is moved
+static void update_references(heap_t *h, root_buffer_t *roots,
+                              uint64_t *live_map) {
+  for (size_t j = 0; j < roots->size; j++) {
+    update_reference(h, live_map, roots->slots[j]);
+  }
+
+  for (size_t p = 0; p < h->page_amount; p++) {
+    page_cursor_t cursor = page_cursor_start(h->page_array[p], live_map);
+    void *obj;
+    while ((obj = page_cursor_next(&cursor)) != NULL) {
+      size_t num_pointers;
+      size_t obj_size;
+      void ***pointer_array = interpret_header(obj, &num_pointers, &obj_size);
+      for (size_t i = 0; i < num_pointers; i++) {
+        update_reference(h, live_map, pointer_array[i]);
+      }
+      free(pointer_array);
+    }
+  }
+}
+
+// moves the live objects of one page down to the page start in address order
+// and rebuilds the page metadata and its part of the allocation map
+static void slide_page(heap_t *h, page_t *page, uint64_t *live_map) {
+  int first_bit = page->index * GRANULES_PER_PAGE;
+  uint8_t *destination = (uint8_t *)page->page_start;
+  h->start_map[page->index * 2] = 0;
+  h->start_map[page->index * 2 + 1] = 0;
+
+  // the cursor reads the size before the object is moved, the destination
+  // can overlap the header
+  page_cursor_t cursor = page_cursor_start(page, live_map);
+  uint8_t *obj;
+  while ((obj = page_cursor_next(&cursor)) != NULL) {
+    uint8_t *header = obj - HEADER_SIZE;
+    size_t size = cursor.size;
+    if (destination != header) {
+      memmove(destination, header, size);
+      gc_stats_note_copy(h, size);
+    }
+    set_bits_in_alloc_map(h->start_map,
+                          first_bit + (destination - (uint8_t *)page->page_start) /
+                                          MIN_OBJECT_SIZE,
+                          MIN_OBJECT_SIZE);
+    destination += size;
+  }
+
+  size_t used = destination - (uint8_t *)page->page_start;
+  DEBUG_PRINT("slid page %lu, %lu bytes live\n", page->index, used);
+
+  h->alloc_map[page->index * 2] = 0;
+  h->alloc_map[page->index * 2 + 1] = 0;
+  set_bits_in_alloc_map(h->alloc_map, first_bit, used);
+
+  if (page->is_active && used == 0) {
+    gc_stats_note_page_reset(h);
+  }
+  page->next_empty_space = destination;
+  page->remaining_size = PAGE_SIZE - used;
+  page->is_active = used > 0;
+}
+
+void mark_compact(heap_t *h, root_buffer_t *roots) {
+  uint64_t *live_map = calloc(h->page_amount * 2, sizeof(uint64_t));
+
+  uint64_t start_ns = gc_clock_ns();
+  mark_live_objects(h, roots, live_map);
+  uint64_t marked_ns = gc_clock_ns();
+  alloc_profile_update(h, slid_to, live_map);
+  trace_update(h, slid_to, live_map);
+  update_references(h, roots, live_map);
+  uint64_t forwarded_ns = gc_clock_ns();
+  gc_event_emit(h, GC_EVENT_FORWARD_END, 0);
+  for (size_t p = 0; p < h->page_amount; p++) {
+    slide_page(h, h->page_array[p], live_map);
+  }
+  h->stats->last.move_ns +=
+      (marked_ns - start_ns) + (gc_clock_ns() - forwarded_ns);
+  h->stats->last.forward_ns += forwarded_ns - marked_ns;
+  gc_event_emit(h, GC_EVENT_MOVE_END, 0);
+
+  free(live_map);
+}
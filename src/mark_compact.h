@@ -0,0 +1,64 @@
+#pragma once
+
+#include "heap.h"
+#include "lib/linked_list.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Sliding mark-compact collector (GC_MODE_SLIDING)
+ *
+ * Instead of evacuating live objects to passive pages, every page is
+ * compacted in place: the live objects keep their address order and are slid
+ * down to the start of the page they already live in. No copy reserve is
+ * needed, so the whole heap can be used for allocation.
+ *
+ * New addresses are computed table based from a live map with the same
+ * format as `alloc_map` (one bit per 16 byte slot of every live object):
+ * an object moves to `page_start + 16 * (live slots before it in the page)`.
+ * Object headers stay intact during the whole collection, there are no
+ * forwarding addresses written into the heap.
+ */
+
+/**
+ * @brief Marks all objects reachable from the roots in a live map.
+ *
+ * @param h          Pointer to the heap.
+ * @param roots      Stack locations (void **) that may hold roots,
+ * locations that no longer point at an object are skipped.
+ * @param live_map   Zeroed map with the same size as `h->alloc_map`, every
+ * slot of every reachable object is set.
+ */
+void mark_live_objects(heap_t *h, root_buffer_t *roots, uint64_t *live_map);
+
+/**
+ * @brief Checks if `mark_live_objects` reached an object.
+ *
+ * @param h         Pointer to the heap.
+ * @param live_map  Live map filled in by `mark_live_objects`.
+ * @param obj       An object (pointer just after its header).
+ * @return true if the object is live.
+ */
+bool is_marked(heap_t *h, uint64_t *live_map, void *obj);
+
+/**
+ * @brief Computes the address an object will have after sliding.
+ *
+ * @param h         Pointer to the heap.
+ * @param live_map  Live map filled in by `mark_live_objects`.
+ * @param obj       A marked object (pointer just after its header).
+ * @return The new address of the object (pointer just after its header).
+ */
+void *slide_destination(heap_t *h, uint64_t *live_map, void *obj);
+
+/**
+ * @brief Runs a full sliding collection from the given roots.
+ *
+ * Marks, updates all root and heap references to the new addresses, slides
+ * every page and rebuilds `alloc_map` and the page metadata. Pages with no
+ * live objects left become passive.
+ *
+ * @param h          Pointer to the heap.
+ * @param roots      Stack locations (void **) that may hold roots.
+ */
+void mark_compact(heap_t *h, root_buffer_t *roots);
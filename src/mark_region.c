@@ -0,0 +1,285 @@
+#include "mark_region.h"
+#include "alloc_profile.h"
+#include "allocation.h"
+#include "compacting.h"
+#include "debug.h"
+#include "gc_events.h"
+#include "gc_policy.h"
+#include "gc_stats.h"
+#include "mark_compact.h"
+#include "trace.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GRANULES_PER_LINE (LINE_SIZE / MIN_OBJECT_SIZE)
+
+int find_hole(uint32_t line_marks, int from_line, size_t size,
+              int *hole_lines) {
+  int line = from_line;
+  while (line < LINES_PER_PAGE) {
+    if (line_marks & (1u << line)) {
+      line++;
+      continue;
+    }
+    int start = line;
+    while (line < LINES_PER_PAGE && !(line_marks & (1u << line))) {
+      line++;
+    }
+    if ((size_t)(line - start) * LINE_SIZE >= size) {
+      *hole_lines = line - start;
+      return start;
+    }
+  }
+  return -1;
+}
+
+int count_holes(uint32_t line_marks) {
+  int holes = 0;
+  bool in_hole = false;
+  for (int line = 0; line < LINES_PER_PAGE; line++) {
+    bool is_free = !(line_marks & (1u << line));
+    if (is_free && !in_hole) {
+      holes++;
+    }
+    in_hole = is_free;
+  }
+  return holes;
+}
+
+// line n is live if any of its 8 slots are set, every line is one byte of
+// the map with the first line in the most significant byte
+static uint32_t lines_from_map(uint64_t *map, size_t page_index) {
+  uint32_t line_marks = 0;
+  for (int line = 0; line < LINES_PER_PAGE; line++) {
+    uint64_t part = map[page_index * 2 + line / 8];
+    if ((part >> (56 - 8 * (line % 8))) & 0xFF) {
+      line_marks |= 1u << line;
+    }
+  }
+  return line_marks;
+}
+
+static size_t live_bytes_in_page(uint64_t *map, size_t page_index) {
+  return (__builtin_popcountll(map[page_index * 2]) +
+          __builtin_popcountll(map[page_index * 2 + 1])) *
+         MIN_OBJECT_SIZE;
+}
+
+static void clear_bits_in_map(uint64_t *map, int start_index, size_t bytes) {
+  for (size_t i = 0; i < bytes / MIN_OBJECT_SIZE; i++) {
+    int index = start_index + i;
+    map[(index / 128) * 2 + (index % 128) / 64] &=
+        ~(1ULL << (63 - (index % 64)));
+  }
+}
+
+// finds a free page with room for size bytes to evacuate into
+static page_t *evacuation_target(heap_t *h, bool *is_target, size_t size) {
+  for (size_t p = 0; p < h->page_amount; p++) {
+    if (is_target[p] && h->page_array[p]->remaining_size >= size) {
+      return h->page_array[p];
+    }
+  }
+  return NULL;
+}
+
+// copies the live objects of the most fragmented pages into pages without any
+// live objects and leaves a forwarding address in their old header, the live
+// map is updated to the new positions
+// returns true if anything was moved
+static bool evacuate_fragmented_pages(heap_t *h, uint64_t *live_map,
+                                      bool *is_candidate) {
+  bool *is_target = calloc(h->page_amount, sizeof(bool));
+  bool moved = false;
+
+  for (size_t p = 0; p < h->page_amount; p++) {
+    size_t live = live_bytes_in_page(live_map, p);
+    if (live == 0) {
+      // nothing survived here, start from an empty page
+      page_t *page = h->page_array[p];
+      is_target[p] = true;
+      page->next_empty_space = page->page_start;
+      page->remaining_size = PAGE_SIZE;
+    } else if (live <= EVACUATION_LIVE_LIMIT &&
+               count_holes(lines_from_map(live_map, p)) > 1) {
+      is_candidate[p] = true;
+    }
+  }
+
+  for (size_t p = 0; p < h->page_amount; p++) {
+    if (!is_candidate[p]) {
+      continue;
+    }
+    int first_bit = p * GRANULES_PER_PAGE;
+    // the header is overwritten with the forwarding address after the cursor
+    // has read the size
+    page_cursor_t cursor = page_cursor_start(h->page_array[p], live_map);
+    uint8_t *obj;
+    while ((obj = page_cursor_next(&cursor)) != NULL) {
+      uint8_t *header = obj - HEADER_SIZE;
+      size_t size = cursor.size;
+
+      page_t *target = evacuation_target(h, is_target, size);
+      if (target == NULL) {
+        // out of free pages, the rest stays where it is
+        continue;
+      }
+      uint8_t *new_header = target->next_empty_space;
+      memcpy(new_header, header, size);
+      gc_stats_note_copy(h, size);
+      target->next_empty_space = new_header + size;
+      target->remaining_size -= size;
+
+      clear_bits_in_map(live_map, first_bit + cursor.granule, size);
+      set_bits_in_alloc_map(live_map,
+                            target->index * GRANULES_PER_PAGE +
+                                (new_header - (uint8_t *)target->page_start) /
+                                    MIN_OBJECT_SIZE,
+                            size);
+
+      // tag b1b0 = 0b01 means forwarding address, same as the copying mode
+      *(uint64_t *)header = (uint64_t)(new_header + HEADER_SIZE) | 0x1;
+      moved = true;
+    }
+    DEBUG_PRINT("evacuated page %lu\n", p);
+  }
+
+  free(is_target);
+  return moved;
+}
+
+// where a reference points after its object was evacuated, otherwise NULL,
+// an interior pointer keeps its offset into the object
+static void *evacuated_to(heap_t *h, bool *is_candidate, void *ptr) {
+  // the start map of the target pages is only rebuilt afterwards, so the page
+  // is checked before the object is looked up
+  page_t *page = page_of(h, ptr);
+  if (page == NULL || !is_candidate[page->index]) {
+    return NULL;
+  }
+  void *obj = object_base(h, ptr);
+  if (!header_is_forwarding_address(obj)) {
+    return NULL;
+  }
+  return (uint8_t *)extract_adress(*((uint64_t *)obj - 1)) +
+         ((uint8_t *)ptr - (uint8_t *)obj);
+}
+
+// a live object stays where it is until it is evacuated
+static void *marked_at(heap_t *h, void *obj, void *live_map) {
+  return is_marked(h, live_map, obj) ? obj : NULL;
+}
+
+// where a live object is after the evacuation
+static void *evacuated_or_kept(heap_t *h, void *obj, void *is_candidate) {
+  void *moved_to = evacuated_to(h, is_candidate, obj);
+  return moved_to ? moved_to : obj;
+}
+
+// rewrites roots and pointer fields that point at evacuated objects
+static void forward_references(heap_t *h, root_buffer_t *root_slots,
+                               uint64_t *live_map, bool *is_candidate) {
+  for (size_t j = 0; j < root_slots->size; j++) {
+    void **slot = root_slots->slots[j];
+    void *moved_to = evacuated_to(h, is_candidate, *slot);
+    if (moved_to) {
+      *slot = moved_to;
+    }
+  }
+
+  for (size_t p = 0; p < h->page_amount; p++) {
+    page_cursor_t cursor = page_cursor_start(h->page_array[p], live_map);
+    void *obj;
+    while ((obj = page_cursor_next(&cursor)) != NULL) {
+      size_t num_pointers;
+      size_t obj_size;
+      void ***pointer_array = interpret_header(obj, &num_pointers, &obj_size);
+      for (size_t i = 0; i < num_pointers; i++) {
+        void *moved_to = evacuated_to(h, is_candidate, *pointer_array[i]);
+        if (moved_to) {
+          *pointer_array[i] = moved_to;
+        }
+      }
+      free(pointer_array);
+    }
+  }
+}
+
+// the live map becomes the allocation map and the page cursor is placed in
+// the first hole, completely empty pages become passive
+static void rebuild_page(heap_t *h, page_t *page, uint64_t *live_map) {
+  size_t p = page->index;
+  h->alloc_map[p * 2] = live_map[p * 2];
+  h->alloc_map[p * 2 + 1] = live_map[p * 2 + 1];
+  rebuild_start_map(h, page);
+  page->line_marks = lines_from_map(live_map, p);
+
+  if (page->line_marks == 0) {
+    if (page->is_active) {
+      gc_stats_note_page_reset(h);
+    }
+    page->is_active = false;
+    page->next_empty_space = page->page_start;
+    page->remaining_size = PAGE_SIZE;
+    return;
+  }
+
+  page->is_active = true;
+  int hole_lines;
+  int hole = find_hole(page->line_marks, 0, LINE_SIZE, &hole_lines);
+  if (hole < 0) {
+    // no free line at all
+    page->next_empty_space = (uint8_t *)page->page_start + PAGE_SIZE;
+    page->remaining_size = 0;
+  } else {
+    page->next_empty_space = (uint8_t *)page->page_start + hole * LINE_SIZE;
+    page->remaining_size = hole_lines * LINE_SIZE;
+  }
+}
+
+void mark_region(heap_t *h, root_buffer_t *roots, bool allow_evacuation) {
+  uint64_t *live_map = calloc(h->page_amount * 2, sizeof(uint64_t));
+  bool *is_candidate = calloc(h->page_amount, sizeof(bool));
+
+  uint64_t start_ns = gc_clock_ns();
+  mark_live_objects(h, roots, live_map);
+  // dead samples and traced objects first, the evacuation may reuse their memory
+  alloc_profile_update(h, marked_at, live_map);
+  trace_update(h, marked_at, live_map);
+
+  if (allow_evacuation) {
+    // remember the roots that really point at objects before headers in the
+    // evacuated pages are overwritten with forwarding addresses, the roots
+    // are only read after this so they are filtered in place
+    size_t kept = 0;
+    for (size_t j = 0; j < roots->size; j++) {
+      if (object_base(h, *roots->slots[j])) {
+        roots->slots[kept] = roots->slots[j];
+        roots->values[kept] = roots->values[j];
+        kept++;
+      }
+    }
+    roots->size = kept;
+
+    if (evacuate_fragmented_pages(h, live_map, is_candidate)) {
+      uint64_t evacuated_ns = gc_clock_ns();
+      h->stats->last.move_ns += evacuated_ns - start_ns;
+      forward_references(h, roots, live_map, is_candidate);
+      start_ns = gc_clock_ns();
+      h->stats->last.forward_ns += start_ns - evacuated_ns;
+      gc_event_emit(h, GC_EVENT_FORWARD_END, 0);
+      alloc_profile_update(h, evacuated_or_kept, is_candidate);
+      trace_update(h, evacuated_or_kept, is_candidate);
+    }
+  }
+
+  for (size_t p = 0; p < h->page_amount; p++) {
+    rebuild_page(h, h->page_array[p], live_map);
+  }
+  h->stats->last.move_ns += gc_clock_ns() - start_ns;
+  gc_event_emit(h, GC_EVENT_MOVE_END, 0);
+
+  free(is_candidate);
+  free(live_map);
+}
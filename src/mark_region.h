@@ -0,0 +1,61 @@
+#pragma once
+
+#include "heap.h"
+#include "lib/linked_list.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Mark-region collector (GC_MODE_MARK_REGION)
+ *
+ * Every 2048 byte page is split into 16 lines of 128 bytes. A collection
+ * marks the live objects, records which lines hold live data in
+ * `page_t::line_marks` and leaves the objects where they are. The runs of
+ * free lines (holes) are then reused by the allocator, which bump allocates
+ * into one hole at a time and moves on to the next hole in the page when the
+ * current one is too small.
+ *
+ * Only the most fragmented pages, little live data scattered over several
+ * holes, are evacuated into completely free pages, so most collections are
+ * mark-only and never copy anything.
+ */
+
+/// pages with at most this many live bytes are candidates for evacuation
+#define EVACUATION_LIVE_LIMIT (PAGE_SIZE / 4)
+
+/**
+ * @brief Finds a run of free lines big enough for an allocation.
+ *
+ * @param line_marks  Line marks of the page (bit n set means line n is live).
+ * @param from_line   First line to consider.
+ * @param size        Bytes that must fit in the hole.
+ * @param hole_lines  Output: length of the found hole in lines.
+ * @return Index of the first line of the hole, or -1 if no hole fits.
+ */
+int find_hole(uint32_t line_marks, int from_line, size_t size,
+              int *hole_lines);
+
+/**
+ * @brief Counts the runs of free lines in a page.
+ *
+ * @param line_marks Line marks of the page.
+ * @return Number of holes.
+ */
+int count_holes(uint32_t line_marks);
+
+/**
+ * @brief Runs a mark-region collection from the given roots.
+ *
+ * Marks all reachable objects, optionally evacuates the most fragmented
+ * pages into free pages (updating every reference to the moved objects),
+ * and then rebuilds `alloc_map`, the line marks and the page cursors so that
+ * allocation continues in the first hole of each page.
+ *
+ * @param h                 Pointer to the heap.
+ * @param roots             Stack locations (void **) that may hold roots. With
+ * evacuation the locations that do not point at an object are removed from
+ * the buffer.
+ * @param allow_evacuation  If false nothing is moved at all.
+ */
+void mark_region(heap_t *h, root_buffer_t *roots, bool allow_evacuation);
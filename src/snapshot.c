@@ -0,0 +1,152 @@
+#include "snapshot.h"
+#include "allocation.h"
+#include "compacting.h"
+#include "find_roots.h"
+#include "stack_cache.h"
+#include "threads.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// words waiting to be written, flushed whenever the chunk is full
+typedef struct snapshot_writer {
+  int fd;
+  uint64_t words[SNAPSHOT_CHUNK_WORDS];
+  size_t count;
+  bool failed;
+} snapshot_writer_t;
+
+static void flush(snapshot_writer_t *w) {
+  const uint8_t *data = (const uint8_t *)w->words;
+  size_t left = w->count * sizeof(uint64_t);
+  while (left > 0 && !w->failed) {
+    ssize_t written = write(w->fd, data, left);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      w->failed = true;
+      break;
+    }
+    data += written;
+    left -= written;
+  }
+  w->count = 0;
+}
+
+static void emit(snapshot_writer_t *w, uint64_t word) {
+  if (w->count == SNAPSHOT_CHUNK_WORDS) {
+    flush(w);
+  }
+  w->words[w->count++] = word;
+}
+
+static size_t write_roots(snapshot_writer_t *w, root_buffer_t *roots) {
+  size_t written = 0;
+  for (size_t j = 0; j < roots->size; j++) {
+    // a slot that changed after the scan is not a root any more
+    if (*roots->slots[j] != roots->values[j]) {
+      continue;
+    }
+    emit(w, SNAPSHOT_ROOT);
+    emit(w, (uintptr_t)roots->slots[j]);
+    emit(w, (uintptr_t)roots->values[j]);
+    written++;
+  }
+  return written;
+}
+
+static size_t write_objects(snapshot_writer_t *w, heap_t *h) {
+  size_t written = 0;
+  for (size_t p = 0; p < h->page_amount; p++) {
+    page_cursor_t cursor = page_cursor_start(h->page_array[p], h->alloc_map);
+    uint8_t *obj;
+    while ((obj = page_cursor_next(&cursor)) != NULL) {
+      // decoded on the stack, the child of a threaded process must not
+      // allocate
+      void **fields[MAX_POINTER_FIELDS];
+      size_t num_pointers = object_pointer_fields(obj, fields);
+      emit(w, (uint64_t)num_pointers << 8 | SNAPSHOT_OBJECT);
+      emit(w, (uintptr_t)obj);
+      emit(w, *((uint64_t *)obj - 1));
+      emit(w, cursor.size);
+      for (size_t i = 0; i < num_pointers; i++) {
+        emit(w, (uintptr_t)*fields[i]);
+      }
+      written++;
+    }
+  }
+  return written;
+}
+
+// the whole dump, from a heap that does not change meanwhile
+static bool write_snapshot(snapshot_writer_t *w, heap_t *heap,
+                           root_buffer_t *roots) {
+  emit(w, SNAPSHOT_MAGIC);
+  emit(w, SNAPSHOT_VERSION);
+  emit(w, (uintptr_t)heap->heap_start);
+  emit(w, heap->heap_size);
+  size_t root_count = write_roots(w, roots);
+  size_t object_count = write_objects(w, heap);
+  emit(w, SNAPSHOT_END);
+  emit(w, object_count);
+  emit(w, root_count);
+  flush(w);
+  return !w->failed;
+}
+
+// true (non-NULL) if the writer process wrote the whole snapshot
+static void *wait_for_writer(void *arg) {
+  pid_t pid = *(pid_t *)arg;
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      return NULL;
+    }
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? arg : NULL;
+}
+
+__attribute__((noinline)) bool h_dump_snapshot(heap_t *heap, int fd) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  snapshot_writer_t *w = malloc(sizeof(snapshot_writer_t));
+  if (!w) {
+    return false;
+  }
+  w->fd = fd;
+  w->count = 0;
+  w->failed = false;
+
+  // pointers the caller keeps in registers are found by the scan
+  __builtin_unwind_init();
+  heap_lock(heap);
+  threads_stop_world(heap);
+  root_buffer_t *roots = find_gc_roots(heap);
+
+  // the child gets a copy-on-write image of the stopped heap and the stacks
+  // and writes it out while the world runs on, it only has this thread
+  pid_t pid = fork();
+  if (pid == 0) {
+    _exit(write_snapshot(w, heap, roots) ? 0 : 1);
+  }
+  bool ok = true;
+  if (pid < 0) {
+    // no process to write it, the world stays stopped for the whole dump
+    ok = write_snapshot(w, heap, roots);
+  }
+
+  stack_caches_refresh(heap);
+  threads_resume_world(heap);
+  heap_unlock(heap);
+
+  if (pid > 0) {
+    // collections in other threads do not wait for this one meanwhile
+    ok = h_do_blocking(heap, wait_for_writer, &pid) != NULL;
+  }
+  free(w);
+  return ok;
+}
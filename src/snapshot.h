@@ -0,0 +1,63 @@
+#pragma once
+
+#include "gc.h"
+#include "heap.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Heap snapshots
+ *
+ * `h_dump_snapshot` stops the world once to find the roots and forks. The
+ * child process has a copy-on-write image of the heap and the stacks as they
+ * were at that moment and streams the object graph to the file descriptor
+ * through a fixed buffer of `SNAPSHOT_CHUNK_WORDS` words, while the world of
+ * the parent runs on. The child only writes from that buffer and the stack,
+ * it does not allocate. The pause is a root scan and the fork (copying the
+ * page tables), not the writing, nothing is collected or moved, and the dump
+ * needs the same small amount of memory whatever the size of the heap, plus
+ * the pages the mutators change while it is written. The calling thread
+ * waits for the child as in `h_do_blocking`. If the process cannot fork the
+ * snapshot is written with the world stopped instead.
+ *
+ * The format is a sequence of 64 bit words in the byte order of the machine:
+ *
+ *     SNAPSHOT_MAGIC SNAPSHOT_VERSION heap_start heap_size
+ *     roots:   SNAPSHOT_ROOT slot value
+ *     objects: (pointers << 8 | SNAPSHOT_OBJECT) address header size
+ *              target...
+ *     SNAPSHOT_END objects roots
+ *
+ * All roots come before the objects and the objects are in address order.
+ * Every allocated object is written, also garbage that the next collection
+ * would free, the objects not reachable from the roots are the garbage.
+ * `address` points just after the header like the pointers the allocator
+ * returns, `size` includes header and padding, and every target is the value
+ * of a non-NULL pointer field (it can point into the middle of an object when
+ * interior pointers are on). `tools/snapshot_tool.c` reads the format and
+ * computes dominators and retained sizes.
+ */
+
+#define SNAPSHOT_MAGIC 0x0a31504e53434721ULL // "!GCSNP1\n"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_CHUNK_WORDS 8192 // 64 KiB written at a time
+
+/// Kind of a record, the low byte of its first word.
+typedef enum snapshot_record {
+  SNAPSHOT_END = 0,
+  SNAPSHOT_OBJECT = 1,
+  SNAPSHOT_ROOT = 2,
+} snapshot_record_t;
+
+/**
+ * @brief Writes the allocated objects and the roots of `heap` to `fd`.
+ *
+ * Does not collect, the objects stay where they are. Returns once the
+ * snapshot is written, the world only stops for the root scan and the fork
+ * of the writing process.
+ *
+ * @param heap A pointer to the heap.
+ * @param fd   An open file descriptor, written to from its current position.
+ * @return false if a write failed.
+ */
+bool h_dump_snapshot(heap_t *heap, int fd);
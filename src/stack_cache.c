@@ -0,0 +1,209 @@
+#include "stack_cache.h"
+#include "find_roots.h"
+#include "threads.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <unwind.h>
+
+// the barrier of the calling thread
+static __thread stack_barrier_t own_barrier = {0};
+
+// every arming gets its own serial, a cache is never valid for another
+// thread's barrier even if that thread runs on the same stack later
+static uint64_t barrier_serials = 0;
+
+#if defined(__x86_64__)
+// the code below, declared as bytes since it is only ever an address
+extern char stack_barrier_trampoline[] __attribute__((visibility("hidden")));
+
+// a frame returning through the barrier lands here with its return values
+// in rax/rdx and xmm0/xmm1, the stack pointer is 16-byte aligned. The rip
+// of the frame is undefined, unwinders stop here instead of misreading the
+// stack, and the nop makes the return address minus one fall inside it.
+__asm__(".pushsection .text\n"
+        ".globl stack_barrier_trampoline\n"
+        ".hidden stack_barrier_trampoline\n"
+        ".type stack_barrier_trampoline, @function\n"
+        ".cfi_startproc\n"
+        ".cfi_undefined rip\n"
+        "nop\n"
+        "stack_barrier_trampoline:\n"
+        "sub $48, %rsp\n"
+        "mov %rax, (%rsp)\n"
+        "mov %rdx, 8(%rsp)\n"
+        "movdqu %xmm0, 16(%rsp)\n"
+        "movdqu %xmm1, 32(%rsp)\n"
+        "call stack_barrier_hit\n"
+        "mov %rax, %r11\n"
+        "mov (%rsp), %rax\n"
+        "mov 8(%rsp), %rdx\n"
+        "movdqu 16(%rsp), %xmm0\n"
+        "movdqu 32(%rsp), %xmm1\n"
+        "add $48, %rsp\n"
+        "jmp *%r11\n"
+        ".cfi_endproc\n"
+        ".size stack_barrier_trampoline, .-stack_barrier_trampoline\n"
+        ".popsection\n");
+
+// called by the trampoline only, returns where the frame really returns to
+__attribute__((used, visibility("hidden"))) void *stack_barrier_hit(void) {
+  own_barrier.slot = NULL;
+  return own_barrier.return_address;
+}
+
+typedef struct barrier_search {
+  void **above;
+  void **slot;
+  void **watermark;
+} barrier_search_t;
+
+// picks the first frame that starts at or above `above`, and checks that the
+// word below its start is the return address into the next frame
+static _Unwind_Reason_Code find_barrier_frame(struct _Unwind_Context *ctx,
+                                              void *arg) {
+  barrier_search_t *search = arg;
+  void **cfa = (void **)_Unwind_GetCFA(ctx);
+  if (search->slot) {
+    if (*search->slot == (void *)_Unwind_GetIP(ctx)) {
+      search->watermark = cfa;
+      return _URC_NORMAL_STOP;
+    }
+    search->slot = NULL;
+  }
+  if (cfa >= search->above) {
+    search->slot = cfa - 1;
+  }
+  return _URC_NO_REASON;
+}
+#endif
+
+stack_barrier_t *stack_barrier_own(void) { return &own_barrier; }
+
+void stack_barrier_disarm(void) {
+#if defined(__x86_64__)
+  if (own_barrier.slot && *own_barrier.slot == stack_barrier_trampoline) {
+    *own_barrier.slot = own_barrier.return_address;
+  }
+#endif
+  own_barrier.slot = NULL;
+}
+
+void stack_barrier_arm(stack_cache_t *cache) {
+  // the walk has to see the real return addresses
+  stack_barrier_disarm();
+  cache->serial = 0;
+#if defined(__x86_64__)
+  barrier_search_t search = {
+      .above = cache->bottom - cache->words + STACK_BARRIER_DEPTH};
+  if (search.above >= cache->bottom) {
+    return;
+  }
+  _Unwind_Backtrace(find_barrier_frame, &search);
+  if (!search.watermark || search.watermark > cache->bottom) {
+    return;
+  }
+  own_barrier.serial =
+      __atomic_add_fetch(&barrier_serials, 1, __ATOMIC_RELAXED);
+  own_barrier.return_address = *search.slot;
+  own_barrier.watermark = search.watermark;
+  own_barrier.slot = search.slot;
+  *search.slot = stack_barrier_trampoline;
+  cache->serial = own_barrier.serial;
+#endif
+}
+
+void stack_cache_scan(heap_t *h, stack_cache_t *cache, void **top,
+                      void **bottom, root_buffer_t *res) {
+  cache->bottom = bottom;
+  cache->interior = h->interior_pointers;
+  cache->words = bottom - top;
+  cache->ref_count = 0;
+  cache->reused = 0;
+  cache->serial = 0;
+  cache->scanned = true;
+  scan_range(h, top, bottom, res, cache);
+}
+
+void stack_cache_scan_thread(heap_t *h, stack_cache_t *cache,
+                             stack_barrier_t *barrier, void **top,
+                             void **bottom, root_buffer_t *res) {
+  if (!h->stack_barriers) {
+    scan_range(h, top, bottom, res, NULL);
+    return;
+  }
+  void **slot = barrier->slot;
+  void **watermark = barrier->watermark;
+#if defined(__x86_64__)
+  bool armed = slot && barrier->serial == cache->serial && top < slot &&
+               slot < watermark && watermark <= bottom &&
+               *slot == stack_barrier_trampoline;
+#else
+  bool armed = false;
+#endif
+  if (!armed || cache->bottom != bottom ||
+      cache->interior != h->interior_pointers) {
+    stack_cache_scan(h, cache, top, bottom, res);
+    return;
+  }
+
+  // the words above the watermark are still the ones the last scan saw, only
+  // the recorded ones are looked up again
+  size_t above = bottom - watermark;
+  size_t kept = 0;
+  for (size_t i = 0; i < cache->ref_count; i++) {
+    if (cache->refs[i] < above) {
+      scan_word(h, bottom - 1 - cache->refs[i], res, NULL);
+      cache->refs[kept++] = cache->refs[i];
+    }
+  }
+  cache->ref_count = kept;
+  cache->words = bottom - top;
+  cache->reused = above;
+  cache->scanned = true;
+  scan_range(h, top, watermark, res, cache);
+}
+
+void stack_cache_reuse(heap_t *h, stack_cache_t *cache, root_buffer_t *res) {
+  for (size_t i = 0; i < cache->ref_count; i++) {
+    scan_word(h, cache->bottom - 1 - cache->refs[i], res, NULL);
+  }
+  cache->reused = cache->words;
+  cache->scanned = true;
+}
+
+void stack_cache_note(stack_cache_t *cache, void **slot) {
+  if (cache->ref_count == cache->ref_capacity) {
+    size_t capacity = cache->ref_capacity ? cache->ref_capacity * 2 : 64;
+    size_t *refs = realloc(cache->refs, capacity * sizeof(size_t));
+    if (!refs) {
+      assert(!"Could not grow the stack cache");
+    }
+    cache->refs = refs;
+    cache->ref_capacity = capacity;
+  }
+  cache->refs[cache->ref_count++] = cache->bottom - 1 - slot;
+}
+
+void stack_caches_refresh(heap_t *h) {
+  // the other threads arm their barriers when they continue
+  gc_thread_t *self = threads_current(h);
+  stack_cache_t *own = self ? &self->cache : &h->threads->collector_cache;
+  if (own->scanned && h->stack_barriers) {
+    stack_barrier_arm(own);
+  }
+  own->scanned = false;
+  for (size_t i = 0; i < h->threads->stack_count; i++) {
+    gc_stack_t *stack = h->threads->stacks[i];
+    if (stack->cache.scanned) {
+      // a stack that is running keeps changing
+      stack->dirty = stack->running;
+    }
+    stack->cache.scanned = false;
+    stack->running = false;
+  }
+}
+
+void stack_cache_destroy(stack_cache_t *cache) {
+  free(cache->refs);
+  *cache = (stack_cache_t){0};
+}
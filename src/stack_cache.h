@@ -0,0 +1,131 @@
+#pragma once
+
+#include "heap.h"
+
+/**
+ * Stack caches
+ *
+ * A registered stack that no thread ran on since the last collection still
+ * holds the same words. Every scan of a registered stack records the offsets
+ * of the words that pointed into the heap, and a later collection that finds
+ * the stack clean only looks those words up again (their objects may have
+ * died or moved since), the rest of the stack is not read at all.
+ *
+ * Stack barriers
+ *
+ * The stack of a thread that keeps running only changes below the deepest
+ * frame it returned to since the last collection. With
+ * `h_set_stack_barriers` on, every collection that scanned a thread's stack
+ * finds the first frame at least `STACK_BARRIER_DEPTH` words above the top it
+ * scanned from, and the thread replaces that frame's return address with a
+ * trampoline (the collector does it for its own stack, a stopped thread when
+ * it continues). The frame it returns to starts at the watermark.
+ *
+ * While the trampoline is in place, the words from the watermark to the
+ * bottom of the stack are the ones the last scan saw, so the next collection
+ * only scans the words above the watermark and looks up the recorded words
+ * below it again. Returning through the trampoline puts the return address
+ * back and disarms the barrier, and the next scan reads the whole stack.
+ * Comparing the stack with a copy from the last collection instead reads
+ * every word as well, and a deep recursion measured slower that way than the
+ * plain scan.
+ */
+
+/**
+ * @brief Minimum distance in words between the top of a scanned stack and
+ * its barrier, the part every scan reads before it gets to the watermark.
+ */
+#define STACK_BARRIER_DEPTH 512
+
+/**
+ * @brief Scans `[top, bottom)` of a stack for roots and records in `cache`
+ * where they were.
+ *
+ * @param h      Pointer to the heap.
+ * @param cache  The cache of the stack, a zeroed cache is empty.
+ * @param top    Lowest live address of the stack.
+ * @param bottom Base (highest address) of the stack.
+ * @param res    Buffer the roots are appended to.
+ */
+void stack_cache_scan(heap_t *h, stack_cache_t *cache, void **top,
+                      void **bottom, root_buffer_t *res);
+
+/**
+ * @brief Finds the roots of a stack that did not change since the last
+ * collection, only the recorded words are checked.
+ *
+ * @param h     Pointer to the heap.
+ * @param cache The cache of the stack, filled by an earlier scan.
+ * @param res   Buffer the roots are appended to.
+ */
+void stack_cache_reuse(heap_t *h, stack_cache_t *cache, root_buffer_t *res);
+
+/**
+ * @brief Scans `[top, bottom)` of a thread's stack for roots, the frames
+ * above its armed barrier are taken from `cache`.
+ *
+ * Falls back to `stack_cache_scan` when the barrier is not armed, was armed
+ * for a different scan, or the heap does not use stack barriers.
+ *
+ * @param h       Pointer to the heap.
+ * @param cache   The cache of the thread's stack.
+ * @param barrier The barrier of the thread.
+ * @param top     Lowest live address of the stack.
+ * @param bottom  Base (highest address) of the stack.
+ * @param res     Buffer the roots are appended to.
+ */
+void stack_cache_scan_thread(heap_t *h, stack_cache_t *cache,
+                             stack_barrier_t *barrier, void **top,
+                             void **bottom, root_buffer_t *res);
+
+/**
+ * @brief Records that the scan of `cache`'s stack found a word at `slot`
+ * that points into the heap.
+ *
+ * @param cache The cache of the stack being scanned.
+ * @param slot  The word, between the top and the bottom of the stack.
+ */
+void stack_cache_note(stack_cache_t *cache, void **slot);
+
+/**
+ * @brief Ends the scans of this collection.
+ *
+ * Has to run after the roots are updated and before the threads continue.
+ * Registered stacks that no thread runs on are marked clean, and the barrier
+ * of the calling thread is armed for its scanned stack.
+ *
+ * @param h Pointer to the heap.
+ */
+void stack_caches_refresh(heap_t *h);
+
+/**
+ * @brief Frees the offsets of a cache and leaves it empty.
+ *
+ * @param cache The cache.
+ */
+void stack_cache_destroy(stack_cache_t *cache);
+
+/**
+ * @brief The stack barrier of the calling thread.
+ *
+ * @return A record that lives as long as the thread.
+ */
+stack_barrier_t *stack_barrier_own(void);
+
+/**
+ * @brief Arms the barrier of the calling thread for the scan recorded in
+ * `cache`.
+ *
+ * The barrier is moved to the first frame that starts at least
+ * `STACK_BARRIER_DEPTH` words above the top of the scan, and `cache` is
+ * marked as valid for it. Without such a frame the barrier stays disarmed.
+ *
+ * @param cache The cache of the calling thread's stack, just scanned.
+ */
+void stack_barrier_arm(stack_cache_t *cache);
+
+/**
+ * @brief Puts back the return address the barrier of the calling thread
+ * replaced.
+ */
+void stack_barrier_disarm(void);
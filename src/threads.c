@@ -0,0 +1,289 @@
+#include "threads.h"
+#include "alloc_buffer.h"
+#include "find_roots.h"
+#include "stack_cache.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// the records of the calling thread, one per heap it is attached to
+static __thread gc_thread_t *own_records = NULL;
+
+// noinline so that the canonical frame address is the stack pointer of the
+// caller, which is below everything the caller has spilled
+__attribute__((noinline)) static void *caller_stack_pointer(void) {
+  return __builtin_dwarf_cfa();
+}
+
+static bool is_stop_requested(heap_t *h) {
+  return __atomic_load_n(&h->threads->stop_requested, __ATOMIC_ACQUIRE);
+}
+
+void threads_init(heap_t *h) {
+  h->threads = calloc(1, sizeof(gc_threads_state_t));
+  if (!h->threads) {
+    assert(!"Could not allocate the thread state");
+  }
+  pthread_mutex_init(&h->threads->lock, NULL);
+  pthread_cond_init(&h->threads->all_stopped, NULL);
+  pthread_cond_init(&h->threads->resumed, NULL);
+}
+
+// removes a record from the list of the calling thread
+static void unlink_own_record(gc_thread_t *record) {
+  gc_thread_t **link = &own_records;
+  while (*link && *link != record) {
+    link = &(*link)->next_of_thread;
+  }
+  if (*link) {
+    *link = record->next_of_thread;
+  }
+}
+
+void threads_destroy(heap_t *h) {
+  // a heap deleted by an attached thread, other threads must have detached
+  unlink_own_record(threads_current(h));
+  for (size_t i = 0; i < h->threads->count; i++) {
+    free(h->threads->list[i]->shadow_stack.slots);
+    stack_cache_destroy(&h->threads->list[i]->cache);
+    free(h->threads->list[i]);
+  }
+  free(h->threads->list);
+  stack_cache_destroy(&h->threads->collector_cache);
+  for (size_t i = 0; i < h->threads->stack_count; i++) {
+    stack_cache_destroy(&h->threads->stacks[i]->cache);
+    free(h->threads->stacks[i]);
+  }
+  free(h->threads->stacks);
+  pthread_cond_destroy(&h->threads->resumed);
+  pthread_cond_destroy(&h->threads->all_stopped);
+  pthread_mutex_destroy(&h->threads->lock);
+  free(h->threads);
+  h->threads = NULL;
+}
+
+gc_thread_t *threads_current(heap_t *h) {
+  for (gc_thread_t *t = own_records; t; t = t->next_of_thread) {
+    if (t->heap == h) {
+      return t;
+    }
+  }
+  return NULL;
+}
+
+// waits with the lock held until no collection stops the world, the caller
+// has already recorded where its stack ends
+static void wait_while_stopped(heap_t *h, gc_thread_t *self) {
+  while (is_stop_requested(h)) {
+    if (self) {
+      self->stopped = true;
+      pthread_cond_broadcast(&h->threads->all_stopped);
+    }
+    pthread_cond_wait(&h->threads->resumed, &h->threads->lock);
+  }
+  if (self) {
+    self->stopped = false;
+    // the collector scanned the stack while we waited
+    if (self->cache.scanned && h->stack_barriers) {
+      stack_barrier_arm(&self->cache);
+    }
+    self->cache.scanned = false;
+  }
+}
+
+__attribute__((noinline)) void heap_lock(heap_t *h) {
+  // the collector may scan and update this frame while we wait, the
+  // registers of the caller are restored from it when we return
+  __builtin_unwind_init();
+  gc_thread_t *self = threads_current(h);
+  if (self) {
+    self->stack_top = caller_stack_pointer();
+  }
+  pthread_mutex_lock(&h->threads->lock);
+  wait_while_stopped(h, self);
+  // whatever runs under the lock sees the objects of the inline fast path
+  alloc_buffer_retire(h);
+}
+
+void heap_unlock(heap_t *h) { pthread_mutex_unlock(&h->threads->lock); }
+
+static bool others_stopped(heap_t *h, gc_thread_t *self) {
+  for (size_t i = 0; i < h->threads->count; i++) {
+    gc_thread_t *t = h->threads->list[i];
+    if (t != self && !t->stopped) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void threads_stop_world(heap_t *h) {
+  gc_thread_t *self = threads_current(h);
+  __atomic_store_n(&h->threads->stop_requested, true, __ATOMIC_RELEASE);
+  // waiting releases the lock so the others can get to their safepoints
+  while (!others_stopped(h, self)) {
+    pthread_cond_wait(&h->threads->all_stopped, &h->threads->lock);
+  }
+}
+
+void threads_resume_world(heap_t *h) {
+  __atomic_store_n(&h->threads->stop_requested, false, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&h->threads->resumed);
+}
+
+void h_thread_attach(heap_t *heap) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  if (threads_current(heap)) {
+    assert(!"Thread is already attached to the heap");
+  }
+  gc_thread_t *self = calloc(1, sizeof(gc_thread_t));
+  if (!self) {
+    assert(!"Could not allocate a thread record");
+  }
+  self->id = pthread_self();
+  self->heap = heap;
+  self->stack_bottom = get_stack_bottom();
+  self->barrier = stack_barrier_own();
+
+  heap_lock(heap);
+  gc_threads_state_t *threads = heap->threads;
+  if (threads->count == threads->capacity) {
+    size_t capacity = threads->capacity ? threads->capacity * 2 : 8;
+    gc_thread_t **grown =
+        realloc(threads->list, capacity * sizeof(gc_thread_t *));
+    if (!grown) {
+      assert(!"Could not grow the thread list");
+    }
+    threads->list = grown;
+    threads->capacity = capacity;
+  }
+  threads->list[threads->count++] = self;
+  heap_unlock(heap);
+
+  self->next_of_thread = own_records;
+  own_records = self;
+}
+
+void h_thread_detach(heap_t *heap) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  gc_thread_t *self = threads_current(heap);
+  if (!self) {
+    assert(!"Thread is not attached to the heap");
+  }
+
+  heap_lock(heap);
+  gc_threads_state_t *threads = heap->threads;
+  for (size_t i = 0; i < threads->count; i++) {
+    if (threads->list[i] == self) {
+      threads->list[i] = threads->list[--threads->count];
+      break;
+    }
+  }
+  heap_unlock(heap);
+
+  unlink_own_record(self);
+  // nothing scans this stack for the heap any more, the thread may exit
+  // without returning through the barrier
+  stack_barrier_disarm();
+  free(self->shadow_stack.slots);
+  stack_cache_destroy(&self->cache);
+  free(self);
+}
+
+void h_safepoint(heap_t *heap) {
+  if (is_stop_requested(heap)) {
+    heap_lock(heap);
+    heap_unlock(heap);
+  }
+}
+
+gc_stack_t *threads_stack_containing(heap_t *h, void *addr) {
+  for (size_t i = 0; i < h->threads->stack_count; i++) {
+    gc_stack_t *stack = h->threads->stacks[i];
+    if ((uint8_t *)addr >= (uint8_t *)stack->lo &&
+        (uint8_t *)addr < (uint8_t *)stack->hi) {
+      return stack;
+    }
+  }
+  return NULL;
+}
+
+gc_stack_t *h_register_stack(heap_t *heap, void *lo, void *hi,
+                             gc_stack_pointer_function *sp_getter) {
+  if (!heap || (uint8_t *)lo >= (uint8_t *)hi) {
+    assert(!"invalid heap or stack");
+  }
+  gc_stack_t *stack = calloc(1, sizeof(gc_stack_t));
+  if (!stack) {
+    assert(!"Could not allocate a stack record");
+  }
+  // only whole words are scanned
+  stack->lo = (void *)(((uintptr_t)lo + sizeof(void *) - 1) &
+                       ~(uintptr_t)(sizeof(void *) - 1));
+  stack->hi = (void *)((uintptr_t)hi & ~(uintptr_t)(sizeof(void *) - 1));
+  stack->sp_getter = sp_getter;
+  stack->dirty = true;
+
+  heap_lock(heap);
+  gc_threads_state_t *threads = heap->threads;
+  if (threads->stack_count == threads->stack_capacity) {
+    size_t capacity =
+        threads->stack_capacity ? threads->stack_capacity * 2 : 16;
+    gc_stack_t **grown =
+        realloc(threads->stacks, capacity * sizeof(gc_stack_t *));
+    if (!grown) {
+      assert(!"Could not grow the stack list");
+    }
+    threads->stacks = grown;
+    threads->stack_capacity = capacity;
+  }
+  stack->index = threads->stack_count;
+  threads->stacks[threads->stack_count++] = stack;
+  heap_unlock(heap);
+  return stack;
+}
+
+void h_unregister_stack(heap_t *heap, gc_stack_t *stack) {
+  if (!heap || !stack) {
+    assert(!"invalid heap or stack");
+  }
+  heap_lock(heap);
+  gc_threads_state_t *threads = heap->threads;
+  gc_stack_t *last = threads->stacks[--threads->stack_count];
+  threads->stacks[stack->index] = last;
+  last->index = stack->index;
+  heap_unlock(heap);
+
+  stack_cache_destroy(&stack->cache);
+  free(stack);
+}
+
+void h_stack_set_dirty(gc_stack_t *stack, bool dirty) { stack->dirty = dirty; }
+
+__attribute__((noinline)) void *
+h_do_blocking(heap_t *heap, void *(*fn)(void *), void *arg) {
+  __builtin_unwind_init();
+  gc_thread_t *self = threads_current(heap);
+  if (!self) {
+    return fn(arg);
+  }
+
+  pthread_mutex_lock(&heap->threads->lock);
+  self->stack_top = caller_stack_pointer();
+  self->stopped = true;
+  pthread_cond_broadcast(&heap->threads->all_stopped);
+  pthread_mutex_unlock(&heap->threads->lock);
+
+  void *result = fn(arg);
+
+  // the stack may have been updated meanwhile, wait for a running collection
+  // before anything is read from it again
+  pthread_mutex_lock(&heap->threads->lock);
+  wait_while_stopped(heap, self);
+  pthread_mutex_unlock(&heap->threads->lock);
+  return result;
+}
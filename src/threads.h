@@ -0,0 +1,200 @@
+#pragma once
+
+#include "gc.h"
+#include "heap.h"
+#include <stdbool.h>
+
+/**
+ * Mutator threads
+ *
+ * A heap can be shared by several threads once each of them has called
+ * `h_thread_attach`. Allocation and collection are serialised by the heap
+ * lock, and a collection stops the world: the collecting thread raises
+ * `stop_requested` and waits until every other attached thread is stopped
+ * before it scans for roots, so objects can be moved under all of them.
+ *
+ * A thread stops when it
+ *  - allocates or collects (it waits for the heap lock),
+ *  - calls `h_safepoint`, which mutator loops that run for a long time
+ * without allocating must do regularly, or
+ *  - runs a blocking function with `h_do_blocking`, it then counts as stopped
+ * the whole time.
+ *
+ * Every stopped thread has its callee-saved registers spilled to its own
+ * stack and the stack is scanned from `stack_top` to `stack_bottom`, roots in
+ * those registers are restored with their new values when it continues.
+ *
+ * Threads that are not attached are never waited for or scanned. The thread
+ * that collects is always scanned, attached or not, so a single threaded
+ * program does not have to attach at all. In `ROOT_MODE_PRECISE` every
+ * attached thread pushes and pops its roots on a shadow stack of its own,
+ * threads that are not attached share the one of the heap.
+ *
+ * Coroutines or fibers that run on their own stacks register them with
+ * `h_register_stack`. A thread whose stack pointer lies in a registered stack
+ * runs on it, its stack is then scanned up to the top of that stack instead of
+ * the base of the thread's own stack. The native stack of such a thread is
+ * suspended below the point where it switched away, so a thread that
+ * collects (or is stopped) while it runs on a registered stack must have its
+ * native stack registered as well, with an `sp_getter` that returns the
+ * stack pointer saved at the switch. Every suspended registered stack is
+ * scanned from its saved stack pointer, unless it is clean: a stack that did
+ * not run since the last collection only has its known references checked
+ * again.
+ */
+
+/**
+ * @brief Sets up the lock and the (empty) thread list of a new heap.
+ *
+ * @param h Pointer to the heap.
+ */
+void threads_init(heap_t *h);
+
+/**
+ * @brief Frees the thread records of a heap and destroys its lock.
+ *
+ * @param h Pointer to the heap, every thread but the calling one must have
+ * detached.
+ */
+void threads_destroy(heap_t *h);
+
+/**
+ * @brief The record of the calling thread on `h`.
+ *
+ * @param h Pointer to the heap.
+ * @return The record, or NULL if the thread is not attached to `h`.
+ */
+gc_thread_t *threads_current(heap_t *h);
+
+/**
+ * @brief Takes the heap lock on behalf of a mutator.
+ *
+ * If a collection is waiting for or running with the world stopped, the
+ * calling thread stops until it is done. The registers of the caller are
+ * spilled before waiting so that its stack is complete. An open allocation
+ * buffer is retired once the lock is held, see `alloc_buffer.h`.
+ *
+ * @param h Pointer to the heap.
+ */
+void heap_lock(heap_t *h);
+
+/**
+ * @brief Releases the heap lock taken with `heap_lock`.
+ *
+ * @param h Pointer to the heap.
+ */
+void heap_unlock(heap_t *h);
+
+/**
+ * @brief Stops every other attached thread, called with the heap lock held.
+ *
+ * @param h Pointer to the heap.
+ */
+void threads_stop_world(heap_t *h);
+
+/**
+ * @brief Lets the threads stopped by `threads_stop_world` continue.
+ *
+ * @param h Pointer to the heap.
+ */
+void threads_resume_world(heap_t *h);
+
+/**
+ * @brief Registers the calling thread as a mutator of `heap`.
+ *
+ * Has to be called before the thread keeps pointers into a heap that other
+ * threads collect, and balanced with `h_thread_detach` before it exits.
+ *
+ * @param heap A pointer to the heap.
+ */
+void h_thread_attach(heap_t *heap);
+
+/**
+ * @brief Unregisters the calling thread, its stack is not scanned any more.
+ *
+ * Roots it still has on its shadow stack are dropped, and its stack barrier
+ * is disarmed.
+ *
+ * @param heap A pointer to the heap.
+ */
+void h_thread_detach(heap_t *heap);
+
+/**
+ * @brief Stops the calling thread if a collection is waiting for it.
+ *
+ * Cheap when no collection is pending, a single load.
+ *
+ * @param heap A pointer to the heap.
+ */
+void h_safepoint(heap_t *heap);
+
+/**
+ * @brief Finds the registered stack that holds `addr`.
+ *
+ * @param h    Pointer to the heap.
+ * @param addr Any address.
+ * @return The stack, or NULL if `addr` is not in a registered stack.
+ */
+gc_stack_t *threads_stack_containing(heap_t *h, void *addr);
+
+/**
+ * @brief Registers a stack that mutator code runs on besides the native
+ * stacks of the threads, e.g. an mmap'd coroutine stack.
+ *
+ * A thread that switches to registered stacks also registers its native
+ * stack, with `hi` the base of the thread's stack (the end of the mapping
+ * `pthread_getattr_np` reports), otherwise the frames it left there would not
+ * be scanned while it runs elsewhere. A collection on a registered stack
+ * asserts that the native one is registered.
+ *
+ * While the stack is suspended the words from `sp_getter(lo)` up to `hi` are
+ * scanned conservatively, the registers of the suspended code must be saved
+ * on the stack (or in a registered root range). A new stack is dirty. Only
+ * used in `ROOT_MODE_CONSERVATIVE`.
+ *
+ * @param heap      A pointer to the heap.
+ * @param lo        Lowest address of the stack.
+ * @param hi        One past its highest address, where it starts to grow.
+ * @param sp_getter Returns the saved stack pointer, or NULL to always scan
+ * all of `[lo, hi)`.
+ * @return A handle for `h_stack_set_dirty` and `h_unregister_stack`.
+ */
+gc_stack_t *h_register_stack(heap_t *heap, void *lo, void *hi,
+                             gc_stack_pointer_function *sp_getter);
+
+/**
+ * @brief Unregisters a stack, it is not scanned any more.
+ *
+ * Has to be called before the memory of the stack is unmapped.
+ *
+ * @param heap  A pointer to the heap.
+ * @param stack The handle from `h_register_stack`.
+ */
+void h_unregister_stack(heap_t *heap, gc_stack_t *stack);
+
+/**
+ * @brief Tells the collector whether a suspended stack changed.
+ *
+ * A runtime marks a stack dirty when it switches to it, every collection
+ * marks the stacks that are suspended clean. The references on a clean stack
+ * are still updated when their objects move, but the stack is not scanned.
+ * Cheap enough to call on every switch.
+ *
+ * @param stack The handle from `h_register_stack`.
+ * @param dirty false if the stack did not change since the last collection.
+ */
+void h_stack_set_dirty(gc_stack_t *stack, bool dirty);
+
+/**
+ * @brief Runs `fn(arg)` with the calling thread counted as stopped.
+ *
+ * For calls that can block for a long time (I/O, locks, joins). Collections
+ * in other threads do not wait for the calling thread meanwhile, so `fn`
+ * must not touch the heap or any object in it.
+ *
+ * @param heap A pointer to the heap.
+ * @param fn   The blocking function.
+ * @param arg  Argument to `fn`.
+ * @return What `fn` returned.
+ */
+void *h_do_blocking(heap_t *heap, void *(*fn)(void *), void *arg);
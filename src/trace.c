@@ -0,0 +1,200 @@
+#include "trace.h"
+#include "compacting.h"
+#include "threads.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void put_varint(FILE *file, uint64_t value) {
+  while (value >= 0x80) {
+    putc((int)(value & 0x7f) | 0x80, file);
+    value >>= 7;
+  }
+  putc((int)value, file);
+}
+
+static uint64_t hash_address(void *obj) {
+  uint64_t x = (uintptr_t)obj >> 4;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  return x ^ (x >> 33);
+}
+
+// the table is kept at most half full
+static void rebuild_table(trace_recorder_t *t) {
+  size_t size = t->table_size ? t->table_size : 64;
+  while (size < t->object_count * 2 + 2) {
+    size *= 2;
+  }
+  if (size != t->table_size) {
+    free(t->table);
+    t->table = malloc(size * sizeof(size_t));
+    if (!t->table) {
+      assert(!"Could not grow the trace table");
+    }
+    t->table_size = size;
+  }
+  memset(t->table, 0, size * sizeof(size_t));
+  for (size_t i = 0; i < t->object_count; i++) {
+    size_t slot = hash_address(t->objects[i].obj) & (size - 1);
+    while (t->table[slot]) {
+      slot = (slot + 1) & (size - 1);
+    }
+    t->table[slot] = i + 1;
+  }
+}
+
+// the number of the traced object at `obj`, 0 if it is not one
+static uint64_t id_of(trace_recorder_t *t, void *obj) {
+  size_t slot = hash_address(obj) & (t->table_size - 1);
+  while (t->table[slot]) {
+    trace_object_t *object = &t->objects[t->table[slot] - 1];
+    if (object->obj == obj) {
+      return object->id;
+    }
+    slot = (slot + 1) & (t->table_size - 1);
+  }
+  return 0;
+}
+
+void trace_alloc(heap_t *h, void *obj, const char *layout, size_t bytes) {
+  trace_recorder_t *t = h->trace;
+  if (layout) {
+    size_t length = strlen(layout);
+    putc(TRACE_ALLOC_STRUCT, t->file);
+    put_varint(t->file, length);
+    fwrite(layout, 1, length, t->file);
+  } else {
+    putc(TRACE_ALLOC_RAW, t->file);
+    put_varint(t->file, bytes);
+  }
+
+  if (t->object_count == t->object_capacity) {
+    size_t capacity = t->object_capacity ? t->object_capacity * 2 : 256;
+    trace_object_t *objects =
+        realloc(t->objects, capacity * sizeof(trace_object_t));
+    if (!objects) {
+      assert(!"Could not grow the traced objects");
+    }
+    t->objects = objects;
+    t->object_capacity = capacity;
+  }
+  t->objects[t->object_count++] = (trace_object_t){obj, t->next_id++};
+  if (t->object_count * 2 + 2 > t->table_size) {
+    rebuild_table(t);
+    return;
+  }
+  size_t slot = hash_address(obj) & (t->table_size - 1);
+  while (t->table[slot]) {
+    slot = (slot + 1) & (t->table_size - 1);
+  }
+  t->table[slot] = t->object_count;
+}
+
+void trace_note_gc(heap_t *h) {
+  if (h->trace) {
+    putc(TRACE_GC, h->trace->file);
+  }
+}
+
+void trace_update(heap_t *h, alloc_profile_where_function *where,
+                  void *extra) {
+  trace_recorder_t *t = h->trace;
+  if (!t) {
+    return;
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < t->object_count; i++) {
+    trace_object_t object = t->objects[i];
+    object.obj = where(h, object.obj, extra);
+    if (!object.obj) {
+      putc(TRACE_DEATH, t->file);
+      put_varint(t->file, object.id);
+      continue;
+    }
+    t->objects[kept++] = object;
+  }
+  t->object_count = kept;
+  rebuild_table(t);
+}
+
+static bool close_trace(heap_t *h) {
+  trace_recorder_t *t = h->trace;
+  putc(TRACE_END, t->file);
+  bool ok = !ferror(t->file);
+  ok &= fclose(t->file) == 0;
+  free(t->objects);
+  free(t->table);
+  free(t);
+  h->trace = NULL;
+  return ok;
+}
+
+void trace_destroy(heap_t *h) {
+  if (h->trace) {
+    close_trace(h);
+  }
+}
+
+bool h_trace_start(heap_t *heap, const char *path) {
+  if (!heap || !path) {
+    assert(!"invalid heap or path");
+  }
+  heap_lock(heap);
+  FILE *file = heap->trace ? NULL : fopen(path, "wb");
+  if (!file) {
+    heap_unlock(heap);
+    return false;
+  }
+  trace_recorder_t *t = calloc(1, sizeof(trace_recorder_t));
+  if (!t) {
+    assert(!"Could not allocate the trace recorder");
+  }
+  t->file = file;
+  t->next_id = 1;
+  rebuild_table(t);
+  fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, file);
+  put_varint(file, heap->heap_size);
+  heap->trace = t;
+  heap_unlock(heap);
+  return true;
+}
+
+bool h_trace_stop(heap_t *heap) {
+  if (!heap) {
+    assert(!"invalid heap");
+  }
+  heap_lock(heap);
+  bool ok = heap->trace && close_trace(heap);
+  heap_unlock(heap);
+  return ok;
+}
+
+void h_trace_store(heap_t *heap, void *obj, void **slot, void *value) {
+  if (!heap->trace) {
+    *slot = value;
+    return;
+  }
+  // a collection may move obj and value while we wait for the lock, pushed
+  // they are updated on this frame in the precise root mode too. The slot is
+  // found again from its offset
+  size_t offset = (uint8_t *)slot - (uint8_t *)obj;
+  h_push_root(heap, &obj);
+  h_push_root(heap, &value);
+  heap_lock(heap);
+  h_pop_roots(heap, 2);
+  slot = (void **)((uint8_t *)obj + offset);
+  *slot = value;
+  trace_recorder_t *t = heap->trace;
+  uint64_t id = t ? id_of(t, obj) : 0;
+  if (id) {
+    void *base = value ? object_base(heap, value) : NULL;
+    uint64_t value_id = base ? id_of(t, base) : 0;
+    putc(TRACE_STORE, t->file);
+    put_varint(t->file, id);
+    put_varint(t->file, offset);
+    put_varint(t->file, value_id);
+    put_varint(t->file, value_id ? (uint8_t *)value - (uint8_t *)base : 0);
+  }
+  heap_unlock(heap);
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "alloc_profile.h"
+#include "gc.h"
+#include "heap.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Allocation traces
+ *
+ * `h_trace_start(h, path)` records how the object graph of a program evolves,
+ * so that it can be replayed offline against any collector configuration
+ * with `bench/trace_replay.c`. The trace starts with `TRACE_MAGIC` and the
+ * size the heap was created with as a varint, then one record per event, a
+ * tag byte followed by unsigned LEB128 varints:
+ *  - `TRACE_ALLOC_STRUCT`: length and bytes of the layout string,
+ *  - `TRACE_ALLOC_RAW`: the size,
+ *  - `TRACE_STORE`: object, byte offset of the field, stored object (0 for
+ * NULL or anything that is not a traced object) and the offset into it,
+ *  - `TRACE_DEATH`: an object that a collection found dead,
+ *  - `TRACE_GC`: an explicit `h_gc`, after the deaths it found,
+ *  - `TRACE_END`: written by `h_trace_stop`.
+ *
+ * Objects are numbered from 1 in the order they were allocated. Only stores
+ * made through `H_STORE` are seen, and objects allocated before the trace
+ * started are not known to it, so it should be started right after `h_init`.
+ *
+ * Roots are not recorded. The replay keeps every object alive until its
+ * death record, which comes from the first collection that found it
+ * unreachable, so an object lives at most until the next collection of the
+ * recorded run longer than it did there. The recorder follows its objects
+ * through every collection the same way the allocation profiler follows its
+ * samples.
+ */
+
+#define TRACE_MAGIC "GCTRACE1"
+#define TRACE_MAGIC_SIZE 8
+
+typedef enum trace_record {
+  TRACE_END,
+  TRACE_ALLOC_STRUCT,
+  TRACE_ALLOC_RAW,
+  TRACE_STORE,
+  TRACE_DEATH,
+  TRACE_GC,
+} trace_record_t;
+
+/**
+ * @brief Records an allocation, called with the heap lock held.
+ *
+ * @param h      Pointer to the heap.
+ * @param obj    The new object (pointer just after its header).
+ * @param layout Its layout string, NULL for `h_alloc_raw`.
+ * @param bytes  The size asked for with `h_alloc_raw`.
+ */
+void trace_alloc(heap_t *h, void *obj, const char *layout, size_t bytes);
+
+/**
+ * @brief Records an allocation if a trace is being recorded.
+ *
+ * @param h      Pointer to the heap.
+ * @param obj    The new object (pointer just after its header).
+ * @param layout Its layout string, NULL for `h_alloc_raw`.
+ * @param bytes  The size asked for with `h_alloc_raw`.
+ */
+static inline void trace_note_alloc(heap_t *h, void *obj, const char *layout,
+                                    size_t bytes) {
+  if (h->trace) {
+    trace_alloc(h, obj, layout, bytes);
+  }
+}
+
+/**
+ * @brief Records an explicit collection, after it is done.
+ *
+ * @param h Pointer to the heap.
+ */
+void trace_note_gc(heap_t *h);
+
+/**
+ * @brief Follows the traced objects through a collection.
+ *
+ * Called by the collectors next to `alloc_profile_update`, a death record is
+ * written for every object that is gone. Does nothing when no trace is being
+ * recorded.
+ *
+ * @param h     Pointer to the heap.
+ * @param where Gives the new address (or NULL) of a traced object.
+ * @param extra Passed to `where`.
+ */
+void trace_update(heap_t *h, alloc_profile_where_function *where, void *extra);
+
+/**
+ * @brief Stops recording and frees the recorder of a heap.
+ *
+ * @param h Pointer to the heap.
+ */
+void trace_destroy(heap_t *h);
+
+/**
+ * @brief Starts recording a trace of `heap` to a file.
+ *
+ * @param heap A pointer to the heap.
+ * @param path File to (over)write.
+ * @return false if a trace is already being recorded or the file could not
+ * be opened.
+ */
+bool h_trace_start(heap_t *heap, const char *path);
+
+/**
+ * @brief Ends the trace and closes its file.
+ *
+ * @param heap A pointer to the heap.
+ * @return false if no trace was being recorded or it could not be written.
+ */
+bool h_trace_stop(heap_t *heap);
+
+/**
+ * @brief Stores `value` at `slot` in `obj`, and records it when tracing.
+ *
+ * Use it through `H_STORE`. Without a trace it is a plain store.
+ *
+ * @param heap  A pointer to the heap.
+ * @param obj   The object that is written to.
+ * @param slot  A pointer field of `obj`.
+ * @param value The pointer to store.
+ */
+void h_trace_store(heap_t *heap, void *obj, void **slot, void *value);
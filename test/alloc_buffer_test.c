@@ -0,0 +1,84 @@
+#include "../src/alloc_buffer.h"
+#include "../src/allocation.h"
+#include "../src/gc.h"
+#include "../src/gc_inline.h"
+#include "../src/heap.h"
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+struct inline_node {
+  struct inline_node *next;
+  int value;
+};
+
+void test_inline_allocation(void) {
+  heap_t *heap = h_init(20480, false, 0.9);
+  gc_layout_t layout = h_layout("*i");
+  uint64_t *reference = h_alloc_struct(heap, "*i");
+  CU_ASSERT_EQUAL(layout.header, reference[-1]);
+  CU_ASSERT_EQUAL(layout.size, 32);
+
+  // the first one refills the buffer, the others are bumped behind it
+  struct inline_node *volatile nodes[4];
+  for (int i = 0; i < 4; i++) {
+    nodes[i] = h_alloc_struct_inline(heap, layout);
+    CU_ASSERT_PTR_NULL(nodes[i]->next);
+    CU_ASSERT_EQUAL(nodes[i]->value, 0);
+  }
+  CU_ASSERT_PTR_NOT_NULL(heap->alloc_buffer.limit);
+  for (int i = 1; i < 4; i++) {
+    CU_ASSERT_EQUAL((uint8_t *)nodes[i] - (uint8_t *)nodes[i - 1], 32);
+  }
+  uint8_t *volatile raw = h_alloc_raw_inline(heap, 40);
+  CU_ASSERT_PTR_EQUAL(raw, (uint8_t *)nodes[3] + 32);
+  CU_ASSERT_EQUAL(((uint64_t *)raw)[-1], (40 << 3) | 0x3);
+  memset(raw, 0xab, 40);
+
+  // published by the next call that takes the lock
+  CU_ASSERT_EQUAL(h_used(heap), 32 + 4 * 32 + 48);
+  CU_ASSERT_PTR_NULL(heap->alloc_buffer.limit);
+  int slot =
+      (raw - HEADER_SIZE - (uint8_t *)heap->heap_start) / MIN_OBJECT_SIZE;
+  CU_ASSERT_TRUE(get_bit_in_alloc_map(heap->start_map, slot));
+  gc_stats_t stats;
+  h_stats(heap, &stats);
+  CU_ASSERT_EQUAL(stats.objects_allocated, 6);
+  CU_ASSERT_EQUAL(stats.bytes_allocated, 32 + 4 * 32 + 48);
+
+  // they are ordinary objects to the collector
+  nodes[0]->next = nodes[1];
+  nodes[1]->value = 7;
+  h_gc(heap);
+  CU_ASSERT_PTR_EQUAL(nodes[0]->next, nodes[1]);
+  CU_ASSERT_EQUAL(nodes[1]->value, 7);
+  CU_ASSERT_EQUAL(raw[39], 0xab);
+
+  // every allocation takes the slow path while a thread is attached
+  h_thread_attach(heap);
+  CU_ASSERT_PTR_NOT_NULL(h_alloc_struct_inline(heap, layout));
+  CU_ASSERT_PTR_NULL(heap->alloc_buffer.limit);
+  h_thread_detach(heap);
+  h_delete(heap);
+}
+
+int alloc_buffer_tests() {
+  CU_pSuite pSuite = CU_add_suite("alloc_buffer_tests", NULL, NULL);
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ((NULL == CU_add_test(pSuite, "test inline allocation fast path",
+                           test_inline_allocation)) ||
+      false) {
+
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
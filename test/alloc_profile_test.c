@@ -0,0 +1,134 @@
+#include "../src/alloc_profile.h"
+#include "../src/gc.h"
+#include "../src/heap.h"
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+struct profiled_node {
+  void *next;
+  int value;
+};
+
+// the two call sites of the profile test
+__attribute__((noinline)) static struct profiled_node *
+allocate_kept(heap_t *heap) {
+  struct profiled_node *head = NULL;
+  for (int i = 0; i < 3; i++) {
+    struct profiled_node *node = h_alloc_struct(heap, "*i");
+    node->next = head;
+    head = node;
+  }
+  return head;
+}
+
+__attribute__((noinline)) static void allocate_garbage(heap_t *heap) {
+  for (int i = 0; i < 5; i++) {
+    h_alloc_raw(heap, 40);
+  }
+}
+
+static bool first_line_starts_with(const char *path, const char *prefix) {
+  char line[256] = {0};
+  FILE *in = fopen(path, "r");
+  if (!in) {
+    return false;
+  }
+  bool found = fgets(line, sizeof(line), in) &&
+               strncmp(line, prefix, strlen(prefix)) == 0;
+  fclose(in);
+  return found;
+}
+
+__attribute__((noinline)) static void profile_in_mode(gc_mode_t mode) {
+  heap_t *heap = h_init(20480, false, 0.9);
+  h_set_gc_mode(heap, mode);
+  // a point every byte or so, every object is sampled
+  h_set_alloc_sampling(heap, 1);
+  struct profiled_node *volatile kept = allocate_kept(heap);
+  allocate_garbage(heap);
+
+  alloc_profile_t *profile = heap->profile;
+  CU_ASSERT_EQUAL(profile->sample_count, 8);
+  CU_ASSERT_TRUE(profile->site_count >= 2);
+  CU_ASSERT_EQUAL(profile->samples[2].obj, kept);
+
+  h_gc(heap);
+  // the samples followed their objects, all of them are sampled so the
+  // retained bytes are what is still allocated
+  size_t retained = 0;
+  for (size_t i = 0; i < profile->site_count; i++) {
+    retained += profile->sites[i].live_sample_bytes;
+  }
+  CU_ASSERT_EQUAL(retained, h_used(heap));
+  alloc_site_t *kept_site = NULL;
+  for (size_t i = 0; i < profile->sample_count; i++) {
+    if (profile->samples[i].obj == kept) {
+      kept_site = &profile->sites[profile->samples[i].site];
+    }
+  }
+  CU_ASSERT_PTR_NOT_NULL(kept_site);
+  if (kept_site) {
+    CU_ASSERT_EQUAL(kept_site->samples, 3);
+    CU_ASSERT_EQUAL(kept_site->live_samples, 3);
+    CU_ASSERT_EQUAL(kept_site->live_sample_bytes, 3 * 32);
+  }
+
+  const char *path = "alloc_profile_test.txt";
+  CU_ASSERT_TRUE(h_dump_alloc_profile(heap, path, true));
+  CU_ASSERT_TRUE(first_line_starts_with(path, "heap profile: "));
+  CU_ASSERT_TRUE(h_dump_alloc_profile(heap, path, false));
+  CU_ASSERT_TRUE(first_line_starts_with(path, "allocation profile"));
+  remove(path);
+
+  h_set_alloc_sampling(heap, 0);
+  CU_ASSERT_PTR_NULL(heap->profile);
+  CU_ASSERT_FALSE(h_dump_alloc_profile(heap, path, false));
+  h_delete(heap);
+}
+
+void test_alloc_profile(void) {
+  gc_mode_t modes[] = {GC_MODE_COPYING, GC_MODE_SLIDING, GC_MODE_MARK_REGION};
+  for (int m = 0; m < 3; m++) {
+    profile_in_mode(modes[m]);
+  }
+}
+
+void test_alloc_sampling_rate(void) {
+  heap_t *heap = h_init(204800, false, 0.9);
+  h_set_alloc_sampling(heap, 1024);
+  // 3200 objects of 32 bytes, about 100 points
+  for (int i = 0; i < 3200; i++) {
+    h_alloc_struct(heap, "*i");
+  }
+  size_t points = 0;
+  for (size_t i = 0; i < heap->profile->site_count; i++) {
+    points += heap->profile->sites[i].points;
+  }
+  CU_ASSERT_TRUE(points >= 60 && points <= 140);
+  h_delete(heap);
+}
+
+int alloc_profile_tests() {
+  CU_pSuite pSuite = CU_add_suite("alloc_profile_tests", NULL, NULL);
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ((NULL == CU_add_test(pSuite, "test sampling allocation profile",
+                           test_alloc_profile)) ||
+      (NULL == CU_add_test(pSuite, "test allocation sampling rate",
+                           test_alloc_sampling_rate)) ||
+      false) {
+
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
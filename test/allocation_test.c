@@ -95,7 +95,7 @@ void test_layout_size_to_big(void) {
 
 //////Finding next available space in heap//////
 void test_find_first_in_empty_heap() {
-  heap_t *heap = h_init((size_t)2500, false, 0.8);
+  heap_t *heap = h_init((size_t)2600, false, 0.8);
   long test_long = 2e10;
 
   int index = find_next_available(heap, sizeof(test_long));
@@ -107,7 +107,7 @@ void test_find_first_in_empty_heap() {
 }
 
 void test_find_first_in_non_empty_heap() {
-  heap_t *heap = h_init((size_t)2500, false, 0.8);
+  heap_t *heap = h_init((size_t)2600, false, 0.8);
   long test_long = 2e10;
   // long *alloc1 =
   h_alloc_raw(heap, sizeof(test_long)); // NOTE: Variabel används ej
@@ -203,7 +203,8 @@ void test_allocating_remainingsize_changed(void) {
 }
 
 void test_allocating_100_obj(void) {
-  heap_t *heap = h_init((size_t)5200, false, 0.8);
+  // 4 pages, so that the copy reserve allows a second active page
+  heap_t *heap = h_init((size_t)10400, false, 0.8);
 
   // allocate first page
   for (int i = 0; i < 64; i++) {
@@ -283,6 +284,33 @@ void test_covering_more_complex(void) {
   h_delete(heap);
 }
 
+void test_copy_reserve(void) {
+  CU_ASSERT_TRUE(copy_reserve_allows(1, 1));
+  CU_ASSERT_TRUE(copy_reserve_allows(2, 1));
+  CU_ASSERT_FALSE(copy_reserve_allows(2, 2));
+  CU_ASSERT_TRUE(copy_reserve_allows(5, 2));
+  CU_ASSERT_FALSE(copy_reserve_allows(5, 3));
+
+  // 2 pages, the second one is the reserve
+  heap_t *heap = h_init((size_t)5200, false, 0.9);
+  h_alloc_raw(heap, 2040);
+  CU_ASSERT_EQUAL(find_next_available(heap, 32), -1);
+  CU_ASSERT_FALSE(heap->page_array[1]->is_active);
+
+  // without a reserve the second page can be used
+  h_set_gc_mode(heap, GC_MODE_SLIDING);
+  CU_ASSERT_EQUAL(find_next_available(heap, 32), 1);
+  h_delete(heap);
+}
+
+void test_alloc_returns_null_when_full(void) {
+  heap_t *heap = h_init((size_t)2600, false, 0.9);
+  // bigger than a page
+  CU_ASSERT_PTR_NULL(h_alloc_raw(heap, 3000));
+  CU_ASSERT_EQUAL(h_used(heap), 0);
+  h_delete(heap);
+}
+
 int allocation_tests() {
   CU_pSuite pSuite = CU_add_suite("allocation_tests", NULL, NULL);
   if (NULL == pSuite) {
@@ -326,6 +354,9 @@ int allocation_tests() {
        CU_add_test(pSuite,
                    "test a more complex testing, more like a simple program",
                    test_covering_more_complex)) ||
+      (NULL == CU_add_test(pSuite, "test copy reserve", test_copy_reserve)) ||
+      (NULL == CU_add_test(pSuite, "test allocation failing with NULL",
+                           test_alloc_returns_null_when_full)) ||
 
       false) {
 
@@ -0,0 +1,87 @@
+#include "../src/census.h"
+#include "../src/gc.h"
+#include "../src/heap.h"
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stddef.h>
+
+// leaves no pointer to the object in a register of the caller
+__attribute__((noinline)) static void alloc_garbage(heap_t *heap) {
+  h_alloc_raw(heap, 200);
+}
+
+// overwrites the dead frames of the allocation below the caller
+__attribute__((noinline)) static void scrub_stack(void) {
+  void *volatile area[256];
+  for (size_t i = 0; i < 256; i++) {
+    area[i] = NULL;
+  }
+  (void)area;
+}
+
+void test_census(void) {
+  heap_t *heap = h_init(20480, false, 0.9);
+  void *volatile kept[6];
+  for (int i = 0; i < 3; i++) {
+    kept[i] = h_alloc_struct(heap, "*i");
+  }
+  kept[3] = h_alloc_raw(heap, 100);
+  kept[4] = h_alloc_struct(heap, "***");
+  kept[5] = h_alloc_struct(heap, "***");
+  alloc_garbage(heap);
+  scrub_stack();
+  void *first = kept[0];
+
+  // the garbage is still allocated but not counted, nothing is collected
+  gc_census_t census;
+  h_census(heap, &census);
+  CU_ASSERT_EQUAL(census.objects, 6);
+  CU_ASSERT_EQUAL(census.bytes + 208, h_used(heap));
+  CU_ASSERT_EQUAL(census.entry_count, 3);
+  CU_ASSERT_EQUAL(heap->gc_policy.info.collections, 0);
+  CU_ASSERT_PTR_EQUAL(kept[0], first);
+
+  // biggest total first
+  char text[16];
+  CU_ASSERT_EQUAL(census.entries[0].objects, 1);
+  CU_ASSERT_EQUAL(census.entries[0].bytes, 112);
+  h_census_describe(census.entries[0].header, text, sizeof(text));
+  CU_ASSERT_STRING_EQUAL(text, "raw 100");
+  CU_ASSERT_EQUAL(census.entries[1].objects, 3);
+  CU_ASSERT_EQUAL(census.entries[1].bytes, 96);
+  h_census_describe(census.entries[1].header, text, sizeof(text));
+  CU_ASSERT_STRING_EQUAL(text, "*i");
+  CU_ASSERT_EQUAL(census.entries[2].objects, 2);
+  h_census_describe(census.entries[2].header, text, sizeof(text));
+  CU_ASSERT_STRING_EQUAL(text, "***");
+  CU_ASSERT_EQUAL(h_census_describe(census.entries[2].header, text, 2), 3);
+  CU_ASSERT_STRING_EQUAL(text, "*");
+
+  // five objects of 32 bytes, one of 112
+  CU_ASSERT_EQUAL(census.bucket_objects[1], 5);
+  CU_ASSERT_EQUAL(census.bucket_bytes[1], 160);
+  CU_ASSERT_EQUAL(census.bucket_objects[3], 1);
+  CU_ASSERT_EQUAL(census.bucket_bytes[3], 112);
+  CU_ASSERT_PTR_NOT_NULL(kept[0]);
+  h_census_free(&census);
+  CU_ASSERT_PTR_NULL(census.entries);
+  h_delete(heap);
+}
+
+int census_tests() {
+  CU_pSuite pSuite = CU_add_suite("census_tests", NULL, NULL);
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ((NULL == CU_add_test(pSuite, "test heap census", test_census)) ||
+      false) {
+
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
@@ -54,21 +54,12 @@ void test_traverse_move_and_forward(void) {
   CU_ASSERT_TRUE(page1->is_active);
   CU_ASSERT_FALSE(page2->is_active);
   CU_ASSERT_EQUAL(page1->remaining_size, 2048 - (3 * 32));
-  ioopm_list_t *artificial_root_list =
-      ioopm_linked_list_create(ioopm_ptr_cmp_func);
-  ioopm_linked_list_append(artificial_root_list, (elem_t){.ptr = &obj1});
-  ioopm_linked_list_append(artificial_root_list, (elem_t){.ptr = &obj2});
-
-  ioopm_list_t *expected1 = ioopm_linked_list_create(ioopm_ptr_cmp_func);
-  ioopm_linked_list_append(expected1, (elem_t){.ptr = obj1});
-  ioopm_linked_list_append(expected1, (elem_t){.ptr = obj2});
-
-  ioopm_list_t *expected2 = ioopm_linked_list_create(ioopm_ptr_cmp_func);
-  ioopm_linked_list_append(expected2, (elem_t){.ptr = obj1});
-  ioopm_linked_list_append(expected2, (elem_t){.ptr = obj2});
+  root_buffer_t artificial_roots = {0};
+  root_buffer_append(&artificial_roots, (void **)&obj1);
+  root_buffer_append(&artificial_roots, (void **)&obj2);
 
   // traverse and move, see so everything updates as it should
-  traverse_and_move(heap, artificial_root_list, expected1);
+  traverse_and_move(heap, &artificial_roots);
   // test allocation map
   first_in_map_array = heap->alloc_map[0];
   uint64_t third_in_map_array = heap->alloc_map[2];
@@ -93,7 +84,7 @@ void test_traverse_move_and_forward(void) {
   CU_ASSERT_EQUAL((uint64_t *)obj1->ptr1, (uint64_t *)page1->page_start + 9);
   // start+obj1+obj2+header
 
-  traverse_and_forward(heap, artificial_root_list, expected2);
+  traverse_and_forward(heap, &artificial_roots);
   //  obj ptr should be updated
   CU_ASSERT_NOT_EQUAL((uint64_t *)obj1, (uint64_t *)page1->page_start + 1);
   CU_ASSERT_NOT_EQUAL((uint64_t *)obj2, (uint64_t *)page1->page_start + 5);
@@ -105,18 +96,18 @@ void test_traverse_move_and_forward(void) {
   CU_ASSERT_EQUAL((uint64_t *)obj2, (uint64_t *)page2->page_start + 5);
   CU_ASSERT_EQUAL((uint64_t *)obj1->ptr1, (uint64_t *)page2->page_start + 9);
 
-  ioopm_linked_list_destroy(artificial_root_list);
-  ioopm_linked_list_destroy(expected1);
-  ioopm_linked_list_destroy(expected2);
+  root_buffer_destroy(&artificial_roots);
   h_delete(heap);
 }
 
 void test_GC_same_case_as_test_traverse_and_forward(void) {
   heap_t *heap = h_init(10400, false, 0.5);
 
-  struct ptr_ptr_int *obj1 = h_alloc_struct(heap, "**i");
-  struct ptr_ptr_int *obj2 = h_alloc_struct(heap, "**i");
-  struct ptr_ptr_int *obj3 = h_alloc_struct(heap, "**i");
+  // volatile so that an optimised build keeps them in this frame, where the
+  // collector updates them, and drops them when they are set to NULL
+  struct ptr_ptr_int *volatile obj1 = h_alloc_struct(heap, "**i");
+  struct ptr_ptr_int *volatile obj2 = h_alloc_struct(heap, "**i");
+  struct ptr_ptr_int *volatile obj3 = h_alloc_struct(heap, "**i");
   obj1->ptr1 = obj3;
 
   obj3 = NULL;
@@ -173,6 +164,106 @@ void test_GC_same_case_as_test_traverse_and_forward(void) {
   h_delete(heap);
 }
 
+void test_traverse_move_depth_first(void) {
+  heap_t *heap = h_init(10400, false, 0.5);
+  h_set_copy_order(heap, COPY_ORDER_DFS);
+
+  // a -> (b, c), b -> d, allocated in breadth first order
+  struct ptr_ptr_int *a = h_alloc_struct(heap, "**i");
+  struct ptr_ptr_int *b = h_alloc_struct(heap, "**i");
+  struct ptr_ptr_int *c = h_alloc_struct(heap, "**i");
+  struct ptr_ptr_int *d = h_alloc_struct(heap, "**i");
+  a->ptr1 = b;
+  a->ptr2 = c;
+  b->ptr1 = d;
+  c->int1 = 3;
+  d->int1 = 4;
+
+  root_buffer_t artificial_roots = {0};
+  root_buffer_append(&artificial_roots, (void **)&a);
+
+  traverse_and_move(heap, &artificial_roots);
+  traverse_and_forward(heap, &artificial_roots);
+
+  // d is copied right after its parent b, before b's sibling c
+  page_t *page2 = heap->page_array[1];
+  CU_ASSERT_EQUAL((uint64_t *)a, (uint64_t *)page2->page_start + 1);
+  CU_ASSERT_EQUAL((uint64_t *)a->ptr1, (uint64_t *)page2->page_start + 5);
+  b = a->ptr1;
+  CU_ASSERT_EQUAL((uint64_t *)b->ptr1, (uint64_t *)page2->page_start + 9);
+  CU_ASSERT_EQUAL((uint64_t *)a->ptr2, (uint64_t *)page2->page_start + 13);
+  CU_ASSERT_EQUAL(((struct ptr_ptr_int *)b->ptr1)->int1, 4);
+  CU_ASSERT_EQUAL(((struct ptr_ptr_int *)a->ptr2)->int1, 3);
+
+  root_buffer_destroy(&artificial_roots);
+  h_delete(heap);
+}
+
+void test_traverse_move_raw_object(void) {
+  heap_t *heap = h_init(5200, false, 0.8);
+  uint8_t *raw = h_alloc_raw(heap, 100);
+  for (int i = 0; i < 100; i++) {
+    raw[i] = (uint8_t)i;
+  }
+
+  root_buffer_t artificial_roots = {0};
+  root_buffer_append(&artificial_roots, (void **)&raw);
+
+  CU_ASSERT_TRUE(traverse_and_move(heap, &artificial_roots));
+  traverse_and_forward(heap, &artificial_roots);
+
+  // the whole payload is copied, not only the header
+  page_t *page2 = heap->page_array[1];
+  CU_ASSERT_EQUAL(raw, (uint8_t *)page2->page_start + 8);
+  CU_ASSERT_EQUAL(page2->remaining_size, 2048 - 112);
+  bool same = true;
+  for (int i = 0; i < 100; i++) {
+    same = same && raw[i] == (uint8_t)i;
+  }
+  CU_ASSERT_TRUE(same);
+
+  root_buffer_destroy(&artificial_roots);
+  h_delete(heap);
+}
+
+void test_traverse_move_undone_when_out_of_space(void) {
+  // 4 pages, two full active pages of one 1040 and one 1008 byte object each
+  heap_t *heap = h_init(8200, false, 0.9);
+  void *a1 = h_alloc_raw(heap, 1032);
+  void *b1 = h_alloc_raw(heap, 1000);
+  void *a2 = h_alloc_raw(heap, 1032);
+  void *b2 = h_alloc_raw(heap, 1000);
+  CU_ASSERT_TRUE(heap->page_array[1]->is_active);
+  uint64_t alloc_map_before[8];
+  memcpy(alloc_map_before, heap->alloc_map, sizeof(alloc_map_before));
+
+  // both small objects first, they share a passive page and the two big ones
+  // no longer fit in the one that is left
+  root_buffer_t artificial_roots = {0};
+  root_buffer_append(&artificial_roots, (void **)&b1);
+  root_buffer_append(&artificial_roots, (void **)&b2);
+  root_buffer_append(&artificial_roots, (void **)&a1);
+  root_buffer_append(&artificial_roots, (void **)&a2);
+
+  CU_ASSERT_FALSE(traverse_and_move(heap, &artificial_roots));
+
+  // nothing moved
+  CU_ASSERT_FALSE(header_is_forwarding_address(b1));
+  CU_ASSERT_FALSE(header_is_forwarding_address(b2));
+  CU_ASSERT_EQUAL(*((uint64_t *)b1 - 1), (1000ULL << 3) | 0x3);
+  CU_ASSERT_EQUAL(*((uint64_t *)a2 - 1), (1032ULL << 3) | 0x3);
+  CU_ASSERT_EQUAL(memcmp(alloc_map_before, heap->alloc_map,
+                         sizeof(alloc_map_before)),
+                  0);
+  CU_ASSERT_FALSE(heap->page_array[2]->is_active);
+  CU_ASSERT_FALSE(heap->page_array[3]->is_active);
+  CU_ASSERT_EQUAL(heap->page_array[2]->remaining_size, 2048);
+  CU_ASSERT_EQUAL(h_used(heap), 4096);
+
+  root_buffer_destroy(&artificial_roots);
+  h_delete(heap);
+}
+
 // TODO: skriva tester för en vanlig GC efter att jag gjort find_roots
 
 int compacting_tests() {
@@ -190,6 +281,12 @@ int compacting_tests() {
        CU_add_test(pSuite,
                    "same test as traverse move and forward but with gc ",
                    test_GC_same_case_as_test_traverse_and_forward)) ||
+      (NULL == CU_add_test(pSuite, "test depth first copy order",
+                           test_traverse_move_depth_first)) ||
+      (NULL == CU_add_test(pSuite, "test moving a raw object",
+                           test_traverse_move_raw_object)) ||
+      (NULL == CU_add_test(pSuite, "test undoing a move without space",
+                           test_traverse_move_undone_when_out_of_space)) ||
       false) {
 
     CU_cleanup_registry();
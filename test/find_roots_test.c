@@ -1,9 +1,13 @@
 #include "../src/compacting.h"
 #include "../src/gc.h"
 #include "../src/heap.h"
+#include "../src/stack_cache.h"
+#include "../src/threads.h"
 
 #include <CUnit/Basic.h>
 #include <CUnit/CUnit.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -11,15 +15,489 @@
 
 void ex_find_root_test(void) { CU_ASSERT_TRUE(true); }
 
+// find_gc_roots scans from the frame of its caller, the registers the test
+// keeps its pointers in are spilled here first the way gc_collect does
+__attribute__((noinline)) static root_buffer_t *
+find_spilled_roots(heap_t *heap) {
+  __builtin_unwind_init();
+  root_buffer_t *roots = find_gc_roots(heap);
+  asm volatile("" ::: "memory");
+  return roots;
+}
+
 void test_find_single_root(void) {
   heap_t *heap = h_init(10400, false, 0.5);
   void *obj1 = h_alloc_struct(heap, "*");
-  result *res_find_roots = find_gc_roots(heap);
-  CU_ASSERT_EQUAL(ioopm_linked_list_size(res_find_roots->roots), 1);
+  root_buffer_t *roots = find_spilled_roots(heap);
+  CU_ASSERT_EQUAL(roots->size, 1);
+  CU_ASSERT_PTR_EQUAL(*roots->slots[0], obj1);
+  CU_ASSERT_PTR_EQUAL(roots->values[0], obj1);
+  CU_ASSERT_PTR_EQUAL(roots, &heap->roots);
+  h_delete(heap);
+}
+
+struct node_fr {
+  void *next;
+  int value;
+};
+
+void test_precise_roots(void) {
+  heap_t *heap = h_init(10400, false, 0.9);
+  h_set_root_mode(heap, ROOT_MODE_PRECISE);
+  struct node_fr *kept = h_alloc_struct(heap, "*i");
+  struct node_fr *dropped = h_alloc_struct(heap, "*i");
+  struct node_fr *empty = NULL;
+  kept->value = 1;
+  kept->next = h_alloc_struct(heap, "*i");
+  ((struct node_fr *)kept->next)->value = 2;
+  h_push_root(heap, &kept);
+  h_push_root(heap, &empty);
+  CU_ASSERT_EQUAL(h_root_depth(heap), 2);
+
+  // dropped is on the stack but not registered, empty is NULL
+  root_buffer_t *roots = find_gc_roots(heap);
+  CU_ASSERT_EQUAL(roots->size, 1);
+  CU_ASSERT_PTR_EQUAL(roots->slots[0], &kept);
+
+  void *old = kept;
+  CU_ASSERT_EQUAL(h_gc(heap), 32);
+  CU_ASSERT_NOT_EQUAL(kept, old);
+  CU_ASSERT_EQUAL(kept->value, 1);
+  CU_ASSERT_EQUAL(((struct node_fr *)kept->next)->value, 2);
+  CU_ASSERT_EQUAL(h_used(heap), 64);
+  (void)dropped;
+
+  h_pop_roots(heap, 2);
+  CU_ASSERT_EQUAL(h_root_depth(heap), 0);
+  CU_ASSERT_EQUAL(h_gc(heap), 64);
+  h_delete(heap);
+}
+
+void test_membership_filter(void) {
+  heap_t *heap = h_init(10400, false, 0.9);
+  h_alloc_raw(heap, 100);
+  uint8_t *obj = h_alloc_struct(heap, "**i");
+
+  CU_ASSERT_TRUE(is_allocated_on_heap(heap, obj));
+  CU_ASSERT_TRUE(is_object_start(heap, obj));
+  // header, inside the object, after it and outside the heap
+  CU_ASSERT_FALSE(is_allocated_on_heap(heap, obj - 8));
+  CU_ASSERT_FALSE(is_allocated_on_heap(heap, obj + 8));
+  CU_ASSERT_FALSE(is_allocated_on_heap(heap, obj + 16));
+  CU_ASSERT_FALSE(is_allocated_on_heap(heap, obj + 32));
+  CU_ASSERT_FALSE(is_allocated_on_heap(heap, NULL));
+  CU_ASSERT_FALSE(is_allocated_on_heap(heap, heap->alloc_map));
+  CU_ASSERT_FALSE(is_allocated_on_heap(heap, heap->page_array));
+
+  // more than one vector of candidates, only the exact object pointers count
+  void *words[11] = {obj + 16, obj,    NULL,    obj - 8, heap,   obj,
+                     obj + 1,  obj + 8, obj,     words,   obj - 16};
+  root_buffer_t *roots = find_gc_roots(heap);
+  size_t found = 0;
+  for (size_t i = 0; i < roots->size; i++) {
+    void **slot = roots->slots[i];
+    if (slot >= words && slot < words + 11) {
+      CU_ASSERT_PTR_EQUAL(*slot, obj);
+      found++;
+    }
+  }
+  CU_ASSERT_EQUAL(found, 3);
+  h_delete(heap);
+}
+
+void test_start_map_after_gc(void) {
+  gc_mode_t modes[] = {GC_MODE_COPYING, GC_MODE_SLIDING, GC_MODE_MARK_REGION};
+  for (int m = 0; m < 3; m++) {
+    heap_t *heap = h_init(10400, false, 0.9);
+    h_set_gc_mode(heap, modes[m]);
+    h_set_root_mode(heap, ROOT_MODE_PRECISE);
+    struct node_fr *dead = h_alloc_struct(heap, "*i");
+    struct node_fr *kept = h_alloc_struct(heap, "*i");
+    h_push_root(heap, &kept);
+    void *old = kept;
+    (void)dead;
+
+    h_gc(heap);
+    CU_ASSERT_TRUE(is_object_start(heap, kept));
+    if (kept != old) {
+      CU_ASSERT_FALSE(is_object_start(heap, old));
+    }
+    // only one object is left
+    size_t starts = 0;
+    for (size_t i = 0; i < heap->page_amount * 2; i++) {
+      starts += __builtin_popcountll(heap->start_map[i]);
+    }
+    CU_ASSERT_EQUAL(starts, 1);
+    h_delete(heap);
+  }
+}
+
+static void push_in_scope(heap_t *heap, void **slot) {
+  H_ROOT_SCOPE(heap);
+  h_push_root(heap, slot);
+  h_push_root(heap, slot + 1);
+  CU_ASSERT_EQUAL(h_root_depth(heap), 3);
+}
+
+void test_root_scope(void) {
+  heap_t *heap = h_init(10400, false, 0.9);
+  void *outer = NULL;
+  void *inner[2] = {NULL, NULL};
+  h_push_root(heap, &outer);
+  push_in_scope(heap, inner);
+  // the roots pushed inside the scope are gone
+  CU_ASSERT_EQUAL(h_root_depth(heap), 1);
+  CU_ASSERT_PTR_EQUAL(heap->shadow_stack.slots[0], &outer);
+  h_delete(heap);
+}
+
+void test_root_buffer_reused(void) {
+  heap_t *heap = h_init(10400, false, 0.9);
+  h_set_root_mode(heap, ROOT_MODE_PRECISE);
+  void *objs[100];
+  for (int i = 0; i < 100; i++) {
+    objs[i] = h_alloc_raw(heap, 16);
+    h_push_root(heap, &objs[i]);
+  }
+
+  h_gc(heap);
+  CU_ASSERT_EQUAL(heap->roots.size, 100);
+  void ***slots = heap->roots.slots;
+  size_t capacity = heap->roots.capacity;
+  CU_ASSERT_TRUE(capacity >= 100);
+
+  // fewer roots, the buffer is emptied but keeps its memory
+  h_pop_roots(heap, 50);
+  h_gc(heap);
+  CU_ASSERT_EQUAL(heap->roots.size, 50);
+  CU_ASSERT_PTR_EQUAL(heap->roots.slots, slots);
+  CU_ASSERT_EQUAL(heap->roots.capacity, capacity);
+  CU_ASSERT_PTR_EQUAL(heap->roots.slots[49], &objs[49]);
+  h_delete(heap);
+}
+
+struct cache_entry {
+  int key;
+  void *value;
+};
+
+static struct node_fr *global_root = NULL;
+static struct cache_entry cache[64];
+
+void test_root_range(void) {
+  heap_t *heap = h_init(10400, false, 0.9);
+  h_set_root_mode(heap, ROOT_MODE_PRECISE);
+  // a malloc'd structure outside the heap, byte 0 is not pointer aligned
+  uint8_t *outside = calloc(1, 4 * sizeof(void *));
+  struct node_fr **slots = (struct node_fr **)(outside + sizeof(void *));
+  slots[0] = h_alloc_struct(heap, "*i");
+  slots[0]->value = 5;
+  slots[2] = h_alloc_struct(heap, "*i");
+  slots[2]->value = 6;
+  uintptr_t old = (uintptr_t)slots[0] + 1;
+  h_add_root_range(heap, outside + 1, outside + 4 * sizeof(void *));
+  CU_ASSERT_EQUAL(heap->root_range_count, 1);
+  CU_ASSERT_PTR_EQUAL(heap->root_ranges[0].start, slots);
+
+  CU_ASSERT_EQUAL(h_gc(heap), 0);
+  CU_ASSERT_NOT_EQUAL((uintptr_t)slots[0] + 1, old);
+  CU_ASSERT_EQUAL(slots[0]->value, 5);
+  CU_ASSERT_EQUAL(slots[2]->value, 6);
+
+  CU_ASSERT_TRUE(h_remove_root_range(heap, outside + 1));
+  CU_ASSERT_FALSE(h_remove_root_range(heap, outside + 1));
+  CU_ASSERT_EQUAL(h_gc(heap), 64);
+  free(outside);
+  h_delete(heap);
+}
+
+void test_root_table(void) {
+  heap_t *heap = h_init(10400, false, 0.9);
+  h_set_root_mode(heap, ROOT_MODE_PRECISE);
+  for (int i = 0; i < 64; i++) {
+    cache[i].key = i;
+    cache[i].value = i % 2 ? h_alloc_raw(heap, 8) : NULL;
+  }
+  // every key is an int the collector must not read
+  cache[2].key = (int)(uintptr_t)cache[1].value;
+  h_add_root_table(heap, &cache[0].value, 64, sizeof(struct cache_entry));
+
+  root_buffer_t *roots = find_gc_roots(heap);
+  CU_ASSERT_EQUAL(roots->size, 32);
+  CU_ASSERT_EQUAL(h_gc(heap), 0);
+  CU_ASSERT_EQUAL(h_used(heap), 32 * 16);
+  for (int i = 0; i < 64; i++) {
+    CU_ASSERT_EQUAL(cache[i].value != NULL, i % 2);
+  }
+
+  cache[1].value = NULL;
+  CU_ASSERT_EQUAL(h_gc(heap), 16);
+  CU_ASSERT_TRUE(h_remove_root_range(heap, &cache[0].value));
+  CU_ASSERT_EQUAL(h_gc(heap), 31 * 16);
+  // the next heap may get the same address, the table must not point into it
+  memset(cache, 0, sizeof(cache));
+  h_delete(heap);
+}
+
+void test_data_segments(void) {
+  heap_t *heap = h_init(10400, false, 0.9);
+  h_set_root_mode(heap, ROOT_MODE_PRECISE);
+  global_root = h_alloc_struct(heap, "*i");
+  global_root->value = 9;
+  global_root->next = h_alloc_struct(heap, "*i");
+  uintptr_t old = (uintptr_t)global_root + 1;
+
+  CU_ASSERT_TRUE(h_add_data_segments(heap) > 0);
+  CU_ASSERT_EQUAL(h_gc(heap), 0);
+  CU_ASSERT_NOT_EQUAL((uintptr_t)global_root + 1, old);
+  CU_ASSERT_EQUAL(global_root->value, 9);
+  CU_ASSERT_TRUE(is_object_start(heap, global_root->next));
+
+  global_root = NULL;
+  CU_ASSERT_EQUAL(h_gc(heap), 64);
+  h_delete(heap);
+}
+
+void test_overlapping_root_ranges(void) {
+  gc_mode_t modes[] = {GC_MODE_COPYING, GC_MODE_SLIDING, GC_MODE_MARK_REGION};
+  for (int m = 0; m < 3; m++) {
+    heap_t *heap = h_init(10400, false, 0.9);
+    h_set_gc_mode(heap, modes[m]);
+    h_set_root_mode(heap, ROOT_MODE_PRECISE);
+    h_alloc_raw(heap, 8);
+    global_root = h_alloc_struct(heap, "*i");
+    global_root->value = 11;
+    // the global is registered on its own and again with its data segment
+    h_add_root_range(heap, &global_root, &global_root + 1);
+    h_add_root_range(heap, &global_root, &global_root + 1);
+    CU_ASSERT_TRUE(h_add_data_segments(heap) > 0);
+
+    root_buffer_t *roots = find_gc_roots(heap);
+    size_t found = 0;
+    for (size_t i = 0; i < roots->size; i++) {
+      found += roots->slots[i] == (void **)&global_root;
+    }
+    CU_ASSERT_EQUAL(found, 1);
+
+    CU_ASSERT_EQUAL(h_gc(heap), 16);
+    CU_ASSERT_EQUAL(global_root->value, 11);
+    CU_ASSERT_TRUE(is_object_start(heap, global_root));
+    global_root = NULL;
+    h_delete(heap);
+  }
+}
+
+void test_object_base(void) {
+  heap_t *heap = h_init(10400, false, 0.9);
+  uint8_t *buf = h_alloc_raw(heap, 100);
+  uint8_t *next = h_alloc_raw(heap, 16);
+  // only object starts without interior pointers
+  CU_ASSERT_PTR_EQUAL(object_base(heap, buf), buf);
+  CU_ASSERT_PTR_NULL(object_base(heap, buf + 37));
+
+  h_set_interior_pointers(heap, true);
+  CU_ASSERT_PTR_EQUAL(object_base(heap, buf + 37), buf);
+  CU_ASSERT_PTR_EQUAL(object_base(heap, buf + 99), buf);
+  CU_ASSERT_PTR_EQUAL(object_base(heap, next + 3), next);
+  // the header is not part of the object
+  CU_ASSERT_PTR_NULL(object_base(heap, next - 4));
+  CU_ASSERT_PTR_NULL(object_base(heap, buf - 8));
+  // nothing allocated after the last object
+  CU_ASSERT_PTR_NULL(object_base(heap, next + 40));
+  h_delete(heap);
+}
+
+struct slices_fr {
+  void *first;
+  void *second;
+};
+
+void test_interior_pointers(void) {
+  gc_mode_t modes[] = {GC_MODE_COPYING, GC_MODE_SLIDING, GC_MODE_MARK_REGION};
+  for (int m = 0; m < 3; m++) {
+    heap_t *heap = h_init(10400, false, 0.9);
+    h_set_gc_mode(heap, modes[m]);
+    h_set_root_mode(heap, ROOT_MODE_PRECISE);
+    h_set_interior_pointers(heap, true);
+    h_alloc_struct(heap, "*i"); // garbage in front, sliding moves the buffer
+    uint8_t *buf = h_alloc_raw(heap, 100);
+    for (int i = 0; i < 100; i++) {
+      buf[i] = i;
+    }
+    struct slices_fr *holder = h_alloc_struct(heap, "**");
+    holder->first = buf + 50;
+    holder->second = h_alloc_raw(heap, 40);
+    memset(holder->second, 7, 40);
+    holder->second = (uint8_t *)holder->second + 39;
+    // only the slice keeps the buffer alive
+    uint8_t *slice = buf + 37;
+    uintptr_t old = (uintptr_t)slice;
+    h_push_root(heap, &slice);
+    h_push_root(heap, &holder);
+
+    CU_ASSERT_EQUAL(h_gc(heap), 32);
+    if (modes[m] != GC_MODE_MARK_REGION) {
+      CU_ASSERT_NOT_EQUAL((uintptr_t)slice, old);
+    }
+    CU_ASSERT_EQUAL(slice[0], 37);
+    CU_ASSERT_EQUAL(slice[62], 99);
+    CU_ASSERT_PTR_EQUAL(holder->first, slice + 13);
+    CU_ASSERT_EQUAL(*(uint8_t *)holder->first, 50);
+    CU_ASSERT_EQUAL(*(uint8_t *)holder->second, 7);
+    CU_ASSERT_PTR_EQUAL(object_base(heap, slice), slice - 37);
+    CU_ASSERT_PTR_EQUAL(object_base(heap, holder->second),
+                        (uint8_t *)holder->second - 39);
+
+    // without references the buffers are collected
+    h_pop_roots(heap, 2);
+    h_push_root(heap, &holder);
+    holder->first = NULL;
+    holder->second = NULL;
+    CU_ASSERT_EQUAL(h_gc(heap), 112 + 48);
+    h_delete(heap);
+  }
+}
+
+void test_blacklist(void) {
+  for (int interior = 0; interior < 2; interior++) {
+    heap_t *heap = h_init(10400, false, 0.9);
+    h_set_root_mode(heap, ROOT_MODE_PRECISE);
+    h_set_interior_pointers(heap, interior);
+    // integers that happen to be where the first objects of every page would
+    // go, scanned conservatively as a root range
+    uintptr_t noise[5 * 4];
+    for (size_t p = 0; p < heap->page_amount; p++) {
+      for (int k = 0; k < 4; k++) {
+        noise[p * 4 + k] = (uintptr_t)heap->page_array[p]->page_start +
+                           HEADER_SIZE + 32 * k + (interior ? 12 : 0);
+      }
+    }
+    h_add_root_range(heap, noise, noise + 5 * 4);
+    CU_ASSERT_EQUAL(h_blacklisted(heap), 0);
+    CU_ASSERT_EQUAL(h_gc(heap), 0);
+    CU_ASSERT_EQUAL(h_blacklisted(heap), 5 * 4 * 16);
+
+    for (int i = 0; i < 10; i++) {
+      CU_ASSERT_PTR_NOT_NULL(h_alloc_struct(heap, "*i"));
+    }
+    for (int j = 0; j < 5 * 4; j++) {
+      CU_ASSERT_PTR_NULL(object_base(heap, (void *)noise[j]));
+    }
+    // nothing is retained by the noise
+    CU_ASSERT_EQUAL(h_gc(heap), 10 * 32);
+    h_delete(heap);
+  }
+}
+
+// keeps an object in every frame and collects twice at the deepest one,
+// returns how many of the objects are intact and still allocated afterwards
+__attribute__((noinline)) static int collect_when_deep(heap_t *heap, int depth,
+                                                      size_t reused[2],
+                                                      size_t *words) {
+  struct node_fr *volatile mine = h_alloc_struct(heap, "*i");
+  mine->value = depth;
+  int intact = 0;
+  if (depth == 0) {
+    stack_cache_t *cache = &heap->threads->collector_cache;
+    h_gc(heap);
+    reused[0] = cache->reused;
+    // nothing above the barrier changed
+    h_gc(heap);
+    reused[1] = cache->reused;
+    *words = cache->words;
+  } else {
+    intact = collect_when_deep(heap, depth - 1, reused, words);
+  }
+  return intact + (is_object_start(heap, mine) && mine->value == depth);
+}
+
+void test_stack_barrier(void) {
+  heap_t *heap = h_init(40960, false, 0.9);
+  h_set_stack_barriers(heap, true);
+  size_t reused[2];
+  size_t words;
+  CU_ASSERT_EQUAL(collect_when_deep(heap, 300, reused, &words), 301);
+  CU_ASSERT_EQUAL(reused[0], 0);
+  // only the frames below the barrier were scanned, at least two words of
+  // each frame above it were not
+  CU_ASSERT_TRUE(reused[1] > 300);
+  CU_ASSERT_TRUE(words - reused[1] >= STACK_BARRIER_DEPTH);
+  CU_ASSERT_TRUE(words - reused[1] < 2 * STACK_BARRIER_DEPTH);
+
+  // returning through the barrier disarmed it
+  CU_ASSERT_PTR_NULL(stack_barrier_own()->slot);
+  h_gc(heap);
+  CU_ASSERT_EQUAL(heap->threads->collector_cache.reused, 0);
+  h_delete(heap);
+}
+
+typedef struct deep_worker {
+  heap_t *heap;
+  int ready;
+  int done;
+  int passes;
+  int intact;
+} deep_worker_t;
+
+// keeps an object in every frame and passes safepoints at the deepest one
+// until the test is done
+__attribute__((noinline)) static int wait_when_deep(deep_worker_t *w,
+                                                   int depth) {
+  struct node_fr *volatile mine = h_alloc_struct(w->heap, "*i");
+  mine->value = depth;
+  int intact = 0;
+  if (depth == 0) {
+    __atomic_store_n(&w->ready, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&w->done, __ATOMIC_ACQUIRE)) {
+      h_safepoint(w->heap);
+      __atomic_add_fetch(&w->passes, 1, __ATOMIC_RELEASE);
+      sched_yield();
+    }
+  } else {
+    intact = wait_when_deep(w, depth - 1);
+  }
+  return intact + (is_object_start(w->heap, mine) && mine->value == depth);
+}
+
+static void *deep_worker_main(void *arg) {
+  deep_worker_t *w = arg;
+  h_thread_attach(w->heap);
+  w->intact = wait_when_deep(w, 300);
+  h_thread_detach(w->heap);
+  return NULL;
+}
+
+// waits until the worker went through a safepoint that started after the
+// last collection, it armed its barrier on the way out of the one before
+static void wait_for_safepoint(deep_worker_t *w) {
+  int passes = __atomic_load_n(&w->passes, __ATOMIC_ACQUIRE);
+  while (__atomic_load_n(&w->passes, __ATOMIC_ACQUIRE) < passes + 2) {
+    sched_yield();
+  }
+}
+
+void test_stack_barrier_of_thread(void) {
+  heap_t *heap = h_init(40960, false, 0.9);
+  h_set_stack_barriers(heap, true);
+  deep_worker_t w = {heap, 0, 0, 0, 0};
+  pthread_t thread;
+  pthread_create(&thread, NULL, deep_worker_main, &w);
+  while (!__atomic_load_n(&w.ready, __ATOMIC_ACQUIRE)) {
+    sched_yield();
+  }
+
+  h_gc(heap);
+  stack_cache_t *cache = &heap->threads->list[0]->cache;
+  CU_ASSERT_EQUAL(cache->reused, 0);
+  wait_for_safepoint(&w);
+  h_gc(heap);
+  CU_ASSERT_TRUE(cache->reused > 300);
+  CU_ASSERT_TRUE(cache->words - cache->reused >= STACK_BARRIER_DEPTH);
 
-  elem_t res;
-  ioopm_linked_list_get(res_find_roots->roots, 0, &res);
-  CU_ASSERT_PTR_EQUAL(*(void **)res.ptr, obj1);
+  __atomic_store_n(&w.done, 1, __ATOMIC_RELEASE);
+  pthread_join(thread, NULL);
+  CU_ASSERT_EQUAL(w.intact, 301);
+  h_delete(heap);
 }
 
 int find_root_tests() {
@@ -32,6 +510,31 @@ int find_root_tests() {
   if ((NULL == CU_add_test(pSuite, "example test", ex_find_root_test)) ||
       (NULL ==
        CU_add_test(pSuite, "find single root test", test_find_single_root)) ||
+      (NULL == CU_add_test(pSuite, "test precise roots", test_precise_roots)) ||
+      (NULL == CU_add_test(pSuite, "test shadow stack scope", test_root_scope)) ||
+      (NULL == CU_add_test(pSuite, "test heap membership filter",
+                           test_membership_filter)) ||
+      (NULL == CU_add_test(pSuite, "test start map after every collector",
+                           test_start_map_after_gc)) ||
+      (NULL == CU_add_test(pSuite, "test root buffer reuse",
+                           test_root_buffer_reused)) ||
+      (NULL == CU_add_test(pSuite, "test registered root range",
+                           test_root_range)) ||
+      (NULL == CU_add_test(pSuite, "test precise root table", test_root_table)) ||
+      (NULL == CU_add_test(pSuite, "test global data segments",
+                           test_data_segments)) ||
+      (NULL == CU_add_test(pSuite, "test overlapping root ranges",
+                           test_overlapping_root_ranges)) ||
+      (NULL == CU_add_test(pSuite, "test resolving interior pointers",
+                           test_object_base)) ||
+      (NULL == CU_add_test(pSuite, "test interior pointers in every collector",
+                           test_interior_pointers)) ||
+      (NULL == CU_add_test(pSuite, "test blacklisting integer noise",
+                           test_blacklist)) ||
+      (NULL == CU_add_test(pSuite, "test reusing the frames above a barrier",
+                           test_stack_barrier)) ||
+      (NULL == CU_add_test(pSuite, "test the stack barrier of a thread",
+                           test_stack_barrier_of_thread)) ||
       false) {
 
     CU_cleanup_registry();
@@ -0,0 +1,107 @@
+#include "../src/allocation.h"
+#include "../src/compacting.h"
+#include "../src/fragmentation.h"
+#include "../src/gc.h"
+#include "../src/heap.h"
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stddef.h>
+
+void test_fragmentation(void) {
+  heap_t *heap = h_init(20480, false, 0.9);
+  void *volatile kept[5];
+  for (int i = 0; i < 3; i++) {
+    kept[i] = h_alloc_struct(heap, "*i");
+  }
+  kept[3] = h_alloc_raw(heap, 100);
+
+  gc_fragmentation_t report;
+  h_fragmentation(heap, &report);
+  CU_ASSERT_EQUAL(report.used_bytes, 208);
+  CU_ASSERT_EQUAL(report.used_bytes + report.free_bytes,
+                  report.pages * PAGE_SIZE);
+  CU_ASSERT_EQUAL(report.empty_pages, report.pages - 1);
+  CU_ASSERT_EQUAL(report.occupancy[0], 1);
+  CU_ASSERT_EQUAL(report.tail_bytes, PAGE_SIZE - 208);
+  CU_ASSERT_EQUAL(report.hole_bytes, 0);
+  CU_ASSERT_EQUAL(report.largest_free_run, PAGE_SIZE);
+  // 12 bytes after each "*i", 4 after the raw object
+  CU_ASSERT_EQUAL(report.padding_bytes, 40);
+
+  // a page that is filled by a single object
+  kept[4] = h_alloc_raw(heap, PAGE_SIZE - HEADER_SIZE);
+  h_fragmentation(heap, &report);
+  CU_ASSERT_EQUAL(report.full_pages, 1);
+  CU_ASSERT_EQUAL(report.occupancy[GC_OCCUPANCY_BUCKETS - 1], 1);
+  CU_ASSERT_EQUAL(report.padding_bytes, 40);
+
+  // the middle objects die and mark-region leaves a hole where they were
+  h_set_gc_mode(heap, GC_MODE_MARK_REGION);
+  kept[1] = NULL;
+  kept[2] = NULL;
+  h_gc(heap);
+  h_fragmentation(heap, &report);
+  CU_ASSERT_EQUAL(report.used_bytes, h_used(heap));
+  CU_ASSERT_EQUAL(report.tail_bytes + report.hole_bytes +
+                      report.empty_pages * PAGE_SIZE,
+                  report.free_bytes);
+  size_t in_use = 0;
+  for (int i = 0; i < GC_OCCUPANCY_BUCKETS; i++) {
+    in_use += report.occupancy[i];
+  }
+  CU_ASSERT_EQUAL(in_use + report.empty_pages, report.pages);
+  CU_ASSERT_PTR_NOT_NULL(kept[0]);
+  h_delete(heap);
+}
+
+void test_page_cursor(void) {
+  heap_t *heap = h_init(20480, false, 0.9);
+  void *volatile kept[3];
+  kept[0] = h_alloc_struct(heap, "*i");
+  // 1008 bytes, from slot 2 to slot 65 so it crosses into the second word
+  kept[1] = h_alloc_raw(heap, 1000);
+  kept[2] = h_alloc_raw(heap, 100);
+  page_t *page = heap->page_array[0];
+  CU_ASSERT_EQUAL(page->index, 0);
+
+  page_cursor_t cursor = page_cursor_start(page, heap->alloc_map);
+  CU_ASSERT_PTR_EQUAL(page_cursor_next(&cursor), kept[0]);
+  CU_ASSERT_EQUAL(cursor.granule, 0);
+  CU_ASSERT_EQUAL(cursor.size, 32);
+  CU_ASSERT_PTR_EQUAL(page_cursor_next(&cursor), kept[1]);
+  CU_ASSERT_EQUAL(cursor.granule, 2);
+  CU_ASSERT_EQUAL(cursor.size, 1008);
+  CU_ASSERT_PTR_EQUAL(page_cursor_next(&cursor), kept[2]);
+  CU_ASSERT_EQUAL(cursor.granule, 65);
+  CU_ASSERT_PTR_NULL(page_cursor_next(&cursor));
+  CU_ASSERT_PTR_NULL(page_cursor_next(&cursor));
+
+  // a map with only the last object, the free slots before it are skipped
+  uint64_t map[2] = {0, 0};
+  set_bits_in_alloc_map(map, 65, 112);
+  cursor = page_cursor_start(page, map);
+  CU_ASSERT_PTR_EQUAL(page_cursor_next(&cursor), kept[2]);
+  CU_ASSERT_PTR_NULL(page_cursor_next(&cursor));
+  h_delete(heap);
+}
+
+int fragmentation_tests() {
+  CU_pSuite pSuite = CU_add_suite("fragmentation_tests", NULL, NULL);
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ((NULL == CU_add_test(pSuite, "test fragmentation report",
+                           test_fragmentation)) ||
+      (NULL == CU_add_test(pSuite, "test walking the objects of a page",
+                           test_page_cursor)) ||
+      false) {
+
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
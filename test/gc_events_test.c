@@ -0,0 +1,84 @@
+#include "../src/gc.h"
+#include "../src/gc_events.h"
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX_EVENTS 16
+
+typedef struct event_log {
+  gc_event_kind_t kinds[MAX_EVENTS];
+  size_t count;
+  size_t bytes[MAX_EVENTS];
+  uint64_t last_ns;
+  bool ordered;
+} event_log_t;
+
+static void log_event(const gc_event_t *event, void *extra) {
+  event_log_t *log = extra;
+  if (event->time_ns < log->last_ns) {
+    log->ordered = false;
+  }
+  log->last_ns = event->time_ns;
+  if (log->count < MAX_EVENTS) {
+    log->bytes[log->count] = event->bytes;
+    log->kinds[log->count++] = event->kind;
+  }
+}
+
+void test_event_hook(void) {
+  gc_mode_t modes[] = {GC_MODE_COPYING, GC_MODE_SLIDING, GC_MODE_MARK_REGION};
+  for (int m = 0; m < 3; m++) {
+    heap_t *heap = h_init(20480, false, 0.5);
+    h_set_gc_mode(heap, modes[m]);
+    event_log_t log = {.ordered = true};
+    h_set_event_hook(heap, log_event, &log);
+    h_alloc_raw(heap, 100);
+    h_gc(heap);
+
+    CU_ASSERT_TRUE(log.ordered);
+    CU_ASSERT_TRUE(log.count >= 4);
+    CU_ASSERT_EQUAL(log.kinds[0], GC_EVENT_START);
+    CU_ASSERT_EQUAL(log.bytes[0], 112);
+    CU_ASSERT_EQUAL(log.kinds[1], GC_EVENT_ROOTS_END);
+    CU_ASSERT_EQUAL(log.kinds[log.count - 1], GC_EVENT_END);
+    CU_ASSERT_EQUAL(log.bytes[log.count - 1], h_used(heap));
+    size_t moves = 0;
+    for (size_t i = 0; i < log.count; i++) {
+      moves += log.kinds[i] == GC_EVENT_MOVE_END;
+    }
+    CU_ASSERT_EQUAL(moves, 1);
+
+    // an object bigger than a page never fits
+    log.count = 0;
+    CU_ASSERT_PTR_NULL(h_alloc_raw(heap, 4000));
+    CU_ASSERT_EQUAL(log.kinds[log.count - 1], GC_EVENT_HEAP_FULL);
+    CU_ASSERT_EQUAL(log.bytes[log.count - 1], 4016);
+
+    h_set_event_hook(heap, NULL, NULL);
+    log.count = 0;
+    h_gc(heap);
+    CU_ASSERT_EQUAL(log.count, 0);
+    h_delete(heap);
+  }
+}
+
+int gc_events_tests() {
+  CU_pSuite pSuite = CU_add_suite("gc_events_tests", NULL, NULL);
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ((NULL == CU_add_test(pSuite, "test GC event hook", test_event_hook)) ||
+      false) {
+
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
@@ -0,0 +1,145 @@
+#include "../src/gc.h"
+#include "../src/gc_policy.h"
+#include "../src/heap.h"
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static size_t policy_calls = 0;
+
+static size_t never_collect(const gc_policy_info_t *info, void *extra) {
+  (void)info;
+  policy_calls += (size_t)extra;
+  return SIZE_MAX;
+}
+
+void test_threshold_policy_default(void) {
+  heap_t *heap = h_init(20480, false, 0.5);
+  CU_ASSERT_EQUAL(heap->gc_policy.policy, gc_policy_threshold);
+  CU_ASSERT_EQUAL(heap->gc_policy.trigger_bytes, 10240);
+  CU_ASSERT_FALSE(gc_policy_should_collect(heap));
+
+  // the running counter follows the padded object sizes
+  h_alloc_raw(heap, 100);
+  h_alloc_struct(heap, "**i");
+  CU_ASSERT_EQUAL(heap->gc_policy.used_bytes, 112 + 32);
+  CU_ASSERT_EQUAL(heap->gc_policy.used_bytes, h_used(heap));
+
+  heap->gc_policy.used_bytes = 10241;
+  CU_ASSERT_TRUE(gc_policy_should_collect(heap));
+  h_delete(heap);
+}
+
+void test_after_gc_updates_info(void) {
+  heap_t *heap = h_init(20480, false, 0.5);
+  h_alloc_raw(heap, 1000);
+  h_alloc_raw(heap, 1000);
+  size_t used = heap->gc_policy.used_bytes;
+
+  uint64_t start = gc_clock_ns();
+  gc_policy_after_gc(heap, 1008, start);
+  gc_policy_info_t *info = &heap->gc_policy.info;
+  CU_ASSERT_EQUAL(info->collections, 1);
+  CU_ASSERT_EQUAL(info->allocated_bytes, used);
+  CU_ASSERT_EQUAL(info->live_bytes, 1008);
+  CU_ASSERT_EQUAL(info->previous_live_bytes, 0);
+  CU_ASSERT_EQUAL(heap->gc_policy.used_bytes, 1008);
+
+  // custom policies are asked after every collection
+  policy_calls = 0;
+  h_set_gc_policy(heap, never_collect, (void *)1);
+  CU_ASSERT_EQUAL(policy_calls, 1);
+  gc_policy_after_gc(heap, 0, gc_clock_ns());
+  CU_ASSERT_EQUAL(policy_calls, 2);
+  CU_ASSERT_EQUAL(info->allocated_bytes, 0);
+  CU_ASSERT_EQUAL(info->previous_live_bytes, 1008);
+  heap->gc_policy.used_bytes = 20480;
+  CU_ASSERT_FALSE(gc_policy_should_collect(heap));
+  h_delete(heap);
+}
+
+void test_adaptive_policy_budget(void) {
+  gc_adaptive_policy_t p = {.target_overhead = 0.5, .min_budget = 64};
+  gc_policy_info_t info = {.heap_size = 1 << 20, .gc_threshold = 0.5};
+
+  // nothing measured, fall back on the threshold
+  CU_ASSERT_EQUAL(gc_policy_adaptive(&info, &p), 1 << 19);
+
+  // 1 byte per ns allocated, 1 ns per live byte, 50% overhead gives a budget
+  // equal to the cost of tracing what is live
+  info.collections = 1;
+  info.live_bytes = 8192;
+  info.allocated_bytes = 16384;
+  info.mutator_ns = 16384;
+  info.gc_ns = 8192;
+  CU_ASSERT_EQUAL(gc_policy_adaptive(&info, &p), 8192 + 8192);
+  CU_ASSERT_DOUBLE_EQUAL(p.survival_rate, 0.5, 1e-9);
+
+  // a 10% overhead target allows more allocation, up to the ceiling
+  p.target_overhead = 0.1;
+  CU_ASSERT_EQUAL(gc_policy_adaptive(&info, &p), 8192 + 9 * 8192);
+  info.live_bytes = 500000;
+  info.gc_ns = 500000;
+  info.allocated_bytes = 500000;
+  info.mutator_ns = 500000;
+  p = (gc_adaptive_policy_t){.target_overhead = 0.1, .min_budget = 64};
+  CU_ASSERT_EQUAL(gc_policy_adaptive(&info, &p), 1 << 19);
+
+  // over the ceiling, at least min_budget is given
+  info.live_bytes = 600000;
+  CU_ASSERT_EQUAL(gc_policy_adaptive(&info, &p), 600000 + 64);
+
+  // a pause goal of 10000 ns caps the budget at what survives of it
+  p = (gc_adaptive_policy_t){
+      .target_overhead = 0.1, .pause_goal_ns = 10000, .min_budget = 64};
+  info.live_bytes = 8192;
+  info.previous_live_bytes = 0;
+  info.allocated_bytes = 16384;
+  info.mutator_ns = 16384;
+  info.gc_ns = 8192;
+  // (10000 - 8192) / 0.5
+  CU_ASSERT_EQUAL(gc_policy_adaptive(&info, &p), 8192 + 3616);
+}
+
+void test_adaptive_policy_on_heap(void) {
+  heap_t *heap = h_init(20480, false, 0.5);
+  h_set_adaptive_gc_policy(heap, 0.05, 1.0);
+  CU_ASSERT_EQUAL(heap->gc_policy.policy, gc_policy_adaptive);
+  CU_ASSERT_EQUAL(heap->gc_policy.extra, &heap->gc_policy.adaptive);
+  CU_ASSERT_EQUAL(heap->gc_policy.trigger_bytes, 10240);
+
+  h_alloc_raw(heap, 1000);
+  gc_policy_after_gc(heap, 0, gc_clock_ns());
+  // never below the minimum budget, never above the ceiling
+  CU_ASSERT_TRUE(heap->gc_policy.trigger_bytes >= DEFAULT_MIN_BUDGET);
+  CU_ASSERT_TRUE(heap->gc_policy.trigger_bytes <= 10240);
+  h_delete(heap);
+}
+
+int gc_policy_tests() {
+  CU_pSuite pSuite = CU_add_suite("gc_policy_tests", NULL, NULL);
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ((NULL == CU_add_test(pSuite, "test default threshold policy",
+                           test_threshold_policy_default)) ||
+      (NULL == CU_add_test(pSuite, "test statistics after a collection",
+                           test_after_gc_updates_info)) ||
+      (NULL == CU_add_test(pSuite, "test adaptive allocation budget",
+                           test_adaptive_policy_budget)) ||
+      (NULL == CU_add_test(pSuite, "test adaptive policy on a heap",
+                           test_adaptive_policy_on_heap)) ||
+      false) {
+
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
@@ -0,0 +1,63 @@
+#include "../src/gc.h"
+#include "../src/gc_stats.h"
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stddef.h>
+
+void test_stats(void) {
+  heap_t *heap = h_init(20480, false, 0.5);
+  gc_stats_t stats;
+  h_stats(heap, &stats);
+  CU_ASSERT_EQUAL(stats.collections, 0);
+
+  void *volatile kept = h_alloc_struct(heap, "*i");
+  h_alloc_struct(heap, "*i");
+  h_alloc_raw(heap, 100);
+  h_stats(heap, &stats);
+  CU_ASSERT_EQUAL(stats.objects_allocated, 3);
+  CU_ASSERT_EQUAL(stats.bytes_allocated, 32 + 32 + 112);
+
+  h_gc(heap);
+  h_stats(heap, &stats);
+  CU_ASSERT_EQUAL(stats.collections, 1);
+  CU_ASSERT_EQUAL(stats.last.bytes_before, 32 + 32 + 112);
+  CU_ASSERT_EQUAL(stats.last.bytes_after, h_used(heap));
+  // the kept object was copied to a new page and the old one was reset
+  CU_ASSERT_TRUE(stats.last.roots >= 1);
+  CU_ASSERT_TRUE(stats.last.objects_copied >= 1);
+  CU_ASSERT_TRUE(stats.last.bytes_copied >= 32);
+  CU_ASSERT_TRUE(stats.last.pages_reset >= 1);
+  CU_ASSERT_TRUE(stats.survival_rate > 0 && stats.survival_rate < 1);
+  CU_ASSERT_TRUE(stats.last.pause_ns >= stats.last.roots_ns);
+
+  // the totals add up the collections
+  gc_cycle_stats_t first = stats.last;
+  h_gc(heap);
+  h_stats(heap, &stats);
+  CU_ASSERT_EQUAL(stats.collections, 2);
+  CU_ASSERT_EQUAL(stats.total.pause_ns, first.pause_ns + stats.last.pause_ns);
+  CU_ASSERT_EQUAL(stats.total.objects_copied,
+                  first.objects_copied + stats.last.objects_copied);
+  CU_ASSERT_EQUAL(stats.total.bytes_before,
+                  first.bytes_before + stats.last.bytes_before);
+  CU_ASSERT_PTR_NOT_NULL(kept);
+  h_delete(heap);
+}
+
+int gc_stats_tests() {
+  CU_pSuite pSuite = CU_add_suite("gc_stats_tests", NULL, NULL);
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ((NULL == CU_add_test(pSuite, "test collection statistics", test_stats)) ||
+      false) {
+
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
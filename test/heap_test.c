@@ -38,15 +38,40 @@ void create_heap_test(void) {
   size_t heap_start = (size_t)heap->heap_start;
   size_t address_end_of_alloc_map =
       (size_t)&heap->alloc_map[heap->page_amount * 2 - 1] + sizeof(uint64_t);
+  size_t address_end_of_black_map =
+      (size_t)&heap->black_map[heap->page_amount * 2 - 1] + sizeof(uint64_t);
+  size_t address_end_of_visit_map =
+      (size_t)&heap->visit_map[heap->page_amount * 2 - 1] + sizeof(uint64_t);
 
-  // make sure allocation map don't overlap with first page, alloc end should be
+  // make sure the maps don't overlap with first page, the blacklist comes
+  // right after the allocation map, then the visited map whose end should be
   // same as heap start
-  CU_ASSERT_EQUAL(heap_start, address_end_of_alloc_map);
+  CU_ASSERT_EQUAL((size_t)heap->black_map, address_end_of_alloc_map);
+  CU_ASSERT_EQUAL((size_t)heap->visit_map, address_end_of_black_map);
+  CU_ASSERT_EQUAL(heap_start, address_end_of_visit_map);
   // TODO: fortsätt testa detta
 
   h_delete(heap);
 }
 
+void pages_back_to_back_test(void) {
+  heap_t *heap = h_init((size_t)10400, false, 0.4);
+  uint8_t *start = (uint8_t *)heap->heap_start;
+  for (size_t i = 0; i < heap->page_amount; i++) {
+    CU_ASSERT_EQUAL(heap->page_array[i]->page_start, start + i * PAGE_SIZE);
+    CU_ASSERT_EQUAL(heap->page_array[i]->index, i);
+  }
+  // the start map is right before the alloc map
+  CU_ASSERT_EQUAL(heap->start_map + heap->page_amount * 2, heap->alloc_map);
+
+  CU_ASSERT_PTR_NULL(page_of(heap, start - 1));
+  CU_ASSERT_EQUAL(page_of(heap, start), heap->page_array[0]);
+  CU_ASSERT_EQUAL(page_of(heap, start + 3 * PAGE_SIZE - 1),
+                  heap->page_array[2]);
+  CU_ASSERT_PTR_NULL(page_of(heap, start + heap->page_amount * PAGE_SIZE));
+  h_delete(heap);
+}
+
 // TODO: vad vill jag testa:
 //  -
 
@@ -58,7 +83,9 @@ int heap_tests() {
   }
 
   if ((NULL ==
-       CU_add_test(pSuite, "create a heap, simple test", create_heap_test))) {
+       CU_add_test(pSuite, "create a heap, simple test", create_heap_test)) ||
+      (NULL == CU_add_test(pSuite, "pages lie back to back",
+                           pages_back_to_back_test))) {
 
     CU_cleanup_registry();
     return CU_get_error();
@@ -6,6 +6,18 @@ int compacting_tests();
 int allocation_tests();
 int heap_tests();
 int find_root_tests();
+int mark_compact_tests();
+int mark_region_tests();
+int gc_policy_tests();
+int threads_tests();
+int gc_stats_tests();
+int gc_events_tests();
+int alloc_profile_tests();
+int census_tests();
+int snapshot_tests();
+int fragmentation_tests();
+int trace_tests();
+int alloc_buffer_tests();
 
 int main() {
   if (CUE_SUCCESS != CU_initialize_registry()) {
@@ -14,7 +26,14 @@ int main() {
 
   // Registrera testsuiter
   if (heap_tests() != CUE_SUCCESS || allocation_tests() != CUE_SUCCESS ||
-      compacting_tests() != CUE_SUCCESS || find_root_tests() != CUE_SUCCESS) {
+      compacting_tests() != CUE_SUCCESS || find_root_tests() != CUE_SUCCESS ||
+      mark_compact_tests() != CUE_SUCCESS ||
+      mark_region_tests() != CUE_SUCCESS || gc_policy_tests() != CUE_SUCCESS ||
+      threads_tests() != CUE_SUCCESS || gc_stats_tests() != CUE_SUCCESS ||
+      gc_events_tests() != CUE_SUCCESS ||
+      alloc_profile_tests() != CUE_SUCCESS || census_tests() != CUE_SUCCESS ||
+      snapshot_tests() != CUE_SUCCESS || fragmentation_tests() != CUE_SUCCESS ||
+      trace_tests() != CUE_SUCCESS || alloc_buffer_tests() != CUE_SUCCESS) {
     CU_cleanup_registry();
     return CU_get_error();
   }
@@ -0,0 +1,134 @@
+#include "../src/compacting.h"
+#include "../src/gc.h"
+#include "../src/heap.h"
+#include "../src/mark_compact.h"
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct ptr_ptr_int_mc {
+  void *ptr1;
+  void *ptr2;
+  int int1;
+};
+
+void test_object_total_size(void) {
+  heap_t *heap = h_init(10400, false, 0.5);
+  // 20 bytes + header = 28 -> 32
+  void *obj1 = h_alloc_struct(heap, "**i");
+  // 8 bytes + header = 16
+  void *obj2 = h_alloc_struct(heap, "l");
+  // 100 bytes + header = 108 -> 112
+  void *raw = h_alloc_raw(heap, 100);
+
+  CU_ASSERT_EQUAL(object_total_size(obj1), 32);
+  CU_ASSERT_EQUAL(object_total_size(obj2), 16);
+  CU_ASSERT_EQUAL(object_total_size(raw), 112);
+
+  CU_ASSERT_TRUE(is_object_start(heap, obj2));
+  CU_ASSERT_TRUE(is_object_start(heap, raw));
+  CU_ASSERT_FALSE(is_object_start(heap, (uint8_t *)raw + 16));
+  CU_ASSERT_FALSE(is_object_start(heap, (uint8_t *)obj2 - HEADER_SIZE));
+  h_delete(heap);
+}
+
+void test_mark_compact_slides_within_page(void) {
+  heap_t *heap = h_init(10400, false, 0.5);
+  h_set_gc_mode(heap, GC_MODE_SLIDING);
+
+  struct ptr_ptr_int_mc *obj1 = h_alloc_struct(heap, "**i");
+  struct ptr_ptr_int_mc *obj2 = h_alloc_struct(heap, "**i");
+  struct ptr_ptr_int_mc *obj3 = h_alloc_struct(heap, "**i");
+  obj1->ptr1 = obj3;
+  obj3->int1 = 3;
+  obj2->int1 = 2;
+
+  page_t *page1 = heap->page_array[0];
+  page_t *page2 = heap->page_array[1];
+
+  root_buffer_t artificial_roots = {0};
+  root_buffer_append(&artificial_roots, (void **)&obj1);
+
+  mark_compact(heap, &artificial_roots);
+
+  // obj2 is garbage, obj3 slides down into its place on the same page
+  CU_ASSERT_EQUAL((uint64_t *)obj1, (uint64_t *)page1->page_start + 1);
+  CU_ASSERT_EQUAL((uint64_t *)obj1->ptr1, (uint64_t *)page1->page_start + 5);
+  CU_ASSERT_EQUAL(((struct ptr_ptr_int_mc *)obj1->ptr1)->int1, 3);
+
+  // no passive page was needed
+  CU_ASSERT_TRUE(page1->is_active);
+  CU_ASSERT_FALSE(page2->is_active);
+  CU_ASSERT_EQUAL(page1->remaining_size, 2048 - (2 * 32));
+  CU_ASSERT_EQUAL(heap->alloc_map[0], 15ULL << 60);
+  CU_ASSERT_EQUAL(heap->alloc_map[2], 0);
+
+  root_buffer_destroy(&artificial_roots);
+  h_delete(heap);
+}
+
+void test_mark_compact_uses_whole_heap(void) {
+  // one page, the copying collector would need a second one
+  heap_t *heap = h_init(2600, false, 1.0);
+  h_set_gc_mode(heap, GC_MODE_SLIDING);
+  CU_ASSERT_EQUAL(heap->page_amount, 1);
+
+  struct ptr_ptr_int_mc *keep = NULL;
+  // fill the page completely with 64 objects of 32 bytes, keep every 4th one
+  // in a chain starting at keep
+  struct ptr_ptr_int_mc *last = NULL;
+  for (int i = 0; i < 64; i++) {
+    struct ptr_ptr_int_mc *obj = h_alloc_struct(heap, "**i");
+    obj->int1 = i;
+    if (i % 4 == 0) {
+      if (last) {
+        last->ptr1 = obj;
+      } else {
+        keep = obj;
+      }
+      last = obj;
+    }
+  }
+  CU_ASSERT_EQUAL(heap->page_array[0]->remaining_size, 0);
+
+  root_buffer_t artificial_roots = {0};
+  root_buffer_append(&artificial_roots, (void **)&keep);
+  mark_compact(heap, &artificial_roots);
+
+  CU_ASSERT_EQUAL(heap->page_array[0]->remaining_size, 2048 - 16 * 32);
+  int expected = 0;
+  for (struct ptr_ptr_int_mc *obj = keep; obj; obj = obj->ptr1) {
+    CU_ASSERT_EQUAL(obj->int1, expected);
+    expected += 4;
+  }
+  CU_ASSERT_EQUAL(expected, 64);
+
+  root_buffer_destroy(&artificial_roots);
+  h_delete(heap);
+}
+
+int mark_compact_tests() {
+  CU_pSuite pSuite = CU_add_suite("mark_compact_tests", NULL, NULL);
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ((NULL == CU_add_test(pSuite, "test size and start of objects",
+                           test_object_total_size)) ||
+      (NULL == CU_add_test(pSuite, "test sliding objects within a page",
+                           test_mark_compact_slides_within_page)) ||
+      (NULL == CU_add_test(pSuite, "test sliding on a completely full heap",
+                           test_mark_compact_uses_whole_heap)) ||
+      false) {
+
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
@@ -0,0 +1,137 @@
+#include "../src/compacting.h"
+#include "../src/gc.h"
+#include "../src/heap.h"
+#include "../src/mark_region.h"
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct ptr_ptr_int_mr {
+  void *ptr1;
+  void *ptr2;
+  int int1;
+};
+
+void test_find_hole(void) {
+  int hole_lines;
+  // line 0 and 2 live
+  CU_ASSERT_EQUAL(find_hole(0x5, 0, 1, &hole_lines), 1);
+  CU_ASSERT_EQUAL(hole_lines, 1);
+  CU_ASSERT_EQUAL(find_hole(0x5, 0, 129, &hole_lines), 3);
+  CU_ASSERT_EQUAL(hole_lines, 13);
+  CU_ASSERT_EQUAL(find_hole(0xFFFF, 0, 1, &hole_lines), -1);
+  CU_ASSERT_EQUAL(count_holes(0x5), 2);
+  CU_ASSERT_EQUAL(count_holes(0), 1);
+  CU_ASSERT_EQUAL(count_holes(0xFFFF), 0);
+}
+
+void test_mark_region_reuses_holes(void) {
+  heap_t *heap = h_init(10400, false, 0.5);
+  h_set_gc_mode(heap, GC_MODE_MARK_REGION);
+
+  // 4 objects of 32 bytes per line, keep one in line 0 and one in line 2
+  struct ptr_ptr_int_mr *first = NULL;
+  struct ptr_ptr_int_mr *objs[16];
+  for (int i = 0; i < 16; i++) {
+    objs[i] = h_alloc_struct(heap, "**i");
+    objs[i]->int1 = i;
+  }
+  first = objs[0];
+  first->ptr1 = objs[8];
+  struct ptr_ptr_int_mr *second = objs[8];
+  for (int i = 0; i < 16; i++) {
+    objs[i] = NULL;
+  }
+
+  root_buffer_t artificial_roots = {0};
+  root_buffer_append(&artificial_roots, (void **)&first);
+  mark_region(heap, &artificial_roots, false);
+
+  page_t *page = heap->page_array[0];
+  // nothing moved
+  CU_ASSERT_EQUAL((uint8_t *)first, (uint8_t *)page->page_start + 8);
+  CU_ASSERT_EQUAL(first->ptr1, second);
+  CU_ASSERT_EQUAL(second->int1, 8);
+  CU_ASSERT_EQUAL(page->line_marks, 0x5);
+  CU_ASSERT_EQUAL(h_used(heap), 64);
+
+  // allocation continues in the hole at line 1
+  CU_ASSERT_EQUAL(page->next_empty_space, (uint8_t *)page->page_start + 128);
+  CU_ASSERT_EQUAL(page->remaining_size, 128);
+  void *raw1 = h_alloc_raw(heap, 100);
+  CU_ASSERT_EQUAL((uint8_t *)raw1, (uint8_t *)page->page_start + 128 + 8);
+
+  // the next one does not fit in what is left of line 1, skip to line 3
+  void *raw2 = h_alloc_raw(heap, 100);
+  CU_ASSERT_EQUAL((uint8_t *)raw2, (uint8_t *)page->page_start + 384 + 8);
+  CU_ASSERT_TRUE(is_object_start(heap, raw2));
+  CU_ASSERT_EQUAL(second->int1, 8);
+
+  root_buffer_destroy(&artificial_roots);
+  h_delete(heap);
+}
+
+void test_mark_region_evacuates_fragmented_page(void) {
+  heap_t *heap = h_init(10400, false, 0.5);
+  h_set_gc_mode(heap, GC_MODE_MARK_REGION);
+
+  // fill the first page, keep object 0 (line 0) and 40 (line 10)
+  struct ptr_ptr_int_mr *first = NULL;
+  struct ptr_ptr_int_mr *obj;
+  for (int i = 0; i < 64; i++) {
+    obj = h_alloc_struct(heap, "**i");
+    obj->int1 = i;
+    if (i == 0) {
+      first = obj;
+    } else if (i == 40) {
+      first->ptr2 = obj;
+    }
+  }
+  obj = NULL;
+
+  page_t *page1 = heap->page_array[0];
+  page_t *page2 = heap->page_array[1];
+  root_buffer_t artificial_roots = {0};
+  root_buffer_append(&artificial_roots, (void **)&first);
+  mark_region(heap, &artificial_roots, true);
+
+  // both survivors were moved to the start of the free page
+  CU_ASSERT_FALSE(page1->is_active);
+  CU_ASSERT_TRUE(page2->is_active);
+  CU_ASSERT_EQUAL((uint8_t *)first, (uint8_t *)page2->page_start + 8);
+  CU_ASSERT_EQUAL((uint8_t *)first->ptr2, (uint8_t *)page2->page_start + 40);
+  CU_ASSERT_EQUAL(first->int1, 0);
+  CU_ASSERT_EQUAL(((struct ptr_ptr_int_mr *)first->ptr2)->int1, 40);
+  CU_ASSERT_EQUAL(heap->alloc_map[0], 0);
+  CU_ASSERT_EQUAL(heap->alloc_map[2], 15ULL << 60);
+  CU_ASSERT_EQUAL(h_used(heap), 64);
+
+  root_buffer_destroy(&artificial_roots);
+  h_delete(heap);
+}
+
+int mark_region_tests() {
+  CU_pSuite pSuite = CU_add_suite("mark_region_tests", NULL, NULL);
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ((NULL == CU_add_test(pSuite, "test finding holes in line marks",
+                           test_find_hole)) ||
+      (NULL == CU_add_test(pSuite, "test allocating into holes after marking",
+                           test_mark_region_reuses_holes)) ||
+      (NULL == CU_add_test(pSuite, "test evacuating a fragmented page",
+                           test_mark_region_evacuates_fragmented_page)) ||
+      false) {
+
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
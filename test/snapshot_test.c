@@ -0,0 +1,115 @@
+#include "../src/gc.h"
+#include "../src/heap.h"
+#include "../src/snapshot.h"
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct node_snap {
+  void *next;
+  int value;
+};
+
+void test_snapshot(void) {
+  heap_t *heap = h_init(20480, false, 0.9);
+  struct node_snap *volatile kept[1];
+  struct node_snap *head = NULL;
+  for (int i = 0; i < 3; i++) {
+    struct node_snap *node = h_alloc_struct(heap, "*i");
+    node->value = i;
+    node->next = head;
+    head = node;
+  }
+  kept[0] = head;
+  head = NULL;
+  void *volatile garbage = h_alloc_raw(heap, 100);
+  uintptr_t garbage_address = (uintptr_t)garbage;
+  garbage = NULL;
+  uintptr_t head_address = (uintptr_t)kept[0];
+
+  FILE *file = tmpfile();
+  CU_ASSERT_TRUE(h_dump_snapshot(heap, fileno(file)));
+  uint64_t words[256];
+  rewind(file);
+  size_t count = fread(words, sizeof(uint64_t), 256, file);
+  fclose(file);
+  CU_ASSERT_EQUAL(words[0], SNAPSHOT_MAGIC);
+  CU_ASSERT_EQUAL(words[1], SNAPSHOT_VERSION);
+  CU_ASSERT_EQUAL(words[2], (uintptr_t)heap->heap_start);
+
+  // roots first, then the three nodes of the list and the raw object that
+  // is garbage in address order, nothing was collected
+  size_t i = 4;
+  size_t roots = 0;
+  bool head_is_root = false;
+  while (i < count && words[i] == SNAPSHOT_ROOT) {
+    head_is_root |= words[i + 2] == (uintptr_t)kept[0];
+    roots++;
+    i += 3;
+  }
+  CU_ASSERT_TRUE(head_is_root);
+  size_t objects = 0;
+  bool head_found = false;
+  bool garbage_found = false;
+  uint64_t last = 0;
+  while (i < count && (words[i] & 0xff) == SNAPSHOT_OBJECT) {
+    CU_ASSERT_TRUE(words[i + 1] > last);
+    if (words[i + 1] == garbage_address) {
+      garbage_found = true;
+      CU_ASSERT_EQUAL(words[i] >> 8, 0);
+      CU_ASSERT_EQUAL(words[i + 3], 112);
+      last = words[i + 1];
+      i += 4;
+      objects++;
+      continue;
+    }
+    CU_ASSERT_EQUAL(words[i] >> 8, words[i + 1] == (uintptr_t)kept[0] ||
+                                           ((struct node_snap *)words[i + 1])
+                                               ->next
+                                       ? 1
+                                       : 0);
+    CU_ASSERT_EQUAL(words[i + 3], 32);
+    if (words[i + 1] == (uintptr_t)kept[0]) {
+      head_found = true;
+      CU_ASSERT_EQUAL(words[i + 4], (uintptr_t)kept[0]->next);
+    }
+    last = words[i + 1];
+    i += 4 + (words[i] >> 8);
+    objects++;
+  }
+  CU_ASSERT_TRUE(head_found);
+  CU_ASSERT_TRUE(garbage_found);
+  CU_ASSERT_EQUAL(objects, 4);
+  CU_ASSERT_EQUAL(i + 3, count);
+  CU_ASSERT_EQUAL(words[i], SNAPSHOT_END);
+  CU_ASSERT_EQUAL(words[i + 1], 4);
+  CU_ASSERT_EQUAL(words[i + 2], roots);
+
+  // the list is untouched and was not moved
+  CU_ASSERT_EQUAL(kept[0]->value, 2);
+  CU_ASSERT_EQUAL((uintptr_t)kept[0], head_address);
+  CU_ASSERT_EQUAL(heap->gc_policy.info.collections, 0);
+  CU_ASSERT_FALSE(h_dump_snapshot(heap, -1));
+  h_delete(heap);
+}
+
+int snapshot_tests() {
+  CU_pSuite pSuite = CU_add_suite("snapshot_tests", NULL, NULL);
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ((NULL == CU_add_test(pSuite, "test heap snapshot", test_snapshot)) ||
+      false) {
+
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
@@ -0,0 +1,424 @@
+#include "../src/compacting.h"
+#include "../src/find_roots.h"
+#include "../src/gc.h"
+#include "../src/heap.h"
+#include "../src/threads.h"
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <ucontext.h>
+
+#define WORKERS 4
+
+struct node_th {
+  void *next;
+  int value;
+};
+
+typedef struct worker {
+  heap_t *heap;
+  int ready;
+  int done;
+  bool moved;
+  bool intact;
+} worker_t;
+
+static struct node_th *build_list(heap_t *heap, int length, int first) {
+  struct node_th *head = NULL;
+  for (int i = length - 1; i >= 0; i--) {
+    struct node_th *node = h_alloc_struct(heap, "*i");
+    node->value = first + i;
+    node->next = head;
+    head = node;
+  }
+  return head;
+}
+
+static bool list_is_intact(struct node_th *head, int length, int first) {
+  for (int i = 0; i < length; i++) {
+    if (!head || head->value != first + i) {
+      return false;
+    }
+    head = head->next;
+  }
+  return head == NULL;
+}
+
+static void wait_for(int *flag) {
+  while (!__atomic_load_n(flag, __ATOMIC_ACQUIRE)) {
+    sched_yield();
+  }
+}
+
+static void set_flag(int *flag) { __atomic_store_n(flag, 1, __ATOMIC_RELEASE); }
+
+// keeps a list only on its own stack and polls for safepoints until the main
+// thread has collected
+static void *safepoint_worker(void *arg) {
+  worker_t *w = arg;
+  h_thread_attach(w->heap);
+  struct node_th *volatile list = build_list(w->heap, 10, 100);
+  // off by one so that the collector does not take it for a root and update it
+  volatile uintptr_t old = (uintptr_t)list + 1;
+  set_flag(&w->ready);
+  while (!__atomic_load_n(&w->done, __ATOMIC_ACQUIRE)) {
+    h_safepoint(w->heap);
+  }
+  w->moved = (uintptr_t)list + 1 != old;
+  w->intact = list_is_intact(list, 10, 100);
+  h_thread_detach(w->heap);
+  return NULL;
+}
+
+void test_attach_detach(void) {
+  heap_t *heap = h_init(10400, false, 0.9);
+  CU_ASSERT_PTR_NULL(threads_current(heap));
+  h_thread_attach(heap);
+  CU_ASSERT_EQUAL(heap->threads->count, 1);
+  gc_thread_t *self = threads_current(heap);
+  CU_ASSERT_PTR_NOT_NULL(self);
+  CU_ASSERT_PTR_EQUAL(self->heap, heap);
+  CU_ASSERT_TRUE((uint8_t *)self->stack_bottom > (uint8_t *)&self);
+
+  // attached to a second heap at the same time
+  heap_t *other = h_init(10400, false, 0.9);
+  h_thread_attach(other);
+  CU_ASSERT_PTR_NOT_EQUAL(threads_current(other), self);
+  CU_ASSERT_PTR_EQUAL(threads_current(heap), self);
+  h_thread_detach(other);
+  h_delete(other);
+
+  h_thread_detach(heap);
+  CU_ASSERT_EQUAL(heap->threads->count, 0);
+  CU_ASSERT_PTR_NULL(threads_current(heap));
+  h_delete(heap);
+}
+
+void test_roots_on_other_thread(void) {
+  heap_t *heap = h_init(10400, false, 0.9);
+  worker_t w = {.heap = heap};
+  pthread_t thread;
+  pthread_create(&thread, NULL, safepoint_worker, &w);
+  wait_for(&w.ready);
+
+  // garbage of this thread, the list of the worker is only on its stack
+  for (int i = 0; i < 5; i++) {
+    h_alloc_struct(heap, "*i");
+  }
+  size_t reclaimed = h_gc(heap);
+  set_flag(&w.done);
+  pthread_join(thread, NULL);
+
+  CU_ASSERT_TRUE(reclaimed >= 16);
+  CU_ASSERT_TRUE(w.moved);
+  CU_ASSERT_TRUE(w.intact);
+  CU_ASSERT_EQUAL(heap->threads->count, 0);
+  h_delete(heap);
+}
+
+// builds and checks lists until `rounds` are done, every allocation may run a
+// collection that moves the lists of all the other workers
+static void *allocating_worker(void *arg) {
+  worker_t *w = arg;
+  h_thread_attach(w->heap);
+  w->intact = true;
+  for (int round = 0; round < 40; round++) {
+    struct node_th *list = build_list(w->heap, 30, round);
+    struct node_th *kept = build_list(w->heap, 5, -round);
+    if (!list_is_intact(list, 30, round) || !list_is_intact(kept, 5, -round)) {
+      w->intact = false;
+    }
+  }
+  h_thread_detach(w->heap);
+  return NULL;
+}
+
+void test_concurrent_allocation(void) {
+  gc_mode_t modes[] = {GC_MODE_COPYING, GC_MODE_SLIDING, GC_MODE_MARK_REGION};
+  for (int m = 0; m < 3; m++) {
+    heap_t *heap = h_init(40960, false, 0.5);
+    h_set_gc_mode(heap, modes[m]);
+    worker_t workers[WORKERS];
+    pthread_t threads[WORKERS];
+    for (int i = 0; i < WORKERS; i++) {
+      workers[i] = (worker_t){.heap = heap};
+      pthread_create(&threads[i], NULL, allocating_worker, &workers[i]);
+    }
+    for (int i = 0; i < WORKERS; i++) {
+      pthread_join(threads[i], NULL);
+      CU_ASSERT_TRUE(workers[i].intact);
+    }
+    CU_ASSERT_TRUE(heap->gc_policy.info.collections > 0);
+    h_delete(heap);
+  }
+}
+
+static int precise_start;
+
+static void *wait_for_start(void *arg) {
+  wait_for(&precise_start);
+  return arg;
+}
+
+// build_list with the list under construction on the shadow stack
+static struct node_th *build_rooted_list(heap_t *heap, int length,
+                                         int first) {
+  H_ROOT_SCOPE(heap);
+  struct node_th *head = NULL;
+  h_push_root(heap, &head);
+  for (int i = length - 1; i >= 0; i--) {
+    struct node_th *node = h_alloc_struct(heap, "*i");
+    node->value = first + i;
+    node->next = head;
+    head = node;
+  }
+  return head;
+}
+
+// allocating_worker with precise roots, the lists are only reachable from
+// the shadow stack of this thread
+static void *precise_worker(void *arg) {
+  worker_t *w = arg;
+  h_thread_attach(w->heap);
+  w->intact = true;
+  // both push and pop at the same time
+  set_flag(&w->ready);
+  h_do_blocking(w->heap, wait_for_start, NULL);
+  for (int round = 0; round < 200; round++) {
+    H_ROOT_SCOPE(w->heap);
+    struct node_th *list = NULL;
+    struct node_th *kept = NULL;
+    h_push_root(w->heap, &list);
+    h_push_root(w->heap, &kept);
+    list = build_rooted_list(w->heap, 30, round);
+    kept = build_rooted_list(w->heap, 5, -round);
+    if (!list_is_intact(list, 30, round) || !list_is_intact(kept, 5, -round) ||
+        h_root_depth(w->heap) != 2) {
+      w->intact = false;
+    }
+  }
+  if (h_root_depth(w->heap) != 0) {
+    w->intact = false;
+  }
+  h_thread_detach(w->heap);
+  return NULL;
+}
+
+void test_precise_roots_per_thread(void) {
+  gc_mode_t modes[] = {GC_MODE_COPYING, GC_MODE_SLIDING, GC_MODE_MARK_REGION};
+  for (int m = 0; m < 3; m++) {
+    heap_t *heap = h_init(40960, false, 0.5);
+    h_set_gc_mode(heap, modes[m]);
+    h_set_root_mode(heap, ROOT_MODE_PRECISE);
+    worker_t workers[2];
+    pthread_t threads[2];
+    precise_start = 0;
+    for (int i = 0; i < 2; i++) {
+      workers[i] = (worker_t){.heap = heap};
+      pthread_create(&threads[i], NULL, precise_worker, &workers[i]);
+    }
+    for (int i = 0; i < 2; i++) {
+      wait_for(&workers[i].ready);
+    }
+    set_flag(&precise_start);
+    for (int i = 0; i < 2; i++) {
+      pthread_join(threads[i], NULL);
+      CU_ASSERT_TRUE(workers[i].intact);
+    }
+    CU_ASSERT_TRUE(heap->gc_policy.info.collections > 0);
+    CU_ASSERT_EQUAL(h_root_depth(heap), 0);
+    h_delete(heap);
+  }
+}
+
+static void *wait_for_done(void *arg) {
+  wait_for(&((worker_t *)arg)->done);
+  return arg;
+}
+
+// blocks without polling, the collection must not wait for it
+static void *blocking_worker(void *arg) {
+  worker_t *w = arg;
+  h_thread_attach(w->heap);
+  struct node_th *volatile list = build_list(w->heap, 10, 7);
+  // off by one so that the collector does not take it for a root and update it
+  volatile uintptr_t old = (uintptr_t)list + 1;
+  set_flag(&w->ready);
+  CU_ASSERT_PTR_EQUAL(h_do_blocking(w->heap, wait_for_done, w), w);
+  w->moved = (uintptr_t)list + 1 != old;
+  w->intact = list_is_intact(list, 10, 7);
+  h_thread_detach(w->heap);
+  return NULL;
+}
+
+void test_do_blocking(void) {
+  heap_t *heap = h_init(10400, false, 0.9);
+  worker_t w = {.heap = heap};
+  pthread_t thread;
+  pthread_create(&thread, NULL, blocking_worker, &w);
+  wait_for(&w.ready);
+  h_gc(heap);
+  set_flag(&w.done);
+  pthread_join(thread, NULL);
+
+  CU_ASSERT_TRUE(w.moved);
+  CU_ASSERT_TRUE(w.intact);
+  h_delete(heap);
+}
+
+static void *saved_sp = NULL;
+
+// overwrites the dead frames below the caller, build_list leaves the last
+// node it allocated there
+__attribute__((noinline)) static void scrub_stack(void) {
+  void *volatile area[256];
+  for (size_t i = 0; i < 256; i++) {
+    area[i] = NULL;
+  }
+  (void)area;
+}
+
+static void *saved_sp_of(void *lo) {
+  (void)lo;
+  return saved_sp;
+}
+
+void test_registered_stack(void) {
+  heap_t *heap = h_init(10400, false, 0.9);
+  void **words = calloc(512, sizeof(void *));
+  // suspended with 12 words in use, nothing below is scanned
+  saved_sp = words + 500;
+  gc_stack_t *stack = h_register_stack(heap, words, words + 512, saved_sp_of);
+  words[505] = build_list(heap, 1, 1);
+  words[10] = build_list(heap, 1, 2);
+  // off by one so that the collector does not take it for a root and update it
+  volatile uintptr_t old = (uintptr_t)words[505] + 1;
+
+  scrub_stack();
+  CU_ASSERT_EQUAL(h_gc(heap), 32);
+  CU_ASSERT_NOT_EQUAL((uintptr_t)words[505] + 1, old);
+  CU_ASSERT_TRUE(list_is_intact(words[505], 1, 1));
+
+  // clean now, the reference is updated without scanning
+  CU_ASSERT_FALSE(stack->dirty);
+  CU_ASSERT_EQUAL(h_gc(heap), 0);
+  CU_ASSERT_EQUAL(stack->cache.reused, 12);
+  CU_ASSERT_TRUE(list_is_intact(words[505], 1, 1));
+
+  // the coroutine ran and stored another reference
+  h_stack_set_dirty(stack, true);
+  words[506] = build_list(heap, 1, 3);
+  CU_ASSERT_EQUAL(h_gc(heap), 0);
+  CU_ASSERT_EQUAL(stack->cache.reused, 0);
+  CU_ASSERT_TRUE(list_is_intact(words[505], 1, 1));
+  CU_ASSERT_TRUE(list_is_intact(words[506], 1, 3));
+
+  h_unregister_stack(heap, stack);
+  CU_ASSERT_EQUAL(heap->threads->stack_count, 0);
+  CU_ASSERT_EQUAL(h_gc(heap), 64);
+  free(words);
+  h_delete(heap);
+}
+
+static ucontext_t native_context;
+static ucontext_t coroutine_context;
+static heap_t *coroutine_heap;
+static worker_t coroutine_result;
+static void *native_sp = NULL;
+
+static void *native_sp_of(void *lo) {
+  (void)lo;
+  return native_sp;
+}
+
+// the native stack is suspended from here while the coroutine runs
+__attribute__((noinline)) static void switch_to_coroutine(void) {
+  void *volatile marker = NULL;
+  native_sp = (void *)&marker;
+  swapcontext(&native_context, &coroutine_context);
+}
+
+// the native stack of the thread, registered like a coroutine stack
+static gc_stack_t *register_native_stack(heap_t *heap) {
+  uint8_t *base = get_stack_bottom();
+  return h_register_stack(heap, base - (1 << 20), base, native_sp_of);
+}
+
+// collects while running on a registered stack far away from the native one
+static void coroutine_body(void) {
+  struct node_th *volatile list = build_list(coroutine_heap, 10, 40);
+  volatile uintptr_t old = (uintptr_t)list + 1;
+  h_gc(coroutine_heap);
+  coroutine_result.moved = (uintptr_t)list + 1 != old;
+  coroutine_result.intact = list_is_intact(list, 10, 40);
+}
+
+void test_collect_on_registered_stack(void) {
+  coroutine_heap = h_init(10400, false, 0.9);
+  gc_stack_t *native = register_native_stack(coroutine_heap);
+  size_t size = 64 * 1024;
+  uint8_t *memory = malloc(size);
+  gc_stack_t *stack =
+      h_register_stack(coroutine_heap, memory, memory + size, NULL);
+
+  // only on the native stack while the coroutine collects
+  struct node_th *volatile native_list = build_list(coroutine_heap, 5, 60);
+  volatile uintptr_t old = (uintptr_t)native_list + 1;
+
+  getcontext(&coroutine_context);
+  coroutine_context.uc_stack.ss_sp = memory;
+  coroutine_context.uc_stack.ss_size = size;
+  coroutine_context.uc_link = &native_context;
+  makecontext(&coroutine_context, coroutine_body, 0);
+  switch_to_coroutine();
+
+  CU_ASSERT_TRUE(coroutine_result.moved);
+  CU_ASSERT_TRUE(coroutine_result.intact);
+  // it was running during the collection
+  CU_ASSERT_TRUE(stack->dirty);
+  // the native stack was suspended and scanned from where it switched
+  CU_ASSERT_FALSE(native->dirty);
+  CU_ASSERT_NOT_EQUAL((uintptr_t)native_list + 1, old);
+  CU_ASSERT_TRUE(list_is_intact(native_list, 5, 60));
+  CU_ASSERT_TRUE(is_object_start(coroutine_heap, native_list));
+  h_unregister_stack(coroutine_heap, stack);
+  h_unregister_stack(coroutine_heap, native);
+  free(memory);
+  h_delete(coroutine_heap);
+}
+
+int threads_tests() {
+  CU_pSuite pSuite = CU_add_suite("threads_tests", NULL, NULL);
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ((NULL == CU_add_test(pSuite, "test attach and detach",
+                           test_attach_detach)) ||
+      (NULL == CU_add_test(pSuite, "test roots on another thread's stack",
+                           test_roots_on_other_thread)) ||
+      (NULL == CU_add_test(pSuite, "test allocation from several threads",
+                           test_concurrent_allocation)) ||
+      (NULL == CU_add_test(pSuite, "test precise roots of two threads",
+                           test_precise_roots_per_thread)) ||
+      (NULL == CU_add_test(pSuite, "test collection during a blocking call",
+                           test_do_blocking)) ||
+      (NULL == CU_add_test(pSuite, "test registered coroutine stack",
+                           test_registered_stack)) ||
+      (NULL == CU_add_test(pSuite, "test collection on a coroutine stack",
+                           test_collect_on_registered_stack)) ||
+      false) {
+
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
@@ -0,0 +1,181 @@
+#include "../src/compacting.h"
+#include "../src/gc.h"
+#include "../src/heap.h"
+#include "../src/threads.h"
+#include "../src/trace.h"
+
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct node_trace {
+  void *next;
+  int value;
+};
+
+static uint64_t trace_varint(const uint8_t **p) {
+  uint64_t value = 0;
+  for (int shift = 0;; shift += 7) {
+    uint8_t byte = *(*p)++;
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+}
+
+// leaves no pointer to the object in a register of the caller
+__attribute__((noinline)) static void alloc_garbage(heap_t *heap) {
+  h_alloc_raw(heap, 1000);
+}
+
+// overwrites the dead frames of the allocation below the caller
+__attribute__((noinline)) static void scrub_stack(void) {
+  void *volatile area[256];
+  for (size_t i = 0; i < 256; i++) {
+    area[i] = NULL;
+  }
+  (void)area;
+}
+
+void test_trace_recording(void) {
+  heap_t *heap = h_init(20480, false, 0.9);
+  char path[] = "/tmp/gc_trace_XXXXXX";
+  int fd = mkstemp(path);
+  CU_ASSERT_TRUE(fd >= 0);
+  close(fd);
+  CU_ASSERT_TRUE(h_trace_start(heap, path));
+  CU_ASSERT_FALSE(h_trace_start(heap, path));
+
+  struct node_trace *volatile kept[1];
+  struct node_trace *first = h_alloc_struct(heap, "*i");
+  kept[0] = h_alloc_struct(heap, "*i");
+  H_STORE(heap, kept[0], next, first);
+  first = NULL;
+  alloc_garbage(heap);
+  scrub_stack();
+  h_gc(heap);
+  CU_ASSERT_PTR_NOT_NULL(kept[0]->next);
+  CU_ASSERT_TRUE(h_trace_stop(heap));
+  CU_ASSERT_FALSE(h_trace_stop(heap));
+  // a plain store without a trace
+  H_STORE(heap, kept[0], next, NULL);
+  CU_ASSERT_PTR_NULL(kept[0]->next);
+
+  uint8_t data[256];
+  FILE *file = fopen(path, "rb");
+  size_t size = fread(data, 1, sizeof(data), file);
+  fclose(file);
+  unlink(path);
+  CU_ASSERT_TRUE(size > TRACE_MAGIC_SIZE);
+  CU_ASSERT_EQUAL(memcmp(data, TRACE_MAGIC, TRACE_MAGIC_SIZE), 0);
+  const uint8_t *p = data + TRACE_MAGIC_SIZE;
+  CU_ASSERT_EQUAL(trace_varint(&p), 20480);
+  for (int i = 0; i < 2; i++) {
+    CU_ASSERT_EQUAL(*p++, TRACE_ALLOC_STRUCT);
+    CU_ASSERT_EQUAL(trace_varint(&p), 2);
+    CU_ASSERT_EQUAL(memcmp(p, "*i", 2), 0);
+    p += 2;
+  }
+  // the second object points to the first
+  CU_ASSERT_EQUAL(*p++, TRACE_STORE);
+  CU_ASSERT_EQUAL(trace_varint(&p), 2);
+  CU_ASSERT_EQUAL(trace_varint(&p), 0);
+  CU_ASSERT_EQUAL(trace_varint(&p), 1);
+  CU_ASSERT_EQUAL(trace_varint(&p), 0);
+  CU_ASSERT_EQUAL(*p++, TRACE_ALLOC_RAW);
+  CU_ASSERT_EQUAL(trace_varint(&p), 1000);
+  // the raw object died in the collection
+  CU_ASSERT_EQUAL(*p++, TRACE_DEATH);
+  CU_ASSERT_EQUAL(trace_varint(&p), 3);
+  CU_ASSERT_EQUAL(*p++, TRACE_GC);
+  CU_ASSERT_EQUAL(*p++, TRACE_END);
+  CU_ASSERT_EQUAL(p, data + size);
+  h_delete(heap);
+}
+
+typedef struct {
+  heap_t *heap;
+  int ready;
+  int go;
+  bool intact;
+} store_worker_t;
+
+static void wait_for(int *flag) {
+  while (!__atomic_load_n(flag, __ATOMIC_ACQUIRE)) {
+    sched_yield();
+  }
+}
+
+// the store waits for the lock while the main thread collects, it must land
+// in the moved object although the stack is not scanned
+static void *store_worker(void *arg) {
+  store_worker_t *w = arg;
+  h_thread_attach(w->heap);
+  H_ROOT_SCOPE(w->heap);
+  struct node_trace *holder = h_alloc_struct(w->heap, "*i");
+  struct node_trace *value = h_alloc_struct(w->heap, "*i");
+  h_push_root(w->heap, &holder);
+  h_push_root(w->heap, &value);
+  __atomic_store_n(&w->ready, 1, __ATOMIC_RELEASE);
+  wait_for(&w->go);
+  H_STORE(w->heap, holder, next, value);
+  w->intact = holder->next == value;
+  h_thread_detach(w->heap);
+  return NULL;
+}
+
+void test_trace_store_precise_roots(void) {
+  heap_t *heap = h_init(20480, false, 0.9);
+  h_set_root_mode(heap, ROOT_MODE_PRECISE);
+  char path[] = "/tmp/gc_trace_XXXXXX";
+  int fd = mkstemp(path);
+  CU_ASSERT_TRUE(fd >= 0);
+  close(fd);
+  CU_ASSERT_TRUE(h_trace_start(heap, path));
+
+  store_worker_t w = {heap, 0, 0, false};
+  pthread_t thread;
+  pthread_create(&thread, NULL, store_worker, &w);
+  wait_for(&w.ready);
+  // the worker's next safepoint is the lock of the store
+  heap_lock(heap);
+  __atomic_store_n(&w.go, 1, __ATOMIC_RELEASE);
+  gc_collect(heap);
+  heap_unlock(heap);
+  pthread_join(thread, NULL);
+
+  CU_ASSERT_EQUAL(heap->gc_policy.info.collections, 1);
+  CU_ASSERT_TRUE(w.intact);
+  CU_ASSERT_TRUE(h_trace_stop(heap));
+  unlink(path);
+  h_delete(heap);
+}
+
+int trace_tests() {
+  CU_pSuite pSuite = CU_add_suite("trace_tests", NULL, NULL);
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ((NULL == CU_add_test(pSuite, "test trace recording",
+                           test_trace_recording)) ||
+      (NULL == CU_add_test(pSuite, "test traced store with precise roots",
+                           test_trace_store_precise_roots)) ||
+      false) {
+
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
@@ -0,0 +1,343 @@
+#include "../src/gc.h"
+#include "../src/snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+  Reads a snapshot written by h_dump_snapshot and prints the objects that
+  keep the most memory alive.
+
+  Every object is a node, a virtual root node has an edge to the object of
+  every root and every pointer field is an edge to the object it points
+  into. The immediate dominators are computed with the iterative algorithm
+  of Cooper, Harvey and Kennedy over a depth first order from the virtual
+  root. The retained size of an object is its own size plus the sizes of all
+  objects it dominates, i.e. what a collection would free if the object were
+  unreachable.
+
+  usage: ./snapshot_tool <snapshot file> [number of objects to list]
+*/
+
+typedef struct snapshot {
+  size_t count;        // objects, node i + 1 is object i
+  uint64_t *address;   // pointer just after the header, ascending
+  uint64_t *header;
+  uint64_t *size;
+  size_t *edge_start;  // edges of node n are edges[edge_start[n] ..
+  size_t *edges;       //                       edge_start[n + 1])
+} snapshot_t;
+
+typedef struct words {
+  uint64_t *data;
+  size_t size;
+  size_t capacity;
+} words_t;
+
+static void push(words_t *w, uint64_t word) {
+  if (w->size == w->capacity) {
+    w->capacity = w->capacity ? w->capacity * 2 : 1024;
+    w->data = realloc(w->data, w->capacity * sizeof(uint64_t));
+    if (!w->data) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+  w->data[w->size++] = word;
+}
+
+static bool read_word(FILE *in, uint64_t *word) {
+  return fread(word, sizeof(uint64_t), 1, in) == 1;
+}
+
+// the object that `value` points into, 0 if none (node numbers)
+static size_t node_of(snapshot_t *s, uint64_t value) {
+  size_t lo = 0;
+  size_t hi = s->count;
+  // last object whose header starts at or below value
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (s->address[mid] - 8 <= value) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) {
+    return 0;
+  }
+  size_t i = lo - 1;
+  uint64_t start = s->address[i] - 8;
+  return value < start + s->size[i] ? i + 1 : 0;
+}
+
+static bool load(const char *path, snapshot_t *s) {
+  FILE *in = fopen(path, "rb");
+  if (!in) {
+    perror(path);
+    return false;
+  }
+  uint64_t magic, version, heap_start, heap_size;
+  if (!read_word(in, &magic) || magic != SNAPSHOT_MAGIC ||
+      !read_word(in, &version) || version != SNAPSHOT_VERSION ||
+      !read_word(in, &heap_start) || !read_word(in, &heap_size)) {
+    fprintf(stderr, "%s: not a heap snapshot\n", path);
+    fclose(in);
+    return false;
+  }
+
+  words_t roots = {0}, address = {0}, header = {0}, size = {0};
+  words_t targets = {0}, target_start = {0};
+  bool complete = false;
+  uint64_t word;
+  while (!complete && read_word(in, &word)) {
+    uint64_t a, b, c;
+    switch (word & 0xff) {
+    case SNAPSHOT_ROOT:
+      if (!read_word(in, &a) || !read_word(in, &b)) {
+        break;
+      }
+      push(&roots, b);
+      break;
+    case SNAPSHOT_OBJECT:
+      if (!read_word(in, &a) || !read_word(in, &b) || !read_word(in, &c)) {
+        break;
+      }
+      if (address.size > 0 && a <= address.data[address.size - 1]) {
+        fprintf(stderr, "%s: objects out of order\n", path);
+        fclose(in);
+        return false;
+      }
+      push(&address, a);
+      push(&header, b);
+      push(&size, c);
+      push(&target_start, targets.size);
+      for (uint64_t i = 0; i < word >> 8 && read_word(in, &a); i++) {
+        push(&targets, a);
+      }
+      break;
+    case SNAPSHOT_END:
+      complete = read_word(in, &a) && read_word(in, &b) &&
+                 a == address.size && b == roots.size;
+      break;
+    default:
+      fclose(in);
+      fprintf(stderr, "%s: unknown record %llu\n", path,
+              (unsigned long long)word);
+      return false;
+    }
+  }
+  fclose(in);
+  if (!complete) {
+    fprintf(stderr, "%s: truncated snapshot\n", path);
+    return false;
+  }
+
+  s->count = address.size;
+  s->address = address.data;
+  s->header = header.data;
+  s->size = size.data;
+  push(&target_start, targets.size);
+
+  // node 0 is the virtual root, resolve every target to a node
+  s->edge_start = malloc((s->count + 2) * sizeof(size_t));
+  s->edges = malloc((roots.size + targets.size + 1) * sizeof(size_t));
+  size_t edges = 0;
+  s->edge_start[0] = 0;
+  for (size_t r = 0; r < roots.size; r++) {
+    size_t node = node_of(s, roots.data[r]);
+    if (node) {
+      s->edges[edges++] = node;
+    }
+  }
+  for (size_t i = 0; i < s->count; i++) {
+    s->edge_start[i + 1] = edges;
+    for (size_t t = target_start.data[i]; t < target_start.data[i + 1]; t++) {
+      size_t node = node_of(s, targets.data[t]);
+      if (node) {
+        s->edges[edges++] = node;
+      }
+    }
+  }
+  s->edge_start[s->count + 1] = edges;
+  free(roots.data);
+  free(targets.data);
+  free(target_start.data);
+  return true;
+}
+
+#define UNVISITED ((size_t)-1)
+
+// postorder numbers from an iterative depth first search, `order` gets the
+// nodes by postorder number, returns how many nodes are reachable
+static size_t depth_first(snapshot_t *s, size_t *number, size_t *order) {
+  size_t nodes = s->count + 1;
+  size_t *stack = malloc(nodes * sizeof(size_t));
+  size_t *next_edge = malloc(nodes * sizeof(size_t));
+  bool *seen = calloc(nodes, sizeof(bool));
+  size_t depth = 0;
+  size_t done = 0;
+  for (size_t n = 0; n < nodes; n++) {
+    number[n] = UNVISITED;
+  }
+
+  stack[depth++] = 0;
+  seen[0] = true;
+  next_edge[0] = s->edge_start[0];
+  while (depth > 0) {
+    size_t n = stack[depth - 1];
+    if (next_edge[n] < s->edge_start[n + 1]) {
+      size_t m = s->edges[next_edge[n]++];
+      if (!seen[m]) {
+        seen[m] = true;
+        next_edge[m] = s->edge_start[m];
+        stack[depth++] = m;
+      }
+      continue;
+    }
+    depth--;
+    number[n] = done;
+    order[done++] = n;
+  }
+  free(stack);
+  free(next_edge);
+  free(seen);
+  return done;
+}
+
+static size_t intersect(size_t *idom, size_t *number, size_t a, size_t b) {
+  while (a != b) {
+    while (number[a] < number[b]) {
+      a = idom[a];
+    }
+    while (number[b] < number[a]) {
+      b = idom[b];
+    }
+  }
+  return a;
+}
+
+// immediate dominator of every reachable node, UNVISITED otherwise
+static size_t *dominators(snapshot_t *s, size_t *number, size_t *order,
+                          size_t reachable) {
+  size_t nodes = s->count + 1;
+  // predecessors, in the same compressed layout as the edges
+  size_t *pred_start = calloc(nodes + 1, sizeof(size_t));
+  size_t *preds = malloc((s->edge_start[nodes] + 1) * sizeof(size_t));
+  for (size_t e = 0; e < s->edge_start[nodes]; e++) {
+    pred_start[s->edges[e] + 1]++;
+  }
+  for (size_t n = 0; n < nodes; n++) {
+    pred_start[n + 1] += pred_start[n];
+  }
+  size_t *fill = malloc(nodes * sizeof(size_t));
+  memcpy(fill, pred_start, nodes * sizeof(size_t));
+  for (size_t n = 0; n < nodes; n++) {
+    for (size_t e = s->edge_start[n]; e < s->edge_start[n + 1]; e++) {
+      preds[fill[s->edges[e]]++] = n;
+    }
+  }
+  free(fill);
+
+  size_t *idom = malloc(nodes * sizeof(size_t));
+  for (size_t n = 0; n < nodes; n++) {
+    idom[n] = UNVISITED;
+  }
+  idom[0] = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    // reverse postorder, the virtual root is last in postorder
+    for (size_t i = reachable - 1; i-- > 0;) {
+      size_t n = order[i];
+      size_t new_idom = UNVISITED;
+      for (size_t p = pred_start[n]; p < pred_start[n + 1]; p++) {
+        size_t pred = preds[p];
+        if (idom[pred] == UNVISITED) {
+          continue;
+        }
+        new_idom = new_idom == UNVISITED
+                       ? pred
+                       : intersect(idom, number, pred, new_idom);
+      }
+      if (idom[n] != new_idom) {
+        idom[n] = new_idom;
+        changed = true;
+      }
+    }
+  }
+  free(pred_start);
+  free(preds);
+  return idom;
+}
+
+static uint64_t *retained_sizes;
+
+static int by_retained(const void *a, const void *b) {
+  uint64_t x = retained_sizes[*(const size_t *)a];
+  uint64_t y = retained_sizes[*(const size_t *)b];
+  return (x < y) - (x > y);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <snapshot file> [count]\n", argv[0]);
+    return 1;
+  }
+  size_t top = argc > 2 ? strtoul(argv[2], NULL, 10) : 20;
+  snapshot_t s;
+  if (!load(argv[1], &s)) {
+    return 1;
+  }
+
+  size_t nodes = s.count + 1;
+  size_t *number = malloc(nodes * sizeof(size_t));
+  size_t *order = malloc(nodes * sizeof(size_t));
+  size_t reachable = depth_first(&s, number, order);
+  size_t *idom = dominators(&s, number, order, reachable);
+
+  // children come before their dominator in postorder
+  retained_sizes = calloc(nodes, sizeof(uint64_t));
+  uint64_t total = 0;
+  for (size_t i = 0; i < s.count; i++) {
+    retained_sizes[i + 1] = s.size[i];
+    total += s.size[i];
+  }
+  for (size_t i = 0; i + 1 < reachable; i++) {
+    size_t n = order[i];
+    retained_sizes[idom[n]] += retained_sizes[n];
+  }
+
+  printf("%zu objects, %llu bytes, %zu reachable from %zu roots\n", s.count,
+         (unsigned long long)total, reachable - 1,
+         s.edge_start[1] - s.edge_start[0]);
+  size_t *ranked = malloc(nodes * sizeof(size_t));
+  size_t ranked_count = 0;
+  for (size_t i = 0; i + 1 < reachable; i++) {
+    ranked[ranked_count++] = order[i];
+  }
+  qsort(ranked, ranked_count, sizeof(size_t), by_retained);
+
+  printf("%12s %8s %18s  %s\n", "retained", "self", "address", "layout");
+  for (size_t i = 0; i < ranked_count && i < top; i++) {
+    size_t n = ranked[i];
+    char layout[64];
+    h_census_describe(s.header[n - 1], layout, sizeof(layout));
+    printf("%12llu %8llu %#18llx  %s\n",
+           (unsigned long long)retained_sizes[n],
+           (unsigned long long)s.size[n - 1],
+           (unsigned long long)s.address[n - 1], layout);
+  }
+
+  free(ranked);
+  free(retained_sizes);
+  free(idom);
+  free(order);
+  free(number);
+  free(s.address);
+  free(s.header);
+  free(s.size);
+  free(s.edge_start);
+  free(s.edges);
+  return 0;
+}